@@ -8,10 +8,14 @@
 #ifndef HEADERS_ROCKET_FS_H_
 #define HEADERS_ROCKET_FS_H_
 
+#include "async.h"
 #include "filesystem.h"
+#include "fsck.h"
+#include "journal.h"
+#include "series.h"
 
-#define RFS_VERSION 15102019
-#define API_VERSION 20102019
+#define RFS_VERSION 18102026
+#define API_VERSION 18102026
 
 
 #endif /* HEADERS_ROCKET_FS_H_ */
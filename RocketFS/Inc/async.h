@@ -0,0 +1,133 @@
+/*
+ * async.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#ifndef INC_ASYNC_H_
+#define INC_ASYNC_H_
+
+/*
+ * Cooperative streams (C++20 coroutines only)
+ *
+ * Tasks co_await the stream operations, which the executor performs in steps, each one once the devices of the
+ * filesystem are idle (see the busy callback of rocket_fs_bind()). A step writes or reads half a block at most, so that
+ * it crosses one block boundary at most, and a free block is erased ahead after each write step: instead of waiting for
+ * the erase, the executor runs the tasks of the other filesystems (or devices) in the meantime.
+ *
+ * All tasks run on the thread which calls AsyncExecutor::run(). Whenever all of them wait for a device, idle() is called,
+ * e.g. to yield the CPU to the other threads (sched_yield() on Linux) or to sleep until a device interrupt.
+ *
+ * Priorities
+ *
+ * Each task has a priority (0: most urgent, e.g. flight state records). The executor always performs the next step of
+ * the most urgent operation whose filesystem is idle, the operations of the same priority in turn. A write step only
+ * erases a block ahead if no more urgent operation waits for the same filesystem: the erases of the bulk streams are
+ * deferred while the critical ones are served.
+ * Steps are not interrupted, so that the latency of a critical operation is bounded by one step of another task
+ * (half a block and one erase at most), plus its own steps. On devices which suspend erases (see rocket_fs_bind()), reads
+ * and the writes of priority 0 do not wait for the erase ahead: it is suspended until none of them waits any more, unless
+ * they access the erased block (a write which takes it, or a flush). With a clock, the latencies (from the co_await to the end of
+ * the operation) are recorded per priority, with the number of operations which exceeded the budget of their priority.
+ */
+#ifdef __cpp_impl_coroutine
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <coroutine>
+
+#include "filesystem.h"
+
+#ifndef ASYNC_MAX_TASKS
+#define ASYNC_MAX_TASKS 8
+#endif
+
+#ifndef ASYNC_PRIORITIES
+#define ASYNC_PRIORITIES 4
+#endif
+
+#define ASYNC_LATENCY_BUCKETS 24 // Bucket n counts the latencies of [2^(n-1), 2^n) ticks of the clock, bucket 0 those of 0 tick
+
+class AsyncExecutor;
+
+/*
+ * Coroutine handed to AsyncExecutor::spawn(), which owns it from then on. It runs once the executor runs.
+ */
+class AsyncTask {
+public:
+	struct promise_type {
+		AsyncExecutor* executor = 0;
+		uint8_t priority = 0;
+
+		AsyncTask get_return_object() { return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() {}
+	};
+
+	explicit AsyncTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+	AsyncTask(AsyncTask&& task) : handle(task.handle) { task.handle = 0; }
+	AsyncTask(const AsyncTask&) = delete;
+	~AsyncTask();
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+typedef enum AsyncOperationType { ASYNC_WRITE, ASYNC_READ, ASYNC_FLUSH } AsyncOperationType;
+
+/*
+ * Awaitable stream operation. The result of co_await is the number of bytes written or read.
+ */
+class AsyncOperation {
+public:
+	bool await_ready() { return false; } // Always performed by the executor, which checks the devices first
+	void await_suspend(std::coroutine_handle<AsyncTask::promise_type> task);
+	int32_t await_resume() { return done; }
+
+	AsyncOperationType type;
+	FileSystem* fs;
+	Stream* stream;
+	uint8_t* buffer;
+	uint32_t length;
+	uint32_t done;
+
+	std::coroutine_handle<> task;
+	uint8_t priority;
+	uint32_t ticket;      // Order of the operations of the same priority
+	uint32_t start_time;  // Clock at the co_await
+	AsyncOperation* next; // Next operation waiting for the executor
+};
+
+typedef struct AsyncLatency {
+	uint32_t histogram[ASYNC_LATENCY_BUCKETS];
+	uint32_t worst;
+	uint32_t budget;   // 0: none
+	uint32_t overruns; // Operations whose latency exceeded the budget
+} AsyncLatency;
+
+class AsyncExecutor {
+public:
+	AsyncExecutor(uint32_t (*clock)() = 0); // Without a clock, no latency is recorded
+
+	bool spawn(AsyncTask& task, uint8_t priority = ASYNC_PRIORITIES - 1); // Returns false if ASYNC_MAX_TASKS tasks are spawned already
+	void run(void (*idle)() = 0); // Returns once all tasks are complete (idle: 0 to poll the devices continuously)
+	void wait(AsyncOperation* operation);
+
+	std::coroutine_handle<AsyncTask::promise_type> tasks[ASYNC_MAX_TASKS];
+	uint8_t task_count;
+	AsyncOperation* waiting;
+	uint32_t next_ticket;
+
+	uint32_t (*clock)();
+	AsyncLatency latency[ASYNC_PRIORITIES];
+};
+
+AsyncOperation rocket_fs_co_write(Stream* stream, uint8_t* buffer, uint32_t length);
+AsyncOperation rocket_fs_co_read(Stream* stream, uint8_t* buffer, uint32_t length); // Stops at the end of the file
+AsyncOperation rocket_fs_co_flush(FileSystem* fs);
+
+#endif
+
+#endif /* INC_ASYNC_H_ */
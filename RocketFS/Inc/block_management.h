@@ -14,19 +14,47 @@
 #include "filesystem.h"
 
 
-typedef enum AccessType { READ, WRITE } AccessType;
+#define BLOCK_HEADER_SIZE 40
+#define BLOCK_MAGIC_PREFIX 0xC0FFEE00
+#define BAD_BLOCK_META 0xEF // Partition entry of a retired block (NAND): immortal, and of no file type
 
-void rfs_init_block_management(FileSystem* fs);
+typedef enum AccessType { READ, WRITE } AccessType;
 
-uint16_t rfs_block_alloc(FileSystem* fs, FileType type);
-void rfs_block_free(FileSystem* fs, uint16_t block_id);
-void rfs_block_write_header(FileSystem* fs, uint16_t block_id, uint16_t file_id, uint16_t predecessor);
+typedef struct BlockHeader {
+	uint32_t magic;
+	uint32_t file_id;
+	uint32_t predecessor;
+	uint32_t successor;
+	uint64_t usage_table;
+} BlockHeader;
+
+void rfs_init_block_management(FileSystem* fs, bool lazy);
+
+uint32_t rfs_block_alloc(FileSystem* fs, FileType type);
+uint32_t rfs_block_alloc_mirror(FileSystem* fs, FileType type, uint32_t original, uint8_t copy, uint8_t copies);
+void rfs_block_free(FileSystem* fs, uint32_t block_id);
+bool rfs_block_erase(FileSystem* fs, uint32_t block_id);
+bool rfs_block_erase_ahead(FileSystem* fs);
+void rfs_block_settle_erase(FileSystem* fs);
+uint32_t rfs_block_erase_count(FileSystem* fs, uint32_t block_id);
+void rfs_block_write_header(FileSystem* fs, uint32_t block_id, uint32_t file_id, uint32_t predecessor, uint32_t used_end = BLOCK_HEADER_SIZE);
+bool rfs_block_read_header(FileSystem* fs, uint32_t block_id, BlockHeader* header);
+uint32_t rfs_block_successor(FileSystem* fs, uint32_t block_id);
+uint32_t rfs_block_mirror(FileSystem* fs, File* file, File* mirror, uint32_t block_id);
 
 int32_t rfs_access_memory(FileSystem* fs, uint32_t* address, uint32_t length, AccessType access_type);
 
-uint16_t rfs_load_file_meta(FileSystem* fs, File* file);
-void rfs_set_file_root(FileSystem* fs, uint16_t block_id);
-uint32_t rfs_compute_block_length(FileSystem* fs, uint16_t block_id);
-uint32_t rfs_get_block_base_address(FileSystem* fs, uint16_t block_id);
+uint32_t rfs_load_file_meta(FileSystem* fs, File* file);
+void rfs_resolve_file(FileSystem* fs, File* file);
+void rfs_ring_init(FileSystem* fs, File* file, uint32_t block_budget);
+void rfs_set_file_root(FileSystem* fs, uint32_t block_id);
+FileType rfs_get_file_type(FileSystem* fs, File* file);
+void rfs_clear_file_extents(File* file);
+void rfs_append_file_extent(File* file, uint32_t block_id);
+uint32_t rfs_compute_block_length(FileSystem* fs, uint32_t block_id);
+uint32_t rfs_compute_block_end(FileSystem* fs, uint32_t block_id);
+void rfs_block_record_end(FileSystem* fs, File* file, bool seal = false);
+bool rfs_block_sealed(FileSystem* fs, uint32_t block_id);
+uint32_t rfs_get_block_base_address(FileSystem* fs, uint32_t block_id);
 
 #endif /* INC_BLOCK_MANAGEMENT_H_ */
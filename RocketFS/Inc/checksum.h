@@ -0,0 +1,31 @@
+/*
+ * checksum.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#ifndef INC_CHECKSUM_H_
+#define INC_CHECKSUM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "filesystem.h"
+
+
+#define CHECKSUM_SIZE 4
+#define CHUNK_FILL_SIZE (CHECKSUM_CHUNK_SIZE > 256 ? 2 : 1) // Bytes of the trailer which hold the end of the data of the chunk
+
+uint32_t rfs_crc32c(uint32_t crc, const uint8_t* buffer, uint32_t length);
+
+bool rfs_chunk_type(FileType type);
+uint32_t rfs_chunk_size(FileType type);
+uint32_t rfs_chunk_data_begin(FileSystem* fs, uint32_t chunk_address);
+uint32_t rfs_chunk_data_end(FileType type);
+uint32_t rfs_chunk_fill(FileType type, const uint8_t* chunk);
+
+int32_t rfs_chunk_check(FileSystem* fs, FileType type, uint32_t chunk_address, uint8_t* chunk);
+uint32_t rfs_chunk_check_block(FileSystem* fs, FileType type, uint32_t block_id);
+
+#endif /* INC_CHECKSUM_H_ */
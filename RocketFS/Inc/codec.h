@@ -0,0 +1,23 @@
+/*
+ * codec.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#ifndef INC_CODEC_H_
+#define INC_CODEC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "filesystem.h"
+
+
+#define CODEC_FRAME_MAX (3 + STREAM_CHUNK_SIZE) // Largest encoded frame, with its terminator
+#define CODEC_PADDING 0xFF                      // Erased byte found instead of a frame header
+
+uint32_t rfs_codec_encode(uint32_t* history, const uint8_t* raw, uint32_t length, uint8_t* frame);
+int32_t rfs_codec_decode(uint32_t* history, const uint8_t* frame, uint32_t available, uint8_t* raw, uint32_t* length);
+
+#endif /* INC_CODEC_H_ */
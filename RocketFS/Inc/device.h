@@ -0,0 +1,27 @@
+/*
+ * device.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#ifndef INC_DEVICE_H_
+#define INC_DEVICE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "filesystem.h"
+
+
+void rfs_device_read(FileSystem* fs, uint32_t address, uint8_t* buffer, uint32_t length);
+void rfs_device_write(FileSystem* fs, uint32_t address, uint8_t* buffer, uint32_t length);
+bool rfs_device_erase(FileSystem* fs, uint32_t address);
+bool rfs_device_suspend(FileSystem* fs);
+void rfs_device_resume(FileSystem* fs);
+const uint8_t* rfs_device_pointer(FileSystem* fs, uint32_t address);
+void rfs_device_sync(FileSystem* fs);
+bool rfs_device_bad_block(FileSystem* fs, uint32_t block_id);
+void rfs_device_clear_cache(FileSystem* fs);
+
+#endif /* INC_DEVICE_H_ */
@@ -0,0 +1,20 @@
+/*
+ * ecc.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#ifndef INC_ECC_H_
+#define INC_ECC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "filesystem.h"
+
+
+void rfs_ecc_update(uint8_t* parity, const uint8_t* buffer, uint32_t length);
+int32_t rfs_ecc_correct(uint8_t* codeword, uint32_t length);
+
+#endif /* INC_ECC_H_ */
@@ -0,0 +1,35 @@
+/*
+ * encoding.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#ifndef INC_ENCODING_H_
+#define INC_ENCODING_H_
+
+#include <stdint.h>
+
+
+/*
+ * Little-endian encoding utilities, shared by every structure stored on the device
+ */
+static inline uint32_t __decode32(const uint8_t* buffer) {
+	uint32_t composition = 0UL;
+
+	composition |= (uint32_t) buffer[3] << 24;
+	composition |= (uint32_t) buffer[2] << 16;
+	composition |= (uint32_t) buffer[1] << 8;
+	composition |= (uint32_t) buffer[0];
+
+	return composition;
+}
+
+static inline void __encode32(uint8_t* buffer, uint32_t value) {
+	buffer[0] = (uint8_t) (value);
+	buffer[1] = (uint8_t) (value >> 8);
+	buffer[2] = (uint8_t) (value >> 16);
+	buffer[3] = (uint8_t) (value >> 24);
+}
+
+#endif /* INC_ENCODING_H_ */
@@ -12,17 +12,57 @@
 #include <stdbool.h>
 
 
-typedef enum FileType { EMPTY, RAW, ECC, CHECKSUM, LOW_REDUNDANCE, HIGH_REDUNDANCE, FOURIER_REDUNDANCE } FileType;
+/*
+ * LOW_REDUNDANCE and HIGH_REDUNDANCE files are mirrored on 1 and 2 REPLICA chains.
+ * COMPRESSED files are delta-encoded and bit-packed by the stream (see codec.cpp).
+ * CIRCULAR files hold raw data in a ring of at most block_budget blocks, whose oldest block is reused when the ring is full.
+ */
+typedef enum FileType { EMPTY, RAW, ECC, CHECKSUM, LOW_REDUNDANCE, HIGH_REDUNDANCE, FOURIER_REDUNDANCE, REPLICA, COMPRESSED, CIRCULAR } FileType;
+
+class Stream;
+
+#define MAX_REPLICAS 2
+#define NO_FILE 0xFF
+
+/*
+ * Number of runs of consecutive block IDs cached per file.
+ * A chain which needs more runs than that is resolved from the block headers beyond the last cached run.
+ */
+#ifndef FILE_EXTENTS
+#define FILE_EXTENTS 8
+#endif
+
+typedef struct Extent {
+	uint32_t first_block;
+	uint32_t length;
+} Extent;
 
-// 32 bytes
 typedef struct File {
 	char filename[16];
 	uint32_t hash;
-	uint16_t first_block;
-	uint16_t last_block;
-	uint32_t length;
-	uint16_t used_blocks;
-	uint16_t reserved;
+	uint32_t first_block;
+	uint32_t last_block;
+	uint32_t lost_block;  // Head of the chain fragment detached when a block of this file was recycled
+	uint32_t break_block; // Block after which the chain continues at lost_block
+	uint32_t length;      // Number of bytes stored after the block headers (and after the filename)
+	uint32_t tail_offset; // Offset of the end of the data in the last block, kept exact by every write
+	uint32_t used_blocks;
+
+	Extent extents[FILE_EXTENTS]; // Chain of the file, in order
+	uint8_t extent_count;
+	bool extents_complete;        // The last extent ends with the last block of the file
+
+	uint8_t primary;               // File ID of the mirrored file if this chain is a replica, NO_FILE otherwise
+	uint8_t replica_count;
+	uint8_t replicas[MAX_REPLICAS]; // File IDs of the replicas
+	uint8_t degraded;              // Copies found corrupted (bit 0: this chain, bit 1 + n: replica n)
+
+	uint32_t head_block;   // CIRCULAR files: block of the ring holding the oldest data (0 while the ring is empty)
+	uint32_t block_budget; // CIRCULAR files: maximal number of blocks of the ring
+
+	Stream* writer; // Last stream opened to write the file, whose pending bytes are served to its FOLLOW streams
+
+	bool resolved; // The chain was walked since the mount (a lazy mount only loads the root)
 } File;
 
 
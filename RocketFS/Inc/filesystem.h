@@ -16,19 +16,127 @@
 
 /*
  * FS-specific defines
+ *
+ * The geometry may be overridden at build time (e.g. -DNUM_BLOCKS=16320 for a 64MB device with 4KB subsectors).
+ * NUM_BLOCKS is the maximal number of blocks of a filesystem: smaller devices or partitions use fewer blocks.
  */
+#ifndef NUM_BLOCKS
 #define NUM_BLOCKS 4080
+#endif
+
+#ifndef NUM_FILES
 #define NUM_FILES 16
-#define PROTECTED_BLOCKS 8
+#endif
+
+#define FORMAT_VERSION 3 // Stored in the least significant byte of every block magic number
 
+/*
+ * The partition table is split in pages of PARTITION_PAGE_SIZE entries.
+ * Page n is stored in block 1 + n and only CACHED_PARTITION_PAGES pages are kept in memory,
+ * so that the RAM footprint does not grow with the size of the device.
+ */
+#ifndef PARTITION_PAGE_SIZE
+#define PARTITION_PAGE_SIZE 2048
+#endif
 
+#define PARTITION_PAGES ((NUM_BLOCKS + PARTITION_PAGE_SIZE - 1) / PARTITION_PAGE_SIZE)
+
+#ifndef CACHED_PARTITION_PAGES
+#define CACHED_PARTITION_PAGES (PARTITION_PAGES < 4 ? PARTITION_PAGES : 4)
+#endif
 
 /*
- * Since stm32f446 only has 128KB memory, we cannot afford more than 16-bytes data-blocks...
+ * The first CACHED_HEADER_SIZE bytes of a block (magic number, file ID, predecessor, successor, usage table and tail log)
+ * are cached for the CACHED_HEADERS most recently used blocks. Size it per board with rocket_fs_cache_stats().
  */
-typedef struct DataBlock {
-	uint16_t successor;
-} DataBlock;
+#ifndef CACHED_HEADERS
+#define CACHED_HEADERS 32
+#endif
+
+#define CACHED_HEADER_SIZE 32
+
+#ifndef MAX_DEVICES
+#define MAX_DEVICES 4 // Maximal number of devices the blocks can be striped across
+#endif
+
+/*
+ * Free blocks erased more than WEAR_LEVELING_THRESHOLD times above the least worn free block are skipped by the allocator,
+ * which inspects at most WEAR_LEVELING_PROBES free blocks per allocation.
+ */
+#ifndef WEAR_LEVELING_THRESHOLD
+#define WEAR_LEVELING_THRESHOLD 64
+#endif
+
+#ifndef WEAR_LEVELING_PROBES
+#define WEAR_LEVELING_PROBES 4
+#endif
+
+/*
+ * NAND flash devices (see rocket_fs_nand()) are only supported when RFS_NAND is defined. They are programmed by whole pages,
+ * staged in NAND_STAGED_PAGES buffers of NAND_MAX_PAGE_SIZE bytes: one per stream written at the same time avoids
+ * programming pages several times. NOR builds leave the buffers out of the FileSystem.
+ */
+#ifdef RFS_NAND
+#ifndef NAND_MAX_PAGE_SIZE
+#define NAND_MAX_PAGE_SIZE 2048
+#endif
+
+#ifndef NAND_STAGED_PAGES
+#define NAND_STAGED_PAGES 2
+#endif
+#endif
+
+#define STREAM_CHUNK_SIZE 64 // Integrity checks of ECC files are computed per chunk
+#define ECC_PARITY_SIZE 8     // Up to ECC_PARITY_SIZE / 2 corrupted bytes are corrected in each chunk of ECC files
+
+/*
+ * CHECKSUM and mirrored files carry a 4-byte CRC32C per chunk of CHECKSUM_CHUNK_SIZE bytes (a multiple of
+ * STREAM_CHUNK_SIZE dividing the block size): the larger the chunk, the fewer trailer bytes are programmed
+ * (2% with 256 bytes, the end of the data of the chunk included), but the larger the buffer of each Stream and the more is lost to a single corrupted byte.
+ */
+#ifndef CHECKSUM_CHUNK_SIZE
+#define CHECKSUM_CHUNK_SIZE 256
+#endif
+#define CODEC_FRAME_WORDS (STREAM_CHUNK_SIZE / 4) // COMPRESSED files are encoded in frames of STREAM_CHUNK_SIZE bytes
+
+
+
+typedef struct Device {
+	void (*read)(uint32_t address, uint8_t* buffer, uint32_t length);
+	void (*write)(uint32_t address, uint8_t* buffer, uint32_t length);
+	void (*erase_block)(uint32_t address);
+	const uint8_t* (*map)(uint32_t address); // Memory-mapped devices only (0 otherwise): address of the byte in memory
+	bool (*busy)();                           // Asynchronous devices only (0 otherwise): an erase or a program is in progress
+	bool (*erase_suspend)();                  // Optional: suspends the erase in progress, returns false if none was
+	void (*erase_resume)();                   // Optional: resumes the suspended erase
+	bool (*bad_block)(uint32_t address);      // NAND only (0 otherwise): reads the bad block marker of the block
+	bool (*failed)();                         // NAND only (0 otherwise): the last program or erase failed (status register)
+} Device;
+
+typedef struct PartitionPage {
+	uint16_t index;
+	bool loaded;
+	bool dirty;
+	uint32_t last_use;
+	uint8_t entries[PARTITION_PAGE_SIZE];
+} PartitionPage;
+
+typedef struct CachedHeader {
+	uint32_t block_id;
+	bool loaded;
+	bool dirty; // NAND policy: not programmed yet
+	uint32_t last_use;
+	uint8_t header[CACHED_HEADER_SIZE];
+} CachedHeader;
+
+#ifdef RFS_NAND
+typedef struct StagedPage {
+	uint32_t address;
+	bool staged;
+	uint32_t last_use;
+	uint8_t data[NAND_MAX_PAGE_SIZE];
+} StagedPage;
+#endif
 
 
 typedef struct FileSystem {
@@ -40,23 +148,61 @@ typedef struct FileSystem {
 	const char *id;
 	uint32_t addressable_space;
 	uint32_t block_size;
+	uint32_t partition_offset;     // Address of the first block of the filesystem on the device
+	uint32_t num_blocks;
+	uint32_t partition_page_count;
+	uint32_t protected_blocks;     // Core, partition, recovery, backup and journal blocks
 
 	uint32_t total_used_blocks;
-	uint8_t partition_table[NUM_BLOCKS];
-   uint8_t reverse_partition_table[NUM_BLOCKS];
+	PartitionPage partition_pages[CACHED_PARTITION_PAGES];
+	uint16_t partition_free[PARTITION_PAGES];    // Number of free entries in each page
+	uint8_t partition_min_age[PARTITION_PAGES];  // Lower bound of the relative time of the recyclable entries in each page (as stored)
+	uint32_t partition_epochs[PARTITION_PAGES];  // Epoch the relative times stored in each page are relative to
+	uint32_t partition_epoch;                    // Current epoch: advancing it ages all entries at once
+	uint32_t partition_clock;
 	bool partition_table_modified;
-	DataBlock data_blocks[NUM_BLOCKS];
+	uint32_t erased_block;       // Free block erased ahead of its allocation
+	uint32_t erased_block_count; // Erase count of the erased block, until it is programmed (0 once programmed)
+	Device* suspended_device;    // Device whose erase of the erased block is suspended (0 if none)
+	uint32_t wear_cursor;    // Next block inspected by the allocator
+	uint32_t wear_floor;     // Lowest erase count of the free blocks seen during the previous sweep
+	uint32_t wear_sweep_min; // Lowest erase count of the free blocks seen during the current sweep
+	CachedHeader header_cache[CACHED_HEADERS];
+	uint32_t header_clock;
+	uint32_t header_hits;
+	uint32_t header_misses;
+	uint32_t page_size;  // NAND policy: size of the pages, programmed at once (0: NOR policy, programmed byte-wise)
+#ifdef RFS_NAND
+	StagedPage staged_pages[NAND_STAGED_PAGES];
+	uint32_t page_clock;
+#endif
 	File files[NUM_FILES];
 
-	void (*read)(uint32_t address, uint8_t* buffer, uint32_t length);
-	void (*write)(uint32_t address, uint8_t* buffer, uint32_t length);
-	void (*erase_block)(uint32_t address);
+	Device devices[MAX_DEVICES];
+	uint8_t num_devices;
 	void (*erase_sector)(uint32_t address);
 
 	void (*log)(const char*);
 } FileSystem;
 
-typedef enum StreamMode { OVERWRITE, APPEND } StreamMode;
+typedef struct WearStats {
+	uint32_t min_erase_count;
+	uint32_t max_erase_count;
+	uint64_t total_erase_count;
+	uint32_t bad_blocks; // Retired blocks (NAND), whose erase counts are not taken into account
+} WearStats;
+
+typedef struct CacheStats {
+	uint32_t header_hits;   // Header reads served from memory since the mount
+	uint32_t header_misses; // Header reads which loaded the header from the device
+} CacheStats;
+
+/*
+ * FOLLOW streams read a file from the beginning of its last block while another stream writes it:
+ * the bytes become readable as soon as the write returns, the pending frame of a COMPRESSED writer being read from RAM.
+ * At the end of the data, read() sets eof and returns what it could read. The next read() resumes there.
+ */
+typedef enum StreamMode { OVERWRITE, APPEND, FOLLOW } StreamMode;
 
 class Stream {
 public:
@@ -65,10 +211,12 @@ public:
 	void close();
 
 	int32_t  read(uint8_t* buffer, uint32_t length);
+	int32_t  read_span(const uint8_t** span, uint32_t length); // Zero-copy read of a RAW file on a memory-mapped device
 	uint8_t  read8();
 	uint16_t read16();
 	uint32_t read32();
 	uint64_t read64();
+	uint32_t skip(uint32_t length); // Moves the read address forward, without reading RAW data
 
 	void write(uint8_t* buffer, uint32_t length);
 	void write8(uint8_t data);
@@ -82,28 +230,155 @@ public:
 	bool open;
 	uint32_t read_address;
 	uint32_t write_address;
+
+	uint32_t corrupted_chunks; // Number of chunks (or frames) read which could not be verified or corrected
+	uint32_t corrected_bytes;
+
+	File* file;               // Chunks failing their check are read from the replicas of this file (if any)
+	uint8_t replica_count;    // Every write is replayed on the replicas of the file
+
+	bool following;      // Read-only stream of a FOLLOW mode
+	uint8_t follow_skip; // Bytes of the next frame which were read from the pending frame of the writer already
+
+	/*
+	 * A stream only holds the state of the type of its file: init_stream() sets up the member of that type.
+	 */
+	union {
+		struct {
+			uint32_t write_chunk;      // Address of the chunk being written
+			uint32_t write_checksum;   // Running checksum of the chunk being written
+			uint8_t write_parity[ECC_PARITY_SIZE];
+			uint32_t read_chunk;       // Address of the chunk held in the buffer
+			uint8_t chunk[CHECKSUM_CHUNK_SIZE];
+			uint32_t replica_write_address[MAX_REPLICAS];
+			uint32_t replica_write_chunk[MAX_REPLICAS];
+			uint32_t replica_write_checksum[MAX_REPLICAS];
+		} checked; // CHECKSUM, ECC and mirrored files (RAW files keep no chunk)
+
+		struct {
+			uint8_t write_frame[STREAM_CHUNK_SIZE]; // Bytes waiting for their frame to be full
+			uint8_t write_frame_length;
+			uint8_t read_frame_length;
+			uint8_t read_frame_offset;
+			uint32_t write_history[CODEC_FRAME_WORDS];
+			uint32_t read_history[CODEC_FRAME_WORDS];
+			uint32_t read_block;                    // Block of the decoded frame
+			uint8_t read_frame[STREAM_CHUNK_SIZE];  // Decoded frame
+		} compressed; // COMPRESSED files
+	};
 };
 
+/*
+ * Position of a writer in its file, saved so that a single stream writes several files in turn (e.g. the columns of a series).
+ * Only the state which outlives a write is kept: the chunk trailer being computed, or the codec history.
+ */
+typedef struct StreamCursor {
+	File* file;
+	FileType type;
+	uint8_t replica_count;
+	uint32_t write_address;
+
+	union {
+		struct {
+			uint32_t write_chunk;
+			uint32_t write_checksum;
+			uint8_t write_parity[ECC_PARITY_SIZE];
+			uint32_t replica_write_address[MAX_REPLICAS];
+			uint32_t replica_write_chunk[MAX_REPLICAS];
+			uint32_t replica_write_checksum[MAX_REPLICAS];
+		} checked;
+
+		struct {
+			uint32_t write_history[CODEC_FRAME_WORDS];
+		} compressed;
+	};
+} StreamCursor;
+
 
 void rocket_fs_debug(FileSystem* fs, void (*logger)(const char*));
-void rocket_fs_device(FileSystem* fs, const char *id, uint32_t capacity, uint32_t block_size);
+/*
+ * The filesystem spans partition_length bytes from partition_offset (to the end of the device if partition_length is 0),
+ * so that several independent filesystems can share a single device. The blocks beyond NUM_BLOCKS are left unused
+ * (with a warning).
+ */
+void rocket_fs_device(FileSystem* fs, const char *id, uint32_t capacity, uint32_t block_size, uint32_t partition_offset = 0, uint32_t partition_length = 0);
 
+/*
+ * The map callback is optional: on memory-mapped devices (e.g. QSPI flash in XIP mode, images on a host), it returns
+ * the address in memory of a device address, so that RAW files can be read in place with Stream::read_span().
+ * The busy callback is optional as well: on devices whose program and erase callbacks return before the operation is
+ * complete (the next callback waiting for it), it tells whether the device is still busy. See async.h.
+ * With the erase_suspend and erase_resume callbacks, the erase of a block ahead of its allocation can be suspended, so that
+ * the other blocks are read and programmed in the meantime (see rocket_fs_suspend()). The device must not report
+ * itself busy while its erase is suspended.
+ */
 void rocket_fs_bind(
 	FileSystem* fs,
 	void (*read)(uint32_t, uint8_t*, uint32_t),
 	void (*write)(uint32_t, uint8_t*, uint32_t),
-	void (*erase_block)(uint32_t)
+	void (*erase_block)(uint32_t),
+	const uint8_t* (*map)(uint32_t) = 0,
+	bool (*busy)() = 0,
+	bool (*erase_suspend)() = 0,
+	void (*erase_resume)() = 0
+);
+
+/*
+ * Binds an additional device of the same model: blocks are striped round-robin across all bound devices.
+ * The capacity given to rocket_fs_device() is the capacity of all devices together.
+ */
+void rocket_fs_bind_device(
+	FileSystem* fs,
+	uint8_t device,
+	void (*read)(uint32_t, uint8_t*, uint32_t),
+	void (*write)(uint32_t, uint8_t*, uint32_t),
+	void (*erase_block)(uint32_t),
+	const uint8_t* (*map)(uint32_t) = 0,
+	bool (*busy)() = 0,
+	bool (*erase_suspend)() = 0,
+	void (*erase_resume)() = 0
 );
 
-void rocket_fs_mount(FileSystem* fs);
+/*
+ * Selects the NAND policy, after binding the device and before the mount: whole pages are programmed at once, and metadata
+ * is never programmed byte-wise in place (the headers are written back with their pages, the partition table by pages).
+ * The bad_block and failed callbacks belong to the given device: the blocks marked bad by the manufacturer are left out
+ * when formatting, and the blocks which fail to erase are retired. Both are optional, e.g. for a controller which
+ * remaps bad blocks itself. The read callback is expected to correct the bit errors (on-die or controller ECC).
+ * Staged pages and headers are programmed by rocket_fs_flush() (and thus Stream::close()): until then, they are lost
+ * if the power fails. SLC parts allow a few programs of each page between two erases, one more per flush.
+ * Only available when RFS_NAND is defined.
+ */
+#ifdef RFS_NAND
+void rocket_fs_nand(FileSystem* fs, uint32_t page_size, uint8_t device = 0, bool (*bad_block)(uint32_t) = 0, bool (*failed)() = 0);
+#endif
+
+void rocket_fs_mount(FileSystem* fs, bool lazy = false); // A lazy mount defers the resolution of each chain to the first access
 void rocket_fs_unmount(FileSystem* fs);
+bool rocket_fs_resolve(FileSystem* fs); // Resolves one more chain after a lazy mount, returns false once all are resolved
 void rocket_fs_format(FileSystem* fs);
 void rocket_fs_flush(FileSystem* fs); // Flushes the partition table
-File* rocket_fs_newfile(FileSystem* fs, const char* name, FileType type);
+File* rocket_fs_newfile(FileSystem* fs, const char* name, FileType type, uint32_t block_budget = 0); // The budget of CIRCULAR files is at least 2 blocks
 void rocket_fs_delfile(FileSystem* fs, File* file);
 File* rocket_fs_getfile(FileSystem* fs, const char* name);
 bool rocket_fs_touch(FileSystem* fs, File* file);
+
+/*
+ * Opens a stream on the file. APPEND streams resume where the data of the file ends, which is exact to the byte across
+ * remounts: closing a stream logs the end of the data in the block header when it cannot be told apart from erased memory.
+ * After a few such closes in the same block, APPEND streams continue in a new block.
+ */
 bool rocket_fs_stream(Stream* stream, FileSystem* fs, File* file, StreamMode mode);
+bool rocket_fs_poll(Stream* stream); // Returns true if a FOLLOW stream has data to read, without accessing the device
+uint32_t rocket_fs_verify(FileSystem* fs, File* file); // Returns the number of corrupted chunks of a CHECKSUM, ECC or mirrored file (all copies)
+bool rocket_fs_repair(FileSystem* fs, File* file);     // Rebuilds the copies of a mirrored file which were found corrupted (the File may move)
+uint32_t rocket_fs_erase_count(FileSystem* fs, uint32_t block_id);
+void rocket_fs_wear(FileSystem* fs, WearStats* stats); // Reads the erase count of every block
+void rocket_fs_cache_stats(FileSystem* fs, CacheStats* stats);
+bool rocket_fs_busy(FileSystem* fs);    // Returns true while a device of the filesystem is busy
+bool rocket_fs_prepare(FileSystem* fs); // Erases a free block ahead of its allocation, returns false if the device is full
+bool rocket_fs_suspend(FileSystem* fs); // Suspends the erase of rocket_fs_prepare() in progress, returns false if none can be
+void rocket_fs_resume(FileSystem* fs);  // Resumes it (done as well by any access to the erased block, or any other erase)
 
 
 
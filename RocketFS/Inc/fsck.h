@@ -0,0 +1,67 @@
+/*
+ * fsck.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#ifndef INC_FSCK_H_
+#define INC_FSCK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "filesystem.h"
+
+
+/*
+ * Filesystem check
+ *
+ * The check runs in two linear passes over a mounted filesystem, whose RAM footprint is the Fsck structure only:
+ * (1) walk: the chains of all files are followed from their root (and lost block), each reachable block being marked
+ *     in a bitmap. A block reached twice closes a cycle, which the walk cuts there.
+ * (2) sweep: every used block of the partition table which was not reached is an orphan and has to be freed,
+ *     whether its header is valid or not.
+ *
+ * The repairs are planned (FSCK_MAX_REPAIRS at most, the others are counted) and only applied by rocket_fs_fsck_repair().
+ * On a host, the sweep can be split in ranges of blocks checked in parallel, each with its own Fsck and its own copy of
+ * the FileSystem (the partition table cache is not shared), the results being merged with rfs_fsck_merge().
+ */
+#ifndef FSCK_MAX_REPAIRS
+#define FSCK_MAX_REPAIRS 32
+#endif
+
+typedef enum FsckAction {
+	FSCK_FREE_BLOCK,  // Orphan block: freed in the partition table
+	FSCK_CLAIM_BLOCK  // Block of a chain which the partition table regards as free (or lost block already in a chain): assigned to the file
+} FsckAction;
+
+typedef struct FsckRepair {
+	FsckAction action;
+	uint32_t block_id;
+	uint8_t file_id;
+} FsckRepair;
+
+typedef struct Fsck {
+	uint8_t reachable[(NUM_BLOCKS + 7) / 8];
+
+	uint32_t checked_blocks;   // Used blocks of the partition table
+	uint32_t chained_blocks;   // Blocks reached from the files
+	uint32_t invalid_blocks;   // Used blocks without a valid header
+	uint32_t orphan_blocks;    // Used blocks not reached from any file (including the invalid ones)
+	uint32_t unclaimed_blocks; // Chained blocks which the partition table regards as free
+	uint32_t cycles;
+
+	uint16_t repair_count;
+	uint32_t dropped_repairs;  // Not planned for lack of space: check again after the repair
+	FsckRepair repairs[FSCK_MAX_REPAIRS];
+} Fsck;
+
+bool rocket_fs_fsck(FileSystem* fs, Fsck* fsck);  // Returns true if the filesystem is consistent
+void rocket_fs_fsck_repair(FileSystem* fs, Fsck* fsck);
+
+void rfs_fsck_walk(FileSystem* fs, Fsck* fsck);
+void rfs_fsck_sweep(FileSystem* fs, const Fsck* walked, Fsck* fsck, uint32_t first_block, uint32_t end_block);
+void rfs_fsck_merge(Fsck* fsck, const Fsck* part);
+
+#endif /* INC_FSCK_H_ */
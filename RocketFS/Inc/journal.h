@@ -0,0 +1,62 @@
+/*
+ * journal.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#ifndef INC_JOURNAL_H_
+#define INC_JOURNAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "filesystem.h"
+
+
+/*
+ * Multiplexed journals
+ *
+ * Low-rate logs (events, state transitions...) share the chain of a single file instead of using a file each,
+ * so that they neither waste a block each nor allocate, erase and flush on their own.
+ *
+ * The records are buffered in RAM and written JOURNAL_BUFFER_SIZE bytes at most at a time, as a batch:
+ * 0: JOURNAL_BATCH, 1: reserved, 2...3: length of the records, 4...7: channels of the records (one bit per channel),
+ * followed by the records (0: channel, 1: length, 2...: data).
+ * The channel mask is the index of the batch: a reader of a channel skips the batches which do not mention it.
+ */
+#ifndef JOURNAL_BUFFER_SIZE
+#define JOURNAL_BUFFER_SIZE 256
+#endif
+
+#define JOURNAL_CHANNELS 32
+#define JOURNAL_BATCH_HEADER_SIZE 8
+#define JOURNAL_RECORD_HEADER_SIZE 2
+#define JOURNAL_MAX_RECORD (JOURNAL_BUFFER_SIZE - JOURNAL_BATCH_HEADER_SIZE - JOURNAL_RECORD_HEADER_SIZE)
+#define JOURNAL_BATCH 0x4A   // First byte of a batch
+
+typedef struct Journal {
+	FileSystem* fs;
+	Stream stream;
+	uint8_t buffer[JOURNAL_BUFFER_SIZE]; // Batch being built
+	uint16_t buffered_bytes;             // Including the batch header
+	uint32_t channels;
+} Journal;
+
+typedef struct Channel {
+	Stream stream;
+	uint8_t channel;
+	uint16_t remaining_bytes; // In the current batch
+} Channel;
+
+bool rocket_fs_journal_create(FileSystem* fs, Journal* journal, const char* name, FileType type); // Any type but CIRCULAR
+bool rocket_fs_journal_open(FileSystem* fs, Journal* journal, const char* name);                  // Appends to an existing journal
+bool rocket_fs_journal_write(Journal* journal, uint8_t channel, const uint8_t* data, uint8_t length);
+void rocket_fs_journal_flush(Journal* journal); // Writes the buffered records
+void rocket_fs_journal_close(Journal* journal);
+
+bool rocket_fs_channel_open(FileSystem* fs, Channel* channel, const char* name, uint8_t index);
+int32_t rocket_fs_channel_next(Channel* channel, uint8_t* data); // Returns the length of the next record, -1 at the end of the journal
+void rocket_fs_channel_close(Channel* channel);
+
+#endif /* INC_JOURNAL_H_ */
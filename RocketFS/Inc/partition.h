@@ -0,0 +1,29 @@
+/*
+ * partition.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#ifndef INC_PARTITION_H_
+#define INC_PARTITION_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "filesystem.h"
+
+
+void rfs_partition_init(FileSystem* fs);
+void rfs_partition_format(FileSystem* fs);
+void rfs_partition_flush(FileSystem* fs);
+
+uint8_t rfs_partition_get(FileSystem* fs, uint32_t block_id);
+void rfs_partition_set(FileSystem* fs, uint32_t block_id, uint8_t meta);
+
+uint32_t rfs_partition_find_free(FileSystem* fs, uint32_t from);
+uint32_t rfs_partition_find_oldest(FileSystem* fs, uint8_t* age);
+
+void rfs_partition_advance_time(FileSystem* fs);
+
+#endif /* INC_PARTITION_H_ */
@@ -0,0 +1,103 @@
+/*
+ * series.h
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#ifndef INC_SERIES_H_
+#define INC_SERIES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "filesystem.h"
+
+
+/*
+ * Columnar time series
+ *
+ * Each channel of a series is stored in its own file (a column), the timestamps in another one, so that a channel
+ * can be read without reading the others. Each column of series "name" is the file "name.k" (k = 0 for the timestamps).
+ * The names of series are at most 12 characters long. Each series uses 1 + channel_count file identifiers (one more
+ * with summaries), times the number of copies of mirrored columns: NUM_FILES must leave room for them.
+ *
+ * The samples are buffered in RAM and written to all columns at once every SERIES_BUFFERED_SAMPLES samples.
+ * Each such segment starts with a header (0...1: column, 2...3: number of samples, 4...7: first timestamp).
+ * With 30 samples, a segment fills two frames of a COMPRESSED column. A shorter segment (see rocket_fs_series_flush())
+ * ends with a short frame.
+ *
+ * The columns are written one after the other through a single stream, whose position in each column is saved in between:
+ * the RAM of a series does not grow with a chunk buffer per column, but its columns cannot be followed while it is open.
+ *
+ * Optionally, the file "name.s" receives a summary record every SERIES_SUMMARY_SAMPLES samples (about a block of a column):
+ * 0: number of channels, 2...3: number of samples, 4...7: first timestamp, 8...11: last timestamp,
+ * followed by the minimum and the maximum of each channel (compared as signed integers).
+ * An overview of a whole flight is then computed from the summaries only.
+ */
+#ifndef SERIES_MAX_CHANNELS
+#define SERIES_MAX_CHANNELS 15
+#endif
+
+#ifndef SERIES_BUFFERED_SAMPLES
+#define SERIES_BUFFERED_SAMPLES 30
+#endif
+
+#ifndef SERIES_SUMMARY_SAMPLES
+#define SERIES_SUMMARY_SAMPLES 960
+#endif
+
+#define SERIES_SEGMENT_HEADER_SIZE 8
+#define SERIES_SUMMARY_HEADER_SIZE 12
+#define SERIES_SUMMARY_COLUMN 0xFF // Column number of the summary file
+
+typedef struct Series {
+	FileSystem* fs;
+	uint8_t channel_count;
+	uint16_t buffered_samples;
+	uint32_t times[SERIES_BUFFERED_SAMPLES];
+	uint32_t samples[SERIES_MAX_CHANNELS][SERIES_BUFFERED_SAMPLES];
+	Stream writer; // Shared by the columns and the summaries
+	StreamCursor columns[1 + SERIES_MAX_CHANNELS];
+
+	bool summarized;
+	uint16_t summary_samples;
+	uint32_t summary_first_time;
+	uint32_t summary_last_time;
+	int32_t minimum[SERIES_MAX_CHANNELS];
+	int32_t maximum[SERIES_MAX_CHANNELS];
+	StreamCursor summaries;
+} Series;
+
+typedef struct Column {
+	Stream times;
+	Stream values;
+	uint16_t column;
+	uint16_t remaining_samples; // In the current segment
+} Column;
+
+typedef struct Summary {
+	uint32_t first_time;
+	uint32_t last_time;
+	uint32_t sample_count;
+	int32_t minimum;
+	int32_t maximum;
+} Summary;
+
+bool rocket_fs_series_create(FileSystem* fs, Series* series, const char* name, uint8_t channel_count, FileType type, bool summaries = false);
+bool rocket_fs_series_open(FileSystem* fs, Series* series, const char* name); // Appends to an existing series
+void rocket_fs_series_append(Series* series, uint32_t time, const uint32_t* values);
+void rocket_fs_series_flush(Series* series); // Writes the buffered samples
+void rocket_fs_series_close(Series* series);
+
+bool rocket_fs_column_open(FileSystem* fs, Column* column, const char* name, uint8_t channel);
+bool rocket_fs_column_next(Column* column, uint32_t* time, uint32_t* value); // Returns false at the end of the series
+void rocket_fs_column_close(Column* column);
+
+/*
+ * Fills at most max_summaries summaries of the given channel, each of which merges as many consecutive summary records as needed
+ * to cover the whole series. Returns the number of summaries.
+ */
+uint32_t rocket_fs_summarize(FileSystem* fs, const char* name, uint8_t channel, Summary* summaries, uint32_t max_summaries);
+
+#endif /* INC_SERIES_H_ */
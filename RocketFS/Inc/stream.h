@@ -14,5 +14,8 @@
 #include "filesystem.h"
 
 bool init_stream(Stream* stream, FileSystem* filesystem, uint32_t base_address, FileType type);
+bool rfs_stream_copy(Stream* input, Stream* output);
+void rfs_stream_suspend(Stream* stream, StreamCursor* cursor);
+bool rfs_stream_resume(Stream* stream, FileSystem* fs, const StreamCursor* cursor);
 
 #endif /* INC_STREAM_H_ */
@@ -0,0 +1,253 @@
+/*
+ * async.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#include "async.h"
+
+#ifdef __cpp_impl_coroutine
+
+#include <string.h>
+
+/*
+ * Non-exported function prototypes
+ */
+static AsyncOperation* rfs_async_next(AsyncExecutor* executor);
+static bool rfs_async_urgent(AsyncExecutor* executor, FileSystem* fs, uint8_t priority);
+static bool rfs_async_preempts(AsyncOperation* operation);
+static bool rfs_async_preempting(AsyncExecutor* executor, FileSystem* fs);
+static void rfs_async_record(AsyncExecutor* executor, AsyncOperation* operation);
+static bool rfs_async_step(AsyncOperation* operation);
+static AsyncOperation rfs_async_operation(AsyncOperationType type, FileSystem* fs, Stream* stream, uint8_t* buffer, uint32_t length);
+
+
+
+AsyncTask::~AsyncTask() {
+	if(handle) {
+		handle.destroy(); // Never spawned
+	}
+}
+
+void AsyncOperation::await_suspend(std::coroutine_handle<AsyncTask::promise_type> task) {
+	AsyncExecutor* executor = task.promise().executor;
+
+	this->task = task;
+	priority = task.promise().priority;
+	start_time = executor->clock ? executor->clock() : 0;
+
+	executor->wait(this);
+}
+
+AsyncExecutor::AsyncExecutor(uint32_t (*clock)()) : tasks(), task_count(0), waiting(0), next_ticket(0), clock(clock) {
+	memset(latency, 0, sizeof(latency));
+}
+
+bool AsyncExecutor::spawn(AsyncTask& task, uint8_t priority) {
+	if(task_count == ASYNC_MAX_TASKS || !task.handle) {
+		return false;
+	}
+
+	task.handle.promise().executor = this;
+	task.handle.promise().priority = priority < ASYNC_PRIORITIES ? priority : ASYNC_PRIORITIES - 1;
+	tasks[task_count++] = task.handle;
+	task.handle = 0;
+
+	return true;
+}
+
+/*
+ * Performs one step at a time, of the most urgent operation whose filesystem is idle. The operations of a busy filesystem
+ * wait, so that a long erase only holds back the tasks which access the same devices.
+ */
+void AsyncExecutor::run(void (*idle)()) {
+	for(uint8_t i = 0; i < task_count; i++) {
+		tasks[i].resume(); // Up to the first operation
+	}
+
+	while(waiting) {
+		AsyncOperation* operation = rfs_async_next(this);
+
+		if(!operation) {
+			if(idle) {
+				idle();
+			}
+
+			continue;
+		}
+
+		FileSystem* fs = operation->fs;
+		bool complete = rfs_async_step(operation);
+
+		if(operation->type == ASYNC_WRITE && !operation->stream->eof && !rfs_async_urgent(this, fs, operation->priority)) {
+			rocket_fs_prepare(fs); // The next block is erased while the other tasks run
+		}
+
+		if(complete) {
+			rfs_async_record(this, operation);
+			operation->task.resume(); // The operation is gone from here on
+		} else {
+			wait(operation); // Behind the other operations of the same priority
+		}
+
+		if(fs->suspended_device && !rfs_async_preempting(this, fs)) {
+			rocket_fs_resume(fs);
+		}
+	}
+
+	for(uint8_t i = 0; i < task_count; i++) {
+		tasks[i].destroy();
+	}
+
+	task_count = 0;
+}
+
+void AsyncExecutor::wait(AsyncOperation* operation) {
+	operation->ticket = next_ticket++;
+	operation->next = waiting;
+	waiting = operation;
+}
+
+AsyncOperation rocket_fs_co_write(Stream* stream, uint8_t* buffer, uint32_t length) {
+	return rfs_async_operation(ASYNC_WRITE, stream->fs, stream, buffer, length);
+}
+
+AsyncOperation rocket_fs_co_read(Stream* stream, uint8_t* buffer, uint32_t length) {
+	return rfs_async_operation(ASYNC_READ, stream->fs, stream, buffer, length);
+}
+
+AsyncOperation rocket_fs_co_flush(FileSystem* fs) {
+	return rfs_async_operation(ASYNC_FLUSH, fs, 0, 0, 0);
+}
+
+
+
+/*
+ * Removes the most urgent operation whose filesystem is idle from the waiting list (the oldest one of its priority).
+ * Returns 0 if all operations wait for a device.
+ */
+static AsyncOperation* rfs_async_next(AsyncExecutor* executor) {
+	AsyncOperation** selected = 0;
+
+	for(AsyncOperation** link = &(executor->waiting); *link; link = &((*link)->next)) {
+		AsyncOperation* operation = *link;
+
+		if(selected && (operation->priority > (*selected)->priority
+		            || (operation->priority == (*selected)->priority && (int32_t) (operation->ticket - (*selected)->ticket) > 0))) {
+			continue;
+		}
+
+		if(!rocket_fs_busy(operation->fs) || (rfs_async_preempts(operation) && rocket_fs_suspend(operation->fs) && !rocket_fs_busy(operation->fs))) {
+			selected = link;
+		}
+	}
+
+	if(!selected) {
+		return 0;
+	}
+
+	AsyncOperation* operation = *selected;
+	*selected = operation->next;
+
+	return operation;
+}
+
+/*
+ * Returns true if an operation more urgent than the given priority waits for the filesystem.
+ */
+static bool rfs_async_urgent(AsyncExecutor* executor, FileSystem* fs, uint8_t priority) {
+	for(AsyncOperation* operation = executor->waiting; operation; operation = operation->next) {
+		if(operation->fs == fs && operation->priority < priority) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Reads and the writes of priority 0 suspend the erase ahead of their filesystem rather than wait for it.
+ */
+static bool rfs_async_preempts(AsyncOperation* operation) {
+	return operation->type == ASYNC_READ || (operation->type == ASYNC_WRITE && operation->priority == 0);
+}
+
+static bool rfs_async_preempting(AsyncExecutor* executor, FileSystem* fs) {
+	for(AsyncOperation* operation = executor->waiting; operation; operation = operation->next) {
+		if(operation->fs == fs && rfs_async_preempts(operation)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void rfs_async_record(AsyncExecutor* executor, AsyncOperation* operation) {
+	if(!executor->clock) {
+		return;
+	}
+
+	AsyncLatency* latency = &(executor->latency[operation->priority]);
+	uint32_t elapsed = executor->clock() - operation->start_time;
+	uint8_t bucket = 0;
+
+	while(bucket < ASYNC_LATENCY_BUCKETS - 1 && elapsed >> bucket) {
+		bucket++;
+	}
+
+	latency->histogram[bucket]++;
+	latency->worst = elapsed > latency->worst ? elapsed : latency->worst;
+	latency->overruns += latency->budget && elapsed > latency->budget ? 1 : 0;
+}
+
+/*
+ * Performs the next step of the operation, the devices being idle. Returns true once the operation is complete.
+ */
+static bool rfs_async_step(AsyncOperation* operation) {
+	uint32_t step_length = operation->fs->block_size / 2; // Crosses one block boundary at most, even with chunk trailers
+	uint32_t length = operation->length - operation->done;
+
+	if(length > step_length) {
+		length = step_length;
+	}
+
+	switch(operation->type) {
+	case ASYNC_WRITE:
+		operation->stream->write(operation->buffer + operation->done, length);
+
+		if(operation->stream->eof) {
+			return true; // Device full
+		}
+
+		operation->done += length;
+
+		return operation->done == operation->length;
+	case ASYNC_READ: {
+		int32_t read_length = operation->stream->read(operation->buffer + operation->done, length);
+
+		operation->done += read_length > 0 ? read_length : 0;
+
+		return operation->done == operation->length || operation->stream->eof;
+	}
+	default:
+		rocket_fs_flush(operation->fs);
+		return true;
+	}
+}
+
+static AsyncOperation rfs_async_operation(AsyncOperationType type, FileSystem* fs, Stream* stream, uint8_t* buffer, uint32_t length) {
+	AsyncOperation operation;
+
+	operation.type = type;
+	operation.fs = fs;
+	operation.stream = stream;
+	operation.buffer = buffer;
+	operation.length = length;
+	operation.done = 0;
+	operation.next = 0;
+
+	return operation;
+}
+
+#endif
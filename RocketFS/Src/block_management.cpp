@@ -7,106 +7,186 @@
 
 #include "block_management.h"
 
+#include "device.h"
+#include "encoding.h"
 #include "file.h"
+#include "partition.h"
 #include "rocket_fs.h"
-#include "stream.h"
 
 
-#define BLOCK_MAGIC_NUMBER 0xC0FFEE00
-#define BLOCK_HEADER_SIZE 16
+#define BLOCK_MAGIC_NUMBER (BLOCK_MAGIC_PREFIX | FORMAT_VERSION)
+#define BLOCK_SUCCESSOR_OFFSET 12
+#define BLOCK_USAGE_TABLE_OFFSET 16
+#define BLOCK_TAIL_LOG_OFFSET 24
+#define BLOCK_TAIL_LOG_ENTRIES 4
+#define BLOCK_ERASE_COUNT_OFFSET 32
+#define NO_SUCCESSOR 0xFFFFFFFF
+#define NO_TAIL 0xFFFF
+#define UNKNOWN_WEAR 0xFFFFFFFF
+#define ERASE_COUNT_CHECK 0x9E3779B1
+#define RING_BLOCK_META ((CIRCULAR << 4) | 0b1111) // The blocks of a ring are never recycled by other files
 /*
- * 0...3:  Magic number
- * 4...5:  Related file ID
- * 6...7:  Predecessor block ID
- * 8...15: Usage table
+ * 0...3:   Magic number (the least significant byte holds the format version)
+ * 4...7:   Related file ID
+ * 8...11:  Predecessor block ID
+ * 12...15: Successor block ID (programmed once, when the chain grows)
+ * 16...23: Usage table
+ * 24...31: Tail log (4 entries of 16 bits, each programmed once, see rfs_block_record_end())
+ * 32...35: Erase count (bit-inverted, programmed right after each erase)
+ * 36...39: Erase count check (bit-inverted erase count * ERASE_COUNT_CHECK)
  */
 
 /*
  * Non-exported function prototypes
  */
+static uint32_t rfs_block_extend(FileSystem* fs, uint32_t block_id, uint32_t used_end);
+static void rfs_block_link(FileSystem* fs, File* file, uint32_t block_id, uint32_t successor);
+static void rfs_block_detach(FileSystem* fs, uint32_t block_id);
+static uint32_t rfs_block_select_free(FileSystem* fs);
+static bool rfs_block_take(FileSystem* fs, uint32_t block_id, FileType type);
+static bool rfs_block_retire(FileSystem* fs, uint32_t block_id);
+static void rfs_block_write_erase_count(FileSystem* fs, uint32_t block_id, uint32_t erase_count);
+static void rfs_link_replicas(FileSystem* fs);
+static uint32_t rfs_ring_next(FileSystem* fs, File* file, uint32_t block_id);
+static uint32_t rfs_ring_load(FileSystem* fs, File* file);
 static void rfs_block_update_usage_table(FileSystem* fs, uint32_t write_begin, uint32_t write_end);
+static bool rfs_lookup_extents(FileSystem* fs, uint32_t block_id, File** owner, uint32_t* successor);
+static bool __push_extent(File* file, uint32_t block_id);
+static File* rfs_last_block_owner(FileSystem* fs, uint32_t block_id);
 
 static void rfs_update_relative_time(FileSystem* fs);
-static void rfs_decrease_relative_time(FileSystem* fs);
 
 static uint32_t __compute_block_length(FileSystem* fs, uint64_t usage_table);
+static uint8_t __read_tail_log(const uint8_t* tail_log, uint32_t* end);
+static uint64_t __usage_bit_mask(FileSystem* fs, uint32_t write_begin, uint32_t write_end);
 
 
 
-static bool allow_unsafe_access = false;
-
-
-void rfs_init_block_management(FileSystem* fs) {
+void rfs_init_block_management(FileSystem* fs, bool lazy) {
 	static char identifier[16];
-	Stream stream;
+	BlockHeader header;
 	File* selected_file;
 
+	for(uint32_t file_id = 0; file_id < NUM_FILES; file_id++) {
+		selected_file = &(fs->files[file_id]);
+
+		selected_file->first_block = 0;
+		selected_file->last_block = 0;
+		selected_file->lost_block = 0;
+		selected_file->break_block = 0;
+
+		selected_file->primary = NO_FILE;
+		selected_file->replica_count = 0;
+		selected_file->degraded = 0;
+
+		selected_file->head_block = 0;
+		selected_file->block_budget = 0;
+		selected_file->writer = 0;
+		selected_file->resolved = false;
+
+		rfs_clear_file_extents(selected_file);
+	}
+
+	fs->erased_block = 0;
+	fs->erased_block_count = 0;
+	fs->suspended_device = 0;
+	fs->wear_floor = UNKNOWN_WEAR;
+	fs->wear_sweep_min = UNKNOWN_WEAR;
+
 	/*
 	 * First pass: Detect all files.
+	 * Only file roots and lost blocks have to be inspected, the other blocks are reached through their predecessor.
+	 * The blocks of rings are immortal as well: any of them leads to the head of its ring.
 	 */
 	fs->log("Detecting files...");
 
-	for(uint16_t block_id = PROTECTED_BLOCKS; block_id < NUM_BLOCKS; block_id++) {
-		uint8_t meta_data = fs->partition_table[block_id];
+	for(uint32_t block_id = fs->protected_blocks; block_id < fs->num_blocks; block_id++) {
+		uint8_t meta_data = rfs_partition_get(fs, block_id);
 
-		if(meta_data) {
-			uint32_t address = fs->block_size * block_id;
+		bool lost = (meta_data & 0b11110000) == 0b11110000;
+		bool root = !lost && (meta_data & 0b00001111) == 0b00001111;
 
-			allow_unsafe_access = true;
-			init_stream(&stream, fs, address, RAW);
+		if((!lost && !root) || meta_data == BAD_BLOCK_META) {
+			continue;
+		}
 
-			uint32_t magic = stream.read32();
-			uint16_t file_id = stream.read16();
-			uint16_t predecessor = stream.read16();
+		if(!rfs_block_read_header(fs, block_id, &header) || header.file_id >= NUM_FILES) {
+			fs->log("Warning: Invalid magic number. Ignoring block");
+			continue;
+		}
 
-			stream.read64(); // Skip the usage table
+		selected_file = &(fs->files[header.file_id]);
 
-			if(magic == BLOCK_MAGIC_NUMBER) {
-				if(predecessor) {
-					// Normal block detected
-					fs->data_blocks[predecessor].successor = block_id;
-				} else if((meta_data & 0b11110000) != 0b11110000) {
-					// File detected
-					stream.read((uint8_t*) identifier, 16);
+		if(lost) {
+			// Lost block detected
+			fs->log("Lost block recovered");
 
-					fs->log(identifier);
+			selected_file->lost_block = block_id;
+		} else if(header.predecessor == 0) {
+			// File detected
+			rfs_device_read(fs, rfs_get_block_base_address(fs, block_id), (uint8_t*) identifier, 16);
+			identifier[15] = '\0';
 
-					selected_file = &(fs->files[file_id]);
+			fs->log(identifier);
 
-					uint32_t hash = hash_filename(identifier);
+			selected_file->first_block = block_id;
+			filename_copy(identifier, selected_file->filename);
+			selected_file->hash = hash_filename(identifier);
+			selected_file->used_blocks = 0;
+			selected_file->length = 0;
+		} else if(meta_data == RING_BLOCK_META) {
+			selected_file->head_block = block_id; // Resolved by rfs_ring_load()
+		}
+	}
 
-					selected_file->first_block = block_id;
-					filename_copy(identifier, selected_file->filename);
-					selected_file->hash = hash;
-					selected_file->used_blocks = 0;
-					selected_file->length = 0;
-				} else {
-					// Lost block detected
-					fs->log("Lost block recovered");
+	rfs_link_replicas(fs);
 
-					selected_file = &(fs->files[file_id]);
-					fs->data_blocks[selected_file->first_block].successor = block_id;
-				}
-			} else {
-				fs->log("Warning: Invalid magic number. Ignoring block");
-			}
+	/*
+	 * Second pass: Resolve all block links and compute storage statistics.
+	 * A lazy mount leaves each chain unresolved until its file is accessed (see rfs_resolve_file()).
+	 */
+	if(!lazy) {
+		fs->log("Resolving block hierarchy...");
 
-			stream.close();
-			allow_unsafe_access = false;
+		for(uint32_t file_id = 0; file_id < NUM_FILES; file_id++) {
+			rfs_load_file_meta(fs, &(fs->files[file_id]));
 		}
 	}
 
 	/*
-	 * Second pass: Resolve all block links and compute storage statistics.
-	 * Warning: This function traverses all blocks and does not check for cyclicity.
-	 * This may cause infinite loops in extreme data corruption cases. TODO: Check cyclicity.
+	 * The position of the allocation cursor is not stored. Start the sweep at a pseudo-random block derived from
+	 * the state of the device, so that frequent reboots do not keep favouring the same blocks.
 	 */
-	fs->log("Resolving block hierarchy...");
+	uint32_t seed = (rfs_block_erase_count(fs, 1) + fs->total_used_blocks) * ERASE_COUNT_CHECK;
+	fs->wear_cursor = fs->protected_blocks + seed % (fs->num_blocks - fs->protected_blocks);
+}
 
-	for(uint8_t file_id = 0; file_id < NUM_FILES; file_id++) {
-		selected_file = &(fs->files[file_id]);
-		uint32_t used_blocks = rfs_load_file_meta(fs, selected_file);
-		fs->total_used_blocks += used_blocks;
+/*
+ * Attaches each REPLICA chain to the file with the same name. Only the file table is inspected, no block is read.
+ * A replica whose file is gone (e.g. the power failed while the file was deleted) is kept as a standalone file.
+ */
+static void rfs_link_replicas(FileSystem* fs) {
+	for(uint32_t file_id = 0; file_id < NUM_FILES; file_id++) {
+		File* replica = &(fs->files[file_id]);
+
+		if(!replica->first_block || rfs_get_file_type(fs, replica) != REPLICA) {
+			continue;
+		}
+
+		for(uint32_t primary_id = 0; primary_id < NUM_FILES; primary_id++) {
+			File* primary = &(fs->files[primary_id]);
+
+			if(primary->first_block && primary->hash == replica->hash && primary->replica_count < MAX_REPLICAS
+					&& filename_equals(primary->filename, replica->filename) && rfs_get_file_type(fs, primary) != REPLICA) {
+				primary->replicas[primary->replica_count++] = file_id;
+				replica->primary = primary_id;
+				break;
+			}
+		}
+
+		if(replica->primary == NO_FILE) {
+			fs->log("Warning: Replica without original file");
+		}
 	}
 }
 
@@ -115,96 +195,265 @@ void rfs_init_block_management(FileSystem* fs) {
  */
 
 /*
- * Returns the allocated block ID
+ * Returns the allocated block ID or 0 if no block could be allocated.
  *
  * No block header is written.
  * Only the partition table is modified.
  */
-uint16_t rfs_block_alloc(FileSystem* fs, FileType type) {
-	uint16_t oldest_block_id = PROTECTED_BLOCKS;
-   uint16_t oldest_block_age = 0xF;
+uint32_t rfs_block_alloc(FileSystem* fs, FileType type) {
+	bool erased = fs->erased_block && rfs_partition_get(fs, fs->erased_block) == 0;
+	uint32_t block_id = erased ? fs->erased_block : rfs_block_select_free(fs);
+
+	if(block_id) {
+		// We found a free block!
+		if(!rfs_block_take(fs, block_id, type)) {
+			return rfs_block_alloc(fs, type); // The block went bad and was retired
+		}
+
+		fs->erased_block = 0;
+
+		if(fs->num_devices > 1) {
+			/*
+			 * The next free block is most likely the next block of this chain and lies on another device:
+			 * erase it now so that the erase overlaps with the programming of the allocated block.
+			 */
+			rfs_block_erase_ahead(fs);
+		}
+
+		return block_id;
+	}
+
+	/* Device is full! Realloc oldest block. */
+	uint8_t oldest_block_age;
+	uint32_t oldest_block_id = rfs_partition_find_oldest(fs, &oldest_block_age);
+
+	if(!oldest_block_id) {
+		fs->log("Error: Device is full and no block can be recycled");
+		return 0;
+	}
+
+	if(oldest_block_age > 0) { // Some correction for a better relative time repartition
+		rfs_partition_advance_time(fs);
+	}
+
+	// Now, we have to update the predecessor/successor references to avoid inconsistencies in the filesystem.
+	rfs_block_detach(fs, oldest_block_id);
+
+	rfs_partition_set(fs, oldest_block_id, (type << 4) | 0b1100); // Reset the entry in the partition table
+	rfs_update_relative_time(fs);
+
+	if(!rfs_block_erase(fs, oldest_block_id)) { // Prepare reallocated block for writing
+		rfs_block_retire(fs, oldest_block_id);
+		return rfs_block_alloc(fs, type);
+	}
 
-	for(uint16_t block_id = PROTECTED_BLOCKS; block_id < NUM_BLOCKS; block_id++) {
-		uint8_t* meta = &(fs->partition_table[block_id]);
-		uint8_t age = (*meta) & 0xF;
+	return oldest_block_id;
+}
 
-		if(*meta == 0) {
-			// We found a free block!
+/*
+ * Erases the next free block ahead of its allocation, unless such a block is erased already.
+ * Its erase count is only programmed once the block is taken (or the partition table flushed): on an asynchronous
+ * device, the caller does not wait for the end of the erase. Returns false if no free block is left.
+ */
+bool rfs_block_erase_ahead(FileSystem* fs) {
+	if(fs->erased_block && rfs_partition_get(fs, fs->erased_block) == 0) {
+		return true;
+	}
 
-			fs->total_used_blocks++;
+	fs->erased_block = rfs_block_select_free(fs);
+	fs->erased_block_count = 0;
 
-			*meta = (type << 4) | 0b1100;
+	if(!fs->erased_block) {
+		return false;
+	}
 
-			uint32_t address = rfs_get_block_base_address(fs, 1) + block_id;
-		    fs->write(address, meta, 8);
+	fs->erased_block_count = rfs_block_erase_count(fs, fs->erased_block) + 1;
 
-			fs->partition_table_modified = true;
+	if(!rfs_device_erase(fs, fs->erased_block * fs->block_size)) {
+		rfs_block_retire(fs, fs->erased_block);
+		return rfs_block_erase_ahead(fs);
+	}
 
-			fs->data_blocks[block_id].successor = 0;
+	return true;
+}
 
-			rfs_update_relative_time(fs);
+/*
+ * Allocates a block for copy number 'copy' (out of 'copies') of a mirrored chain whose original block is given.
+ * The copies are spread evenly over the device, on another device than the original when the blocks are striped,
+ * so that a local defect does not hit all copies and the writes of the copies can overlap.
+ * Falls back to rfs_block_alloc() (and thus recycling) if no free block is left.
+ */
+uint32_t rfs_block_alloc_mirror(FileSystem* fs, FileType type, uint32_t original, uint8_t copy, uint8_t copies) {
+	uint32_t data_blocks = fs->num_blocks - fs->protected_blocks;
+	uint32_t from = fs->protected_blocks + (original - fs->protected_blocks + copy * data_blocks / copies) % data_blocks;
+	uint32_t block_id = rfs_partition_find_free(fs, from);
 
-			fs->erase_block(fs->block_size * block_id); // Prepare for writing
+	if(fs->num_devices > 1) {
+		uint8_t device = (original + copy) % fs->num_devices;
 
-			return block_id;
-		} else if(age < oldest_block_age){
-		   oldest_block_id = block_id;
-		   oldest_block_age = age;
+		for(uint8_t probe = 0; block_id && block_id % fs->num_devices != device && probe < 2 * fs->num_devices; probe++) {
+			block_id = rfs_partition_find_free(fs, block_id + 1);
 		}
 	}
 
-	/* Device is full! Realloc oldest block. */
+	if(!block_id || !rfs_block_take(fs, block_id, type)) {
+		return rfs_block_alloc(fs, type);
+	}
 
-	if(oldest_block_age > 0) { // Some correction for a better relative time repartition
-		rfs_decrease_relative_time(fs);
+	return block_id;
+}
+
+/*
+ * Marks a free block as used and prepares it for writing. Returns false if the block failed to erase and was retired.
+ */
+static bool rfs_block_take(FileSystem* fs, uint32_t block_id, FileType type) {
+	fs->total_used_blocks++;
+
+	rfs_partition_set(fs, block_id, (type << 4) | 0b1100);
+	rfs_update_relative_time(fs);
+
+	if(block_id == fs->erased_block) {
+		rfs_block_settle_erase(fs);
+		fs->erased_block = 0; // Already erased
+		return true;
 	}
 
-    fs->partition_table[oldest_block_id] = (type << 4) | 0b1100; // Reset the entry in the partition table
-	fs->partition_table_modified = true;
+	return rfs_block_erase(fs, block_id) || rfs_block_retire(fs, block_id);
+}
 
-	// Now, we have to update the predecessor/successor references to avoid inconsistencies in the filesystem.
-    uint8_t header[8];
+/*
+ * Marks a block which failed to erase as bad: it is never allocated again. Always returns false.
+ */
+static bool rfs_block_retire(FileSystem* fs, uint32_t block_id) {
+	if(rfs_partition_get(fs, block_id) == 0) {
+		fs->total_used_blocks++;
+	}
 
-    fs->read(fs->block_size * oldest_block_id, header, 8);
+	if(block_id == fs->erased_block) {
+		fs->erased_block = 0;
+		fs->erased_block_count = 0;
+	}
 
-   uint16_t successor_block_id = fs->data_blocks[oldest_block_id].successor;
+	rfs_partition_set(fs, block_id, BAD_BLOCK_META);
+	fs->log("Warning: Bad block retired");
 
-   File* old_file = &fs->files[(header[5] << 8) | header[4]];
+	return false;
+}
 
-   old_file->length -= 4096;
-   old_file->used_blocks--;
+/*
+ * Dynamic wear levelling
+ *
+ * Free blocks are handed out by a cursor sweeping the device, so that all free blocks are erased in turn
+ * instead of the lowest free block IDs over and over again.
+ * A block erased more than WEAR_LEVELING_THRESHOLD times above the least worn free block of the previous sweep is skipped,
+ * unless WEAR_LEVELING_PROBES blocks in a row are that worn. Returns 0 if the device is full.
+ */
+static uint32_t rfs_block_select_free(FileSystem* fs) {
+	uint32_t selected_block = 0;
+	uint32_t selected_erase_count = UNKNOWN_WEAR;
 
+	for(uint8_t probe = 0; probe < WEAR_LEVELING_PROBES; probe++) {
+		uint32_t block_id = rfs_partition_find_free(fs, fs->wear_cursor);
 
-   if(successor_block_id) {
-  	 uint8_t lost_predecessor[2];
+		if(!block_id) {
+			break;
+		}
 
-  	 fs->write(fs->block_size * successor_block_id + 6, lost_predecessor, 2);
-     fs->partition_table[successor_block_id] |= 0b11110000; // Set the successor block as a lost block
-     fs->partition_table_modified = true;
+		if(block_id < fs->wear_cursor) {
+			// New sweep
+			fs->wear_floor = fs->wear_sweep_min;
+			fs->wear_sweep_min = UNKNOWN_WEAR;
+		}
 
-     fs->data_blocks[old_file->first_block].successor = successor_block_id;
-   }
+		fs->wear_cursor = block_id + 1;
 
-   fs->data_blocks[oldest_block_id].successor = 0;
+		uint32_t erase_count = rfs_block_erase_count(fs, block_id);
 
-   rfs_update_relative_time(fs);
+		if(erase_count < fs->wear_sweep_min) {
+			fs->wear_sweep_min = erase_count;
+		}
 
-	fs->erase_block(fs->block_size * oldest_block_id); // Prepare reallocated block for writing
+		if(!selected_block || erase_count < selected_erase_count) {
+			selected_block = block_id;
+			selected_erase_count = erase_count;
+		}
 
-	return oldest_block_id;
+		if(fs->wear_floor == UNKNOWN_WEAR || erase_count <= fs->wear_floor + WEAR_LEVELING_THRESHOLD) {
+			break;
+		}
+	}
+
+	return selected_block;
 }
 
 
-void rfs_block_free(FileSystem* fs, uint16_t block_id) {
-	if(block_id >= PROTECTED_BLOCKS) {
-		fs->partition_table[block_id] = 0;
-		fs->partition_table_modified = true;
+void rfs_block_free(FileSystem* fs, uint32_t block_id) {
+	if(block_id >= fs->protected_blocks) {
+		rfs_partition_set(fs, block_id, 0);
 		fs->total_used_blocks--;
 	} else {
 		fs->log("Error: Cannot free a protected block");
 	}
 }
 
+/*
+ * Removes a block that is about to be recycled from the chain of its file.
+ *
+ * The successor ID of the predecessor is already programmed and cannot be rewritten without erasing the predecessor.
+ * Instead, the successor of the recycled block is marked as lost and the chain continues there after the predecessor.
+ * Only one such break per file can be represented: a second break truncates the file at the new break.
+ */
+static void rfs_block_detach(FileSystem* fs, uint32_t block_id) {
+	BlockHeader header;
+
+	if(!rfs_block_read_header(fs, block_id, &header) || header.file_id >= NUM_FILES) {
+		return; // Not part of any chain
+	}
+
+	File* file = &(fs->files[header.file_id]);
+
+	rfs_resolve_file(fs, file); // The break is recorded against the resolved chain
+
+	uint32_t successor = rfs_block_successor(fs, block_id);
+	uint32_t predecessor = block_id == file->lost_block ? file->break_block : header.predecessor;
+
+	if(block_id == file->lost_block) {
+		file->lost_block = successor;
+
+		if(!successor) {
+			file->break_block = 0;
+		}
+	} else if(block_id == file->break_block) {
+		file->break_block = predecessor; // The chain still continues at the same lost block
+		successor = 0;
+	} else if(successor) {
+		if(file->lost_block) {
+			fs->log("Warning: Chain already broken, file truncated");
+			rfs_partition_set(fs, file->lost_block, (rfs_get_file_type(fs, file) << 4) | (rfs_partition_get(fs, file->lost_block) & 0xF));
+		}
+
+		file->break_block = predecessor;
+		file->lost_block = successor;
+	}
+
+	if(successor) {
+		rfs_partition_set(fs, successor, rfs_partition_get(fs, successor) | 0b11110000); // Set the successor block as a lost block
+	}
+
+	file->length -= block_id == file->last_block ? file->tail_offset - BLOCK_HEADER_SIZE : rfs_compute_block_length(fs, block_id) - BLOCK_HEADER_SIZE;
+
+	if(block_id == file->last_block) {
+		file->last_block = predecessor;
+		file->tail_offset = rfs_compute_block_end(fs, predecessor);
+	}
+
+	file->used_blocks--;
+
+	// The cached chain is not valid anymore. It is rebuilt by rfs_load_file_meta().
+	file->extent_count = 0;
+	file->extents_complete = false;
+}
+
 
 /*
  * This function transforms the memory access operation to ensure that no block is overwritten.
@@ -215,135 +464,687 @@ void rfs_block_free(FileSystem* fs, uint16_t block_id) {
  * Returns the number of readable bytes.
  */
 int32_t rfs_access_memory(FileSystem* fs, uint32_t* address, uint32_t length, AccessType access_type) {
-	if(allow_unsafe_access) {
-		return length; // Bypass software protection mechanism
+	uint32_t internal_address = 1 + (*address - 1) % fs->block_size;
+	uint32_t block_id = (*address - internal_address) / fs->block_size;
+	bool extended = false;
+
+	if(internal_address < BLOCK_HEADER_SIZE) {
+		// Correction of the address when it is too low
+		*address += BLOCK_HEADER_SIZE - internal_address;
+		internal_address = BLOCK_HEADER_SIZE;
+	} else if(internal_address == fs->block_size) {
+		// Correction of the address when it is at the end of a block
+		uint32_t successor_block = rfs_block_successor(fs, block_id);
+
+		if(!successor_block) {
+			switch(access_type) {
+			case READ:
+				return -1; // End of file
+			case WRITE: {
+				// The span written to the new block is marked as used together with its header
+				uint32_t span = length < fs->block_size - BLOCK_HEADER_SIZE ? length : fs->block_size - BLOCK_HEADER_SIZE;
+
+				successor_block = rfs_block_extend(fs, block_id, BLOCK_HEADER_SIZE + span);
+				extended = true;
+
+				if(!successor_block) {
+					return -1; // Device full
+				}
+
+				break;
+			}
+			default:
+				return -1; // Not implemented
+			}
+		}
+
+		*address = successor_block * fs->block_size + BLOCK_HEADER_SIZE;
+		internal_address = BLOCK_HEADER_SIZE;
+		block_id = successor_block;
 	}
 
-   uint32_t internal_address = 1 + (*address - 1) % fs->block_size;
-   uint16_t block_id = (*address - internal_address) / fs->block_size;
+	uint32_t max_length = fs->block_size;
+	uint32_t new_length = length;
+	File* owner = 0;
 
-   if(internal_address < BLOCK_HEADER_SIZE) {
-      // Correction of the address when it is too low
-      *address += BLOCK_HEADER_SIZE - internal_address;
-   } else if(internal_address == fs->block_size) {
-      // Correction of the address when it is at the end of a block
-      uint16_t successor_block = fs->data_blocks[block_id].successor;
+	if(access_type == READ && block_id >= fs->protected_blocks) {
+		owner = rfs_last_block_owner(fs, block_id);
 
-      if(!successor_block) {
-         switch(access_type) {
-         case READ:
-            return -1; // End of file
-         case WRITE: {
-			uint8_t buffer[2];
-			fs->read(block_id * fs->block_size + 4, buffer, 2); // Read the file identifier
-			uint16_t file_id = (buffer[1] << 8) | buffer[0];
-			File* file = &(fs->files[file_id]);
+		max_length = owner ? owner->tail_offset : rfs_compute_block_length(fs, block_id); // The data of the last block ends exactly there
+	}
 
-			FileType file_type = (FileType) (fs->partition_table[block_id] >> 4);
-			uint16_t new_block_id = rfs_block_alloc(fs, file_type); // Allocate a new block
+	if(internal_address >= max_length) {
+		new_length = 0;
+	} else if(internal_address + length > max_length) {
+		new_length = max_length - internal_address; // Readable/Writable length correction
+	}
 
-			rfs_block_write_header(fs, new_block_id, file_id, block_id);
+	if(owner && new_length == 0) {
+		return 0; // End of file: the address stays where the data will be appended, so that FOLLOW streams resume there
+	}
 
-			file->used_blocks += 1;
-			file->last_block = new_block_id;
-			file->length += fs->block_size;
+	if(internal_address != fs->block_size && new_length == 0) { // Goto next block
+		*address = (block_id + 1) * fs->block_size;
+		return rfs_access_memory(fs, address, length, access_type);
+	}
 
-			fs->data_blocks[block_id].successor = new_block_id;
+	if(access_type == WRITE) {
+		owner = rfs_last_block_owner(fs, block_id);
 
-			successor_block = new_block_id;
+		if(!extended) {
+			rfs_block_update_usage_table(fs, *address, *address + new_length - 1);
+		}
 
-			break;
-         }
-         default:
-            return -1; // Not implemented
-         }
-      }
+		if(owner && internal_address + new_length > owner->tail_offset) {
+			owner->length += internal_address + new_length - owner->tail_offset;
+			owner->tail_offset = internal_address + new_length;
+		}
+	}
 
-      *address = successor_block * fs->block_size + BLOCK_HEADER_SIZE;
-      internal_address = BLOCK_HEADER_SIZE;
-   }
+	return new_length;
+}
 
-   uint32_t max_length = fs->block_size;
-   uint32_t new_length = length;
+/*
+ * Allocates and links a new block at the end of the chain of the given block, whose first used_end bytes are marked as used.
+ * Returns the new block ID or 0 if the device is full.
+ */
+static uint32_t rfs_block_extend(FileSystem* fs, uint32_t block_id, uint32_t used_end) {
+	BlockHeader header;
+	File* file;
+	uint32_t successor;
 
-   if(access_type == READ && *address >= fs->block_size * PROTECTED_BLOCKS) {
-	   max_length = rfs_compute_block_length(fs, block_id);
-   }
+	if(!rfs_lookup_extents(fs, block_id, &file, &successor)) {
+		rfs_block_read_header(fs, block_id, &header); // Read the file identifier
 
-   if(internal_address + length > max_length) {
-	   new_length = max_length - internal_address; // Readable/Writable length correction
-   }
+		if(header.file_id >= NUM_FILES) {
+			return 0;
+		}
 
-   if(internal_address != fs->block_size && new_length == 0) { // Goto next block
-	   *address = (block_id + 1) * fs->block_size;
-	   return rfs_access_memory(fs, address, length, access_type);
-   }
+		file = &(fs->files[header.file_id]);
+	}
 
-   if(access_type == WRITE) {
-	   rfs_block_update_usage_table(fs, *address, *address + new_length - 1);
-   }
+	uint32_t new_block_id;
+
+	if(file->primary != NO_FILE) {
+		// Keep the replica away from the block just allocated for the same data in the original file
+		File* primary = &(fs->files[file->primary]);
+		uint8_t copy = 1;
+
+		while(copy <= primary->replica_count && primary->replicas[copy - 1] != file - fs->files) {
+			copy++;
+		}
+
+		// A replica which is being rebuilt is not listed yet and takes the next position
+		uint8_t copies = copy > primary->replica_count ? copy + 1 : 1 + primary->replica_count;
+
+		new_block_id = rfs_block_alloc_mirror(fs, REPLICA, primary->last_block, copy, copies);
+	} else if(rfs_get_file_type(fs, file) == CIRCULAR) {
+		new_block_id = rfs_ring_next(fs, file, block_id);
+	} else {
+		new_block_id = rfs_block_alloc(fs, rfs_get_file_type(fs, file)); // Allocate a new block
+	}
+
+	if(!new_block_id) {
+		return 0;
+	}
 
-   return new_length;
+	rfs_block_write_header(fs, new_block_id, file - fs->files, block_id, used_end);
+	rfs_block_link(fs, file, block_id, new_block_id);
+	rfs_append_file_extent(file, new_block_id);
+
+	if(block_id == file->last_block && (block_id != file->first_block || rfs_get_file_type(fs, file) != CIRCULAR)) {
+		file->length += rfs_compute_block_length(fs, block_id) - file->tail_offset; // Counted as at mount, e.g. a frame which did not fit
+	}
+
+	file->used_blocks += 1;
+	file->last_block = new_block_id;
+	file->tail_offset = BLOCK_HEADER_SIZE;
+
+	return new_block_id;
 }
 
+static void rfs_block_link(FileSystem* fs, File* file, uint32_t block_id, uint32_t successor) {
+	uint8_t buffer[4];
+
+	rfs_device_read(fs, block_id * fs->block_size + BLOCK_SUCCESSOR_OFFSET, buffer, 4);
+
+	if(__decode32(buffer) == NO_SUCCESSOR) {
+		__encode32(buffer, successor);
+		rfs_device_write(fs, block_id * fs->block_size + BLOCK_SUCCESSOR_OFFSET, buffer, 4);
+	} else if(__decode32(buffer) != successor) {
+		// The successor field has already been programmed by a recycled chain: continue the chain at a lost block.
+		if(file->lost_block) {
+			fs->log("Warning: Chain already broken, file truncated");
+			rfs_partition_set(fs, file->lost_block, (rfs_get_file_type(fs, file) << 4) | (rfs_partition_get(fs, file->lost_block) & 0xF));
+		}
+
+		file->break_block = block_id;
+		file->lost_block = successor;
 
+		rfs_partition_set(fs, successor, rfs_partition_get(fs, successor) | 0b11110000);
+	}
+}
+
+/*
+ * Returns the block following the given one in its chain or 0 if the block is the last one.
+ * A successor is only valid if it still belongs to the same file and designates the given block as predecessor,
+ * otherwise it has been recycled in the meantime.
+ */
+uint32_t rfs_block_successor(FileSystem* fs, uint32_t block_id) {
+	BlockHeader header;
+	BlockHeader successor_header;
+	File* file;
+	uint32_t successor;
+
+	if(rfs_lookup_extents(fs, block_id, &file, &successor)) {
+		return successor; // No flash access needed
+	}
+
+	if(!rfs_block_read_header(fs, block_id, &header) || header.file_id >= NUM_FILES) {
+		return 0;
+	}
+
+	file = &(fs->files[header.file_id]);
+
+	if(block_id == file->break_block && file->lost_block) {
+		return file->lost_block;
+	}
+
+	successor = header.successor;
+
+	if(successor == NO_SUCCESSOR || successor < fs->protected_blocks || successor >= fs->num_blocks) {
+		return 0;
+	}
+
+	if(rfs_block_read_header(fs, successor, &successor_header) && successor_header.file_id == header.file_id && successor_header.predecessor == block_id) {
+		return successor;
+	}
+
+	return 0;
+}
+
+
+
+/*
+ * Returns the block of the mirror chain which holds the same data as the given block of the file or 0 if the chains differ.
+ */
+uint32_t rfs_block_mirror(FileSystem* fs, File* file, File* mirror, uint32_t block_id) {
+	uint32_t file_block = file->first_block;
+	uint32_t mirror_block = mirror->first_block;
+	uint32_t counter = 0;
+
+	while(file_block && mirror_block && counter++ < fs->num_blocks) {
+		if(file_block == block_id) {
+			return mirror_block;
+		}
+
+		file_block = rfs_block_successor(fs, file_block);
+		mirror_block = rfs_block_successor(fs, mirror_block);
+	}
+
+	return 0;
+}
 
 /*
  * Returns the number of blocks used by this file.
+ * The chain detached by a recycled block (if any) is attached where the chain of the file ends.
+ */
+uint32_t rfs_load_file_meta(FileSystem* fs, File* file) {
+	uint32_t block_id = file->first_block;
+	bool lost_attached = !file->lost_block;
+	bool extents_overflow = false;
+
+	file->resolved = true;
+
+	if(block_id && rfs_get_file_type(fs, file) == CIRCULAR) {
+		return rfs_ring_load(fs, file);
+	}
+
+	file->head_block = 0;
+
+	file->length = 0;
+	file->used_blocks = 0;
+	file->extent_count = 0;
+	file->extents_complete = false; // Do not resolve the chain from the extents while they are being built
+
+	uint32_t counter = 0;
+	uint32_t block_length = 0;
+
+	while(block_id) {
+		if(!extents_overflow) {
+			extents_overflow = !__push_extent(file, block_id);
+		}
+
+		block_length = rfs_compute_block_length(fs, block_id);
+
+		file->length += block_length - BLOCK_HEADER_SIZE;
+		file->used_blocks++;
+		file->last_block = block_id;
+
+		if(block_id == file->lost_block) {
+			lost_attached = true;
+		}
+
+		uint32_t successor = rfs_block_successor(fs, block_id);
+
+		if(!successor && !lost_attached) {
+			file->break_block = block_id;
+			successor = file->lost_block;
+			lost_attached = true;
+		}
+
+		block_id = successor;
+
+		if(counter++ > fs->num_blocks) {
+			fs->log("Warning: Cyclic block chain detected");
+			extents_overflow = true;
+			break;
+		}
+	}
+
+	file->extents_complete = !extents_overflow;
+
+	if(file->used_blocks) {
+		// Only the data of the last block ends before the end of the block
+		file->tail_offset = rfs_compute_block_end(fs, file->last_block);
+		file->length += file->tail_offset - block_length - 16; // The filename is not counted
+	}
+
+	return file->used_blocks;
+}
+
+/*
+ * Resolves the chain of a file left unresolved by a lazy mount, along with the chains of its replicas.
+ */
+void rfs_resolve_file(FileSystem* fs, File* file) {
+	if(file->resolved) {
+		return;
+	}
+
+	rfs_load_file_meta(fs, file);
+
+	for(uint8_t i = 0; i < file->replica_count; i++) {
+		rfs_resolve_file(fs, &(fs->files[file->replicas[i]]));
+	}
+}
+
+/*
+ * Circular files
+ *
+ * The root of a CIRCULAR file only holds its filename and its budget (4 bytes right after the filename).
+ * The data is written to a ring of blocks chained as usual, until the ring holds block_budget blocks or the device is full.
+ * Then, the oldest block of the ring (the head) is erased and chained after the last block, so that a ring never
+ * recycles the blocks of other files and is never recycled by them.
+ *
+ * The head is not stored: each block of the ring designates the previous block of the ring as its predecessor,
+ * which links to it, except for the head, whose predecessor is the last block of the ring (or the root before the first wrap).
+ */
+void rfs_ring_init(FileSystem* fs, File* file, uint32_t block_budget) {
+	uint32_t address = rfs_get_block_base_address(fs, file->first_block) + 16;
+	uint8_t buffer[4];
+
+	__encode32(buffer, block_budget);
+	rfs_device_write(fs, address, buffer, 4);
+	rfs_block_update_usage_table(fs, address, address + 3);
+
+	file->head_block = 0;
+	file->block_budget = block_budget;
+	file->tail_offset = BLOCK_HEADER_SIZE + 20;
+	file->extent_count = 0;
+	file->extents_complete = false; // The blocks of the ring are reused out of order
+}
+
+/*
+ * Returns the block which continues the ring after its last block: a free block while the ring grows, its head otherwise.
+ * The reused block is linked before its header is written (by rfs_block_extend), so that an interruption is detected at mount.
  */
-uint16_t rfs_load_file_meta(FileSystem* fs, File* file) {
-   uint32_t block_id = file->first_block;
+static uint32_t rfs_ring_next(FileSystem* fs, File* file, uint32_t block_id) {
+	BlockHeader header;
+	uint32_t head = file->head_block;
+	bool wrapped = head && rfs_block_read_header(fs, head, &header) && header.predecessor != file->first_block;
+
+	if(!wrapped && file->used_blocks - 1 < file->block_budget) {
+		bool erased = fs->erased_block && rfs_partition_get(fs, fs->erased_block) == 0;
+		uint32_t free_block = erased ? fs->erased_block : rfs_block_select_free(fs);
+
+		if(free_block && !rfs_block_take(fs, free_block, CIRCULAR)) {
+			return rfs_ring_next(fs, file, block_id);
+		}
+
+		if(free_block) {
+			rfs_partition_set(fs, free_block, RING_BLOCK_META);
+			rfs_block_link(fs, file, block_id, free_block);
+
+			if(!head) {
+				file->head_block = free_block;
+			}
+
+			return free_block;
+		}
+	}
+
+	if(!head || head == block_id) {
+		fs->log("Error: Ring too small to be reused");
+		return 0;
+	}
+
+	// The next block holds the oldest data from now on
+	file->head_block = rfs_block_successor(fs, head);
+	file->length -= rfs_compute_block_length(fs, head) - BLOCK_HEADER_SIZE;
+	file->used_blocks--;
+
+	rfs_block_erase(fs, head);
+	rfs_block_link(fs, file, block_id, head);
+
+	return head;
+}
+
+/*
+ * Resolves the ring from any of its blocks (file->head_block).
+ * If the power failed while a block was being chained to the ring, its header is written again.
+ */
+static uint32_t rfs_ring_load(FileSystem* fs, File* file) {
+	BlockHeader header;
+	uint8_t buffer[4];
+	uint32_t root = file->first_block;
+	uint32_t block_id = file->head_block ? file->head_block : rfs_block_successor(fs, root);
+	uint32_t counter = 0;
+
+	rfs_device_read(fs, rfs_get_block_base_address(fs, root) + 16, buffer, 4);
+
+	file->block_budget = __decode32(buffer);
+	file->extent_count = 0;
+	file->extents_complete = false;
+
+	// Walk back to the head
+	while(block_id && counter++ < fs->num_blocks) {
+		if(!rfs_block_read_header(fs, block_id, &header) || header.predecessor == root || rfs_block_successor(fs, header.predecessor) != block_id) {
+			break;
+		}
+
+		block_id = header.predecessor;
+	}
+
+	file->head_block = block_id;
+	file->last_block = root;
+	file->tail_offset = BLOCK_HEADER_SIZE + 20; // The root holds no data
+	file->length = 0;
+	file->used_blocks = 1;
+
+	while(block_id && file->used_blocks < fs->num_blocks) {
+		file->length += rfs_compute_block_length(fs, block_id) - BLOCK_HEADER_SIZE;
+		file->used_blocks++;
+		file->last_block = block_id;
+
+		block_id = rfs_block_successor(fs, block_id);
+	}
+
+	if(file->last_block != root) {
+		file->length -= rfs_compute_block_length(fs, file->last_block) - BLOCK_HEADER_SIZE;
+		file->tail_offset = rfs_compute_block_end(fs, file->last_block);
+		file->length += file->tail_offset - BLOCK_HEADER_SIZE;
+	}
+
+	/*
+	 * The block being chained is designated by the successor of the last block, or by the predecessor of the head if the
+	 * power failed while the head was being erased.
+	 */
+	uint32_t pending = rfs_block_read_header(fs, file->last_block, &header) ? header.successor : NO_SUCCESSOR;
+
+	if(pending == NO_SUCCESSOR && file->head_block && rfs_block_read_header(fs, file->head_block, &header)) {
+		pending = header.predecessor;
+	}
+
+	if(pending == root || pending == file->last_block || pending < fs->protected_blocks || pending >= fs->num_blocks) {
+		return file->used_blocks;
+	}
 
-   file->length = 0;
-   file->used_blocks = 0;
+	uint8_t meta_data = rfs_partition_get(fs, pending);
 
-   uint16_t counter = 0;
+	if(meta_data == 0) {
+		if(!rfs_block_take(fs, pending, CIRCULAR)) {
+			return file->used_blocks;
+		}
 
-   while(block_id) {
-      file->length += rfs_compute_block_length(fs, block_id);
-      file->used_blocks++;
-      file->last_block = block_id;
+		rfs_partition_set(fs, pending, RING_BLOCK_META);
+	} else if(meta_data == RING_BLOCK_META && !rfs_block_read_header(fs, pending, &header)) {
+		rfs_block_erase(fs, pending);
+	} else {
+		return file->used_blocks;
+	}
 
-      block_id = fs->data_blocks[block_id].successor;
+	fs->log("Warning: Interrupted ring block recovered");
 
-      if(counter++ > NUM_BLOCKS) {
-    	  break;
-      }
-   }
+	rfs_block_link(fs, file, file->last_block, pending);
+	rfs_block_write_header(fs, pending, file - fs->files, file->last_block);
 
-   return file->used_blocks;
+	if(!file->head_block) {
+		file->head_block = pending;
+	}
+
+	file->used_blocks++;
+	file->last_block = pending;
+	file->tail_offset = BLOCK_HEADER_SIZE;
+
+	return file->used_blocks;
 }
 
-void rfs_set_file_root(FileSystem* fs, uint16_t block_id) {
+void rfs_set_file_root(FileSystem* fs, uint32_t block_id) {
 	uint32_t address = rfs_get_block_base_address(fs, block_id);
 
-	fs->partition_table[block_id] |= 0b00001111; // Set the file base block immortal
+	rfs_partition_set(fs, block_id, rfs_partition_get(fs, block_id) | 0b00001111); // Set the file base block immortal
 	rfs_block_update_usage_table(fs, address, address + 16);
 }
 
+FileType rfs_get_file_type(FileSystem* fs, File* file) {
+	return static_cast<FileType>(rfs_partition_get(fs, file->first_block) >> 4);
+}
+
+/*
+ * Extent functions
+ *
+ * The chain of each file is cached as a list of runs of consecutive block IDs, which is a compact representation
+ * as long as the allocator hands out neighbouring blocks. It spares the header reads needed to follow a chain on flash.
+ */
+void rfs_clear_file_extents(File* file) {
+	file->extent_count = 0;
+	file->extents_complete = true;
+}
+
+/*
+ * Must be called with the block that has been linked after the last block of the file.
+ */
+void rfs_append_file_extent(File* file, uint32_t block_id) {
+	if(file->extents_complete && !__push_extent(file, block_id)) {
+		file->extents_complete = false; // The chain goes on beyond the last extent
+	}
+}
+
+static bool __push_extent(File* file, uint32_t block_id) {
+	Extent* last = file->extent_count ? &(file->extents[file->extent_count - 1]) : 0;
+
+	if(last && last->first_block + last->length == block_id) {
+		last->length++;
+	} else if(file->extent_count < FILE_EXTENTS) {
+		file->extents[file->extent_count].first_block = block_id;
+		file->extents[file->extent_count].length = 1;
+		file->extent_count++;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Returns true if the successor of the given block could be resolved from the cached extents.
+ */
+static bool rfs_lookup_extents(FileSystem* fs, uint32_t block_id, File** owner, uint32_t* successor) {
+	for(uint32_t file_id = 0; file_id < NUM_FILES; file_id++) {
+		File* file = &(fs->files[file_id]);
+
+		for(uint8_t i = 0; i < file->extent_count; i++) {
+			Extent* extent = &(file->extents[i]);
+
+			if(block_id - extent->first_block < extent->length) {
+				if(block_id + 1 < extent->first_block + extent->length) {
+					*successor = block_id + 1;
+				} else if(i + 1 < file->extent_count) {
+					*successor = file->extents[i + 1].first_block;
+				} else if(file->extents_complete) {
+					*successor = 0;
+				} else {
+					return false;
+				}
+
+				*owner = file;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Returns the file whose chain ends with the given block or 0 if there is none.
+ */
+static File* rfs_last_block_owner(FileSystem* fs, uint32_t block_id) {
+	for(uint32_t file_id = 0; file_id < NUM_FILES; file_id++) {
+		File* file = &(fs->files[file_id]);
+
+		if(file->first_block && file->last_block == block_id) {
+			return file;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Block statistics functions
  */
-uint32_t rfs_compute_block_length(FileSystem* fs, uint16_t block_id) {
+uint32_t rfs_compute_block_length(FileSystem* fs, uint32_t block_id) {
 	uint32_t address = block_id * fs->block_size;
-	uint8_t usage_table[8];
+	uint8_t buffer[16];
+	uint32_t logged_end;
 
-	fs->read(address + 8, usage_table, 8); // Skip the file id and predecessor block id
+	rfs_device_read(fs, address + BLOCK_USAGE_TABLE_OFFSET, buffer, 16); // Skip the file id and predecessor/successor block ids
 
-	uint64_t composition = 0ULL;
+	if(__read_tail_log(buffer + 8, &logged_end) == BLOCK_TAIL_LOG_ENTRIES) {
+		return logged_end; // Sealed block: the data ends there exactly
+	}
 
-	composition |= (uint64_t) usage_table[7] << 56;
-	composition |= (uint64_t) usage_table[6] << 48;
-	composition |= (uint64_t) usage_table[5] << 40;
-	composition |= (uint64_t) usage_table[4] << 32;
-	composition |= (uint64_t) usage_table[3] << 24;
-	composition |= (uint64_t) usage_table[2] << 16;
-	composition |= (uint64_t) usage_table[1] << 8;
-	composition |= (uint64_t) usage_table[0];
+	uint64_t composition = ((uint64_t) __decode32(buffer + 4) << 32) | __decode32(buffer);
 
 	return __compute_block_length(fs, composition);
 }
 
+/*
+ * Returns the offset following the last programmed byte of the block.
+ * The usage table designates the last used area, which is then scanned backwards for its erased end.
+ * Bytes 0xFF at the very end of the data cannot be told apart from erased bytes: the end logged when the data was closed
+ * on such bytes is taken instead (see rfs_block_record_end()). A used data area holds at least one byte.
+ */
+uint32_t rfs_compute_block_end(FileSystem* fs, uint32_t block_id) {
+	uint32_t address = block_id * fs->block_size;
+	uint32_t logged_end;
+	uint8_t tail_log[2 * BLOCK_TAIL_LOG_ENTRIES];
+
+	rfs_device_read(fs, address + BLOCK_TAIL_LOG_OFFSET, tail_log, sizeof(tail_log));
+
+	if(__read_tail_log(tail_log, &logged_end) == BLOCK_TAIL_LOG_ENTRIES) {
+		return logged_end;
+	}
+
+	uint32_t end = rfs_compute_block_length(fs, block_id);
+	uint32_t area_begin = end >= BLOCK_HEADER_SIZE + fs->block_size / 64 ? end - fs->block_size / 64 : BLOCK_HEADER_SIZE; // The header is never erased
+	uint32_t minimum_end = end >= BLOCK_HEADER_SIZE + fs->block_size / 64 ? area_begin + 1 : area_begin;
+	uint8_t buffer[64];
+
+	while(end > area_begin) {
+		uint32_t length = end - area_begin < sizeof(buffer) ? end - area_begin : sizeof(buffer);
+
+		rfs_device_read(fs, address + end - length, buffer, length);
+
+		for(uint32_t i = length; i > 0; i--) {
+			if(buffer[i - 1] != 0xFF) {
+				end = end - length + i;
+				return end > logged_end ? end : logged_end;
+			}
+		}
+
+		end -= length;
+	}
+
+	return minimum_end > logged_end ? minimum_end : logged_end;
+}
+
+/*
+ * Tail log
+ *
+ * The end of the data of the last block is only known to the byte while the filesystem is mounted.
+ * When a stream is closed on data which ends with 0xFF bytes, rfs_compute_block_end() would miss them at the next mount:
+ * the end is then programmed in the next entry of the tail log, as an offset from the end of the header.
+ * Once its last entry is programmed, the block is sealed: it holds no more data and its length is the last logged end.
+ */
+
+/*
+ * Logs the end of the data of the last block of the file, unless rfs_compute_block_end() recovers it already.
+ * With seal, the remaining entries are programmed as well, so that APPEND streams continue in a new block.
+ */
+void rfs_block_record_end(FileSystem* fs, File* file, bool seal) {
+	uint32_t address = file->last_block * fs->block_size + BLOCK_TAIL_LOG_OFFSET;
+	uint8_t tail_log[2 * BLOCK_TAIL_LOG_ENTRIES];
+	uint32_t logged_end;
+
+	if(!file->first_block) {
+		return;
+	}
+
+	rfs_device_read(fs, address, tail_log, sizeof(tail_log));
+
+	uint8_t entries = __read_tail_log(tail_log, &logged_end);
+
+	if(entries == BLOCK_TAIL_LOG_ENTRIES || (!seal && rfs_compute_block_end(fs, file->last_block) == file->tail_offset)) {
+		return;
+	}
+
+	uint8_t count = seal ? BLOCK_TAIL_LOG_ENTRIES - entries : 1;
+
+	for(uint8_t i = 0; i < count; i++) {
+		tail_log[2 * i] = (uint8_t) (file->tail_offset - BLOCK_HEADER_SIZE);
+		tail_log[2 * i + 1] = (uint8_t) ((file->tail_offset - BLOCK_HEADER_SIZE) >> 8);
+	}
+
+	rfs_device_write(fs, address + 2 * entries, tail_log, 2 * count);
+}
+
+bool rfs_block_sealed(FileSystem* fs, uint32_t block_id) {
+	uint8_t tail_log[2 * BLOCK_TAIL_LOG_ENTRIES];
+	uint32_t logged_end;
+
+	rfs_device_read(fs, block_id * fs->block_size + BLOCK_TAIL_LOG_OFFSET, tail_log, sizeof(tail_log));
+
+	return __read_tail_log(tail_log, &logged_end) == BLOCK_TAIL_LOG_ENTRIES;
+}
+
+/*
+ * Returns the number of programmed entries of the tail log and the last logged end (0 if none).
+ */
+static uint8_t __read_tail_log(const uint8_t* tail_log, uint32_t* end) {
+	uint8_t entries = 0;
+
+	*end = 0;
+
+	while(entries < BLOCK_TAIL_LOG_ENTRIES && (tail_log[2 * entries] | tail_log[2 * entries + 1] << 8) != NO_TAIL) {
+		*end = BLOCK_HEADER_SIZE + (tail_log[2 * entries] | tail_log[2 * entries + 1] << 8);
+		entries++;
+	}
+
+	return entries;
+}
+
 /*
  * Written length is not an actual length but must be regarded as a bit chain.
  * Consider those examples:
@@ -368,7 +1169,7 @@ static uint32_t __compute_block_length(FileSystem* fs, uint64_t usage_table) {
 }
 
 
-uint32_t rfs_get_block_base_address(FileSystem* fs, uint16_t block_id) {
+uint32_t rfs_get_block_base_address(FileSystem* fs, uint32_t block_id) {
 	return block_id * fs->block_size + BLOCK_HEADER_SIZE;
 }
 
@@ -377,21 +1178,97 @@ uint32_t rfs_get_block_base_address(FileSystem* fs, uint16_t block_id) {
 /*
  * Header update functions
  */
-void rfs_block_write_header(FileSystem* fs, uint16_t block_id, uint16_t file_id, uint16_t predecessor) {
+
+/*
+ * Programs the header of an erased block and marks its first used_end bytes as used, with a single write.
+ */
+void rfs_block_write_header(FileSystem* fs, uint32_t block_id, uint32_t file_id, uint32_t predecessor, uint32_t used_end) {
+	uint32_t address = block_id * fs->block_size;
+	uint64_t usage_bit_mask = __usage_bit_mask(fs, address, address + used_end - 1);
+	uint8_t buffer[24];
+
+	__encode32(buffer, BLOCK_MAGIC_NUMBER);
+	__encode32(buffer + 4, file_id);
+	__encode32(buffer + 8, predecessor);
+	__encode32(buffer + 12, NO_SUCCESSOR); // The successor is left erased until the chain grows
+	__encode32(buffer + 16, usage_bit_mask);
+	__encode32(buffer + 20, usage_bit_mask >> 32);
+
+	rfs_device_write(fs, address, buffer, 24);
+}
+
+/*
+ * The erase count is read before erasing the block and programmed again right after.
+ * It is lost (and restarts from 0) if the power fails in between. Returns false if the block failed to erase (NAND).
+ */
+bool rfs_block_erase(FileSystem* fs, uint32_t block_id) {
+	uint32_t erase_count = rfs_block_erase_count(fs, block_id) + 1;
+
+	if(!rfs_device_erase(fs, block_id * fs->block_size)) {
+		return false;
+	}
+
+	rfs_block_write_erase_count(fs, block_id, erase_count);
+
+	return true;
+}
+
+/*
+ * Programs the erase count of the block erased ahead, if it is still pending.
+ */
+void rfs_block_settle_erase(FileSystem* fs) {
+	if(fs->erased_block_count) {
+		rfs_block_write_erase_count(fs, fs->erased_block, fs->erased_block_count);
+		fs->erased_block_count = 0;
+	}
+}
+
+/*
+ * The count is stored bit-inverted, so that blocks which were never erased by the filesystem read as 0.
+ * Blocks holding foreign data (e.g. a device which was not blank when formatted) fail the check and read as 0 as well.
+ */
+uint32_t rfs_block_erase_count(FileSystem* fs, uint32_t block_id) {
 	uint8_t buffer[8];
 
-	buffer[0] = (uint8_t) (BLOCK_MAGIC_NUMBER);
-	buffer[1] = (uint8_t) (BLOCK_MAGIC_NUMBER >> 8);
-	buffer[2] = (uint8_t) (BLOCK_MAGIC_NUMBER >> 16);
-	buffer[3] = (uint8_t) (BLOCK_MAGIC_NUMBER >> 24);
-	buffer[4] = (uint8_t) file_id;
-	buffer[5] = (uint8_t) (file_id >> 8);
-	buffer[6] = (uint8_t) predecessor;
-	buffer[7] = (uint8_t) (predecessor >> 8);
+	if(block_id == fs->erased_block && fs->erased_block_count) {
+		return fs->erased_block_count; // Not programmed yet
+	}
+
+	rfs_device_read(fs, block_id * fs->block_size + BLOCK_ERASE_COUNT_OFFSET, buffer, 8);
+
+	uint32_t erase_count = ~__decode32(buffer);
+
+	if(~__decode32(buffer + 4) != erase_count * ERASE_COUNT_CHECK) {
+		return 0;
+	}
+
+	return erase_count;
+}
+
+static void rfs_block_write_erase_count(FileSystem* fs, uint32_t block_id, uint32_t erase_count) {
+	uint8_t buffer[8];
+
+	__encode32(buffer, ~erase_count);
+	__encode32(buffer + 4, ~(erase_count * ERASE_COUNT_CHECK));
+
+	rfs_device_write(fs, block_id * fs->block_size + BLOCK_ERASE_COUNT_OFFSET, buffer, 8);
+}
+
+/*
+ * Returns false if the block does not start with a valid magic number.
+ */
+bool rfs_block_read_header(FileSystem* fs, uint32_t block_id, BlockHeader* header) {
+	uint8_t buffer[24];
 
-	fs->write(block_id * fs->block_size, buffer, 8);
+	rfs_device_read(fs, block_id * fs->block_size, buffer, 24);
 
-	rfs_block_update_usage_table(fs, block_id * fs->block_size, block_id * fs->block_size + 16);
+	header->magic = __decode32(buffer);
+	header->file_id = __decode32(buffer + 4);
+	header->predecessor = __decode32(buffer + 8);
+	header->successor = __decode32(buffer + 12);
+	header->usage_table = ((uint64_t) __decode32(buffer + 20) << 32) | __decode32(buffer + 16);
+
+	return header->magic == BLOCK_MAGIC_NUMBER;
 }
 
 /*
@@ -407,18 +1284,8 @@ void rfs_block_write_header(FileSystem* fs, uint16_t block_id, uint16_t file_id,
  * 0000000000000000000000000000000111111111 = (1ULL << normalised_begin) - 1;
  */
 static void rfs_block_update_usage_table(FileSystem* fs, uint32_t write_begin, uint32_t write_end) {
-	uint16_t block_id = write_begin / fs->block_size;
-
-	uint8_t lsb = fs->block_size / 64;
-
-	uint8_t normalised_begin = (write_begin % fs->block_size) / lsb;
-	uint8_t normalised_end = (write_end % fs->block_size) / lsb;
-
-
-	uint64_t begin_bit_mask = (1ULL << normalised_begin) - 1;
-	uint64_t end_bit_mask = (~0ULL << (normalised_end + 1));
-
-	uint64_t usage_bit_mask = normalised_end < 63 ? (begin_bit_mask | end_bit_mask) : begin_bit_mask;
+	uint32_t block_id = write_begin / fs->block_size;
+	uint64_t usage_bit_mask = __usage_bit_mask(fs, write_begin, write_end);
 
 	/*
 	 * We cannot use the stream API because this function is called by rfs_access_memory(),
@@ -426,39 +1293,38 @@ static void rfs_block_update_usage_table(FileSystem* fs, uint32_t write_begin, u
 	 */
 	uint8_t buffer[8];
 
-	buffer[0] = usage_bit_mask;
-	buffer[1] = usage_bit_mask >> 8;
-	buffer[2] = usage_bit_mask >> 16;
-	buffer[3] = usage_bit_mask >> 24;
-	buffer[4] = usage_bit_mask >> 32;
-	buffer[5] = usage_bit_mask >> 40;
-	buffer[6] = usage_bit_mask >> 48;
-	buffer[7] = usage_bit_mask >> 56;
+	__encode32(buffer, usage_bit_mask);
+	__encode32(buffer + 4, usage_bit_mask >> 32);
 
-	fs->write(block_id * fs->block_size + 8, buffer, 8);
+	rfs_device_write(fs, block_id * fs->block_size + BLOCK_USAGE_TABLE_OFFSET, buffer, 8);
+}
+
+static uint64_t __usage_bit_mask(FileSystem* fs, uint32_t write_begin, uint32_t write_end) {
+	uint32_t lsb = fs->block_size / 64;
+
+	uint8_t normalised_begin = (write_begin % fs->block_size) / lsb;
+	uint8_t normalised_end = (write_end % fs->block_size) / lsb;
+
+
+	uint64_t begin_bit_mask = (1ULL << normalised_begin) - 1;
+	uint64_t end_bit_mask = normalised_end < 63 ? (~0ULL << (normalised_end + 1)) : 0ULL;
+
+	return begin_bit_mask | end_bit_mask;
 }
 
 /*
  * Relative time update functions
  *
- * The relative time ranges from 0 to 16 and describes more or less the age of a block.
+ * The relative time ranges from 0 to 16 and describes more or less the age of the data of a block.
  * Birth age is 14, greatest age is 0.
+ * It only decides which block is recycled when the device is full. Wear is tracked by the erase counts.
+ * All entries age at once, without rewriting the partition table (see rfs_partition_advance_time()).
  */
 static void rfs_update_relative_time(FileSystem* fs) {
-	uint8_t anchor = fs->partition_table[0] & 0xF; // Core block meta is used as a time reference
-	uint8_t available_space = 16 - (fs->total_used_blocks * 16UL) / NUM_BLOCKS; // Ranges from 0 to 15
+	uint8_t anchor = rfs_partition_get(fs, 0) & 0xF; // Core block meta is used as a time reference
+	uint8_t available_space = 16 - (fs->total_used_blocks * 16ULL) / fs->num_blocks; // Ranges from 0 to 15
 
 	if(available_space < anchor) {
-		rfs_decrease_relative_time(fs);
-	}
-}
-
-static void rfs_decrease_relative_time(FileSystem* fs) {
-	for(uint16_t block_id = 0; block_id < NUM_BLOCKS; block_id++) {
-		uint8_t* meta = &(fs->partition_table[block_id]);
-
-		if((*meta & 0b00001111) > 0 && (*meta & 0b00001111) < 0xF) {
-			(*meta)--;
-		}
+		rfs_partition_advance_time(fs);
 	}
 }
@@ -0,0 +1,228 @@
+/*
+ * checksum.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#include "checksum.h"
+
+#include "block_management.h"
+#include "device.h"
+#include "ecc.h"
+#include "encoding.h"
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/*
+ * Chunk layout of CHECKSUM, ECC and mirrored files
+ *
+ * The data area of each block is split in chunks aligned on the block boundaries (see rfs_chunk_size()).
+ * The last bytes of each chunk (the trailer) start with the fill, the offset at which the data of the chunk ends, and
+ * protect the rest of the chunk (the block header excluded) including the fill:
+ * ECC files store ECC_PARITY_SIZE Reed-Solomon parity bytes, the other files store its CRC32C.
+ * A chunk sealed when its stream is closed is thus only filled up to its fill, the readers skip the erased bytes after it.
+ * A trailer which is still erased belongs to a chunk that is being written and is not verified.
+ */
+
+#define CRC32C_POLYNOMIAL 0x82F63B78 // Castagnoli, reflected
+
+/*
+ * Slicing-by-8 tables, generated at compile time so that they are stored in flash
+ */
+typedef struct Crc32cTables {
+	uint32_t table[8][256];
+
+	constexpr Crc32cTables() : table() {
+		for(uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+
+			for(uint8_t bit = 0; bit < 8; bit++) {
+				crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+			}
+
+			table[0][i] = crc;
+		}
+
+		for(uint32_t i = 0; i < 256; i++) {
+			for(uint8_t slice = 1; slice < 8; slice++) {
+				table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+			}
+		}
+	}
+} Crc32cTables;
+
+#if !defined(__SSE4_2__) && !defined(__ARM_FEATURE_CRC32)
+static constexpr Crc32cTables crc32c_tables;
+#endif
+
+/*
+ * Non-exported function prototypes
+ */
+static bool __chunk_sealed(FileType type, const uint8_t* chunk);
+
+
+
+/*
+ * Continues the CRC32C of a byte sequence (start with crc = 0).
+ * Uses the CRC instructions of SSE4.2 and ARMv8 when they are available.
+ */
+uint32_t rfs_crc32c(uint32_t crc, const uint8_t* buffer, uint32_t length) {
+	crc = ~crc;
+
+#if defined(__SSE4_2__)
+	for(; length >= 8; length -= 8, buffer += 8) {
+		uint64_t word;
+		__builtin_memcpy(&word, buffer, 8);
+		crc = (uint32_t) _mm_crc32_u64(crc, word);
+	}
+
+	for(; length > 0; length--) {
+		crc = _mm_crc32_u8(crc, *buffer++);
+	}
+#elif defined(__ARM_FEATURE_CRC32)
+	for(; length >= 8; length -= 8, buffer += 8) {
+		uint64_t word;
+		__builtin_memcpy(&word, buffer, 8);
+		crc = __crc32cd(crc, word);
+	}
+
+	for(; length > 0; length--) {
+		crc = __crc32cb(crc, *buffer++);
+	}
+#else
+	const uint32_t (*table)[256] = crc32c_tables.table;
+
+	for(; length >= 8; length -= 8, buffer += 8) {
+		uint32_t low = crc ^ ((uint32_t) buffer[0] | (uint32_t) buffer[1] << 8 | (uint32_t) buffer[2] << 16 | (uint32_t) buffer[3] << 24);
+		uint32_t high = (uint32_t) buffer[4] | (uint32_t) buffer[5] << 8 | (uint32_t) buffer[6] << 16 | (uint32_t) buffer[7] << 24;
+
+		crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+		      table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+	}
+
+	for(; length > 0; length--) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *buffer++) & 0xFF];
+	}
+#endif
+
+	return ~crc;
+}
+
+
+
+/*
+ * Chunk geometry functions
+ */
+
+bool rfs_chunk_type(FileType type) {
+	switch(type) {
+	case ECC:
+	case CHECKSUM:
+	case LOW_REDUNDANCE:
+	case HIGH_REDUNDANCE:
+	case REPLICA:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * ECC files keep small chunks, whose parity corrects up to ECC_PARITY_SIZE / 2 bytes each. The CRC32C of the other files
+ * only detects the corruption: larger chunks keep the trailers to a small share of the programmed bytes.
+ * COMPRESSED files are padded to frames of STREAM_CHUNK_SIZE bytes.
+ */
+uint32_t rfs_chunk_size(FileType type) {
+	return rfs_chunk_type(type) && type != ECC ? CHECKSUM_CHUNK_SIZE : STREAM_CHUNK_SIZE;
+}
+
+/*
+ * Returns the offset of the first data byte of the chunk (the first chunk of a block starts with the block header).
+ */
+uint32_t rfs_chunk_data_begin(FileSystem* fs, uint32_t chunk_address) {
+	uint32_t internal_address = chunk_address % fs->block_size;
+	return internal_address < BLOCK_HEADER_SIZE ? BLOCK_HEADER_SIZE - internal_address : 0;
+}
+
+/*
+ * Returns the offset of the chunk trailer.
+ */
+uint32_t rfs_chunk_data_end(FileType type) {
+	switch(type) {
+	case ECC:
+		return STREAM_CHUNK_SIZE - ECC_PARITY_SIZE - CHUNK_FILL_SIZE;
+	default:
+		return rfs_chunk_type(type) ? CHECKSUM_CHUNK_SIZE - CHECKSUM_SIZE - CHUNK_FILL_SIZE : STREAM_CHUNK_SIZE;
+	}
+}
+
+/*
+ * Returns the offset at which the data of the checked chunk ends: its fill, or the trailer if the chunk is not sealed.
+ */
+uint32_t rfs_chunk_fill(FileType type, const uint8_t* chunk) {
+	uint32_t data_end = rfs_chunk_data_end(type);
+	uint32_t fill = CHUNK_FILL_SIZE > 1 ? chunk[data_end] | chunk[data_end + 1] << 8 : chunk[data_end];
+
+	return __chunk_sealed(type, chunk) && fill < data_end ? fill : data_end;
+}
+
+/*
+ * Corrects the chunk in place if possible.
+ * Returns the number of corrected bytes or -1 if the chunk is corrupted.
+ */
+int32_t rfs_chunk_check(FileSystem* fs, FileType type, uint32_t chunk_address, uint8_t* chunk) {
+	uint32_t data_begin = rfs_chunk_data_begin(fs, chunk_address);
+	uint32_t data_end = rfs_chunk_data_end(type);
+
+	if(!__chunk_sealed(type, chunk)) {
+		return 0;
+	}
+
+	if(type == ECC) {
+		return rfs_ecc_correct(chunk + data_begin, STREAM_CHUNK_SIZE - data_begin);
+	}
+
+	uint32_t checksum_offset = data_end + CHUNK_FILL_SIZE;
+
+	return rfs_crc32c(0, chunk + data_begin, checksum_offset - data_begin) == __decode32(chunk + checksum_offset) ? 0 : -1;
+}
+
+/*
+ * Returns the number of corrupted (uncorrectable) chunks in the used part of the block.
+ */
+uint32_t rfs_chunk_check_block(FileSystem* fs, FileType type, uint32_t block_id) {
+	uint8_t chunk[CHECKSUM_CHUNK_SIZE];
+	uint32_t chunk_size = rfs_chunk_size(type);
+	uint32_t block_address = block_id * fs->block_size;
+	uint32_t length = rfs_compute_block_length(fs, block_id);
+	uint32_t corrupted_chunks = 0;
+
+	for(uint32_t offset = 0; offset < length && offset + chunk_size <= fs->block_size; offset += chunk_size) {
+		rfs_device_read(fs, block_address + offset, chunk, chunk_size);
+
+		if(rfs_chunk_check(fs, type, block_address + offset, chunk) < 0) {
+			corrupted_chunks++;
+		}
+	}
+
+	return corrupted_chunks;
+}
+
+/*
+ * A chunk is sealed once its CRC32C or parity is programmed. Its fill is not looked at: the filename of an ECC file
+ * extends over the fill of the first chunk, which is never sealed.
+ */
+static bool __chunk_sealed(FileType type, const uint8_t* chunk) {
+	bool sealed = false;
+
+	for(uint32_t i = rfs_chunk_data_end(type) + CHUNK_FILL_SIZE; i < rfs_chunk_size(type); i++) {
+		sealed |= chunk[i] != 0xFF;
+	}
+
+	return sealed;
+}
@@ -0,0 +1,211 @@
+/*
+ * codec.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#include "codec.h"
+
+#include "encoding.h"
+
+#include <string.h>
+
+/*
+ * Frame format of COMPRESSED files
+ *
+ * The data is split in frames of STREAM_CHUNK_SIZE bytes, read as CODEC_FRAME_WORDS little-endian 32-bit words.
+ * Each word is replaced by its difference with the word 'stride' words before (1 <= stride <= CODEC_FRAME_WORDS),
+ * which is the same channel of the previous sample as long as the records are at most STREAM_CHUNK_SIZE bytes long.
+ * The differences are zig-zag encoded and packed on the smallest common bit width:
+ *
+ * 0:      Bit width (0...32)
+ * 1:      Stride - 1
+ * 2...:   CODEC_FRAME_WORDS values of 'width' bits, least significant bit first
+ *
+ * The last frame written by a stream holds fewer bytes and is stored verbatim:
+ *
+ * 0:      SHORT_FRAME | length (0...STREAM_CHUNK_SIZE - 1)
+ * 1...:   Data
+ *
+ * The history (the words of the previous frame) is cleared after a short frame and at the beginning of each block,
+ * so that each block is decoded on its own.
+ *
+ * A frame never ends with 0xFF, which cannot be told apart from erased memory at the end of a file (e.g. after a crash):
+ * such a frame is followed by a TERMINATOR byte, an empty frame of its own.
+ */
+
+#define SHORT_FRAME 0x40
+#define TERMINATOR 0x80
+
+/*
+ * Non-exported function prototypes
+ */
+static uint32_t __zigzag(uint32_t delta);
+static uint32_t __unzigzag(uint32_t value);
+static uint32_t __terminate(uint8_t* frame, uint32_t length);
+
+
+
+/*
+ * Returns the length of the frame, its terminator included.
+ */
+uint32_t rfs_codec_encode(uint32_t* history, const uint8_t* raw, uint32_t length, uint8_t* frame) {
+	if(length < STREAM_CHUNK_SIZE) {
+		frame[0] = SHORT_FRAME | length;
+		memcpy(frame + 1, raw, length);
+		memset(history, 0, CODEC_FRAME_WORDS * sizeof(uint32_t));
+
+		return __terminate(frame, 1 + length);
+	}
+
+	uint32_t words[2 * CODEC_FRAME_WORDS]; // History followed by the frame
+
+	memcpy(words, history, CODEC_FRAME_WORDS * sizeof(uint32_t));
+
+	for(uint32_t i = 0; i < CODEC_FRAME_WORDS; i++) {
+		words[CODEC_FRAME_WORDS + i] = __decode32(raw + 4 * i);
+	}
+
+	/*
+	 * Choose the stride which leads to the smallest differences.
+	 * The bit width of the union of the values is the width of the largest value.
+	 */
+	uint32_t stride = 1;
+	uint32_t union_bits = 0xFFFFFFFF;
+
+	for(uint32_t candidate = 1; candidate <= CODEC_FRAME_WORDS && union_bits; candidate++) {
+		uint32_t candidate_bits = 0;
+
+		for(uint32_t i = CODEC_FRAME_WORDS; i < 2 * CODEC_FRAME_WORDS; i++) {
+			candidate_bits |= __zigzag(words[i] - words[i - candidate]);
+		}
+
+		if(candidate_bits < union_bits) {
+			stride = candidate;
+			union_bits = candidate_bits;
+		}
+	}
+
+	uint32_t width = 0;
+
+	while(width < 32 && (union_bits >> width)) {
+		width++;
+	}
+
+	frame[0] = width;
+	frame[1] = stride - 1;
+
+	uint8_t* output = frame + 2;
+	uint64_t accumulator = 0;
+	uint32_t accumulated_bits = 0;
+
+	for(uint32_t i = CODEC_FRAME_WORDS; i < 2 * CODEC_FRAME_WORDS; i++) {
+		accumulator |= (uint64_t) __zigzag(words[i] - words[i - stride]) << accumulated_bits;
+		accumulated_bits += width;
+
+		while(accumulated_bits >= 8) {
+			*output++ = accumulator;
+			accumulator >>= 8;
+			accumulated_bits -= 8;
+		}
+	}
+
+	memcpy(history, words + CODEC_FRAME_WORDS, CODEC_FRAME_WORDS * sizeof(uint32_t));
+
+	return __terminate(frame, 2 + 2 * width); // CODEC_FRAME_WORDS * width bits
+}
+
+/*
+ * Decodes the frame at the beginning of the given bytes into 'raw' and sets the number of decoded bytes.
+ * Returns the length of the frame or -1 if the frame is invalid or truncated.
+ */
+int32_t rfs_codec_decode(uint32_t* history, const uint8_t* frame, uint32_t available, uint8_t* raw, uint32_t* length) {
+	if(available == 0) {
+		return -1;
+	}
+
+	if(frame[0] == TERMINATOR) {
+		*length = 0;
+		return 1;
+	}
+
+	if((frame[0] & 0b11000000) == SHORT_FRAME) {
+		uint32_t short_length = frame[0] & 0b00111111;
+
+		if(1 + short_length > available) {
+			return -1;
+		}
+
+		memcpy(raw, frame + 1, short_length);
+		memset(history, 0, CODEC_FRAME_WORDS * sizeof(uint32_t));
+		*length = short_length;
+
+		return 1 + short_length;
+	}
+
+	uint32_t width = frame[0];
+
+	if(width > 32 || available < 2 || frame[1] >= CODEC_FRAME_WORDS || available < 2 + 2 * width) {
+		return -1;
+	}
+
+	uint32_t stride = frame[1] + 1;
+	uint32_t mask = width < 32 ? (1UL << width) - 1 : 0xFFFFFFFF;
+
+	/*
+	 * The values are extracted independently of each other (a loop the compiler can vectorise),
+	 * from a copy of the payload which is padded so that the last value can be read with a 5-byte window.
+	 */
+	uint8_t payload[2 * 32 + 8] = { 0 };
+	uint32_t values[CODEC_FRAME_WORDS];
+
+	memcpy(payload, frame + 2, 2 * width);
+
+	for(uint32_t i = 0; i < CODEC_FRAME_WORDS; i++) {
+		uint32_t bit = i * width;
+		const uint8_t* window = payload + bit / 8;
+
+		uint64_t composition = (uint64_t) window[4] << 32 | (uint64_t) __decode32(window);
+
+		values[i] = (composition >> (bit % 8)) & mask;
+	}
+
+	uint32_t words[2 * CODEC_FRAME_WORDS];
+
+	memcpy(words, history, CODEC_FRAME_WORDS * sizeof(uint32_t));
+
+	for(uint32_t i = 0; i < CODEC_FRAME_WORDS; i++) {
+		words[CODEC_FRAME_WORDS + i] = words[CODEC_FRAME_WORDS + i - stride] + __unzigzag(values[i]);
+		__encode32(raw + 4 * i, words[CODEC_FRAME_WORDS + i]);
+	}
+
+	memcpy(history, words + CODEC_FRAME_WORDS, CODEC_FRAME_WORDS * sizeof(uint32_t));
+	*length = STREAM_CHUNK_SIZE;
+
+	return 2 + 2 * width;
+}
+
+
+
+/*
+ * Maps small negative and positive differences to small unsigned values: 0, -1, 1, -2, 2... -> 0, 1, 2, 3, 4...
+ */
+static uint32_t __zigzag(uint32_t delta) {
+	return (delta << 1) ^ (0 - (delta >> 31));
+}
+
+static uint32_t __unzigzag(uint32_t value) {
+	return (value >> 1) ^ (0 - (value & 0b1));
+}
+
+/*
+ * Appends a TERMINATOR to the frame if its last byte is 0xFF. Returns the new length.
+ */
+static uint32_t __terminate(uint8_t* frame, uint32_t length) {
+	if(length && frame[length - 1] == 0xFF) {
+		frame[length++] = TERMINATOR;
+	}
+
+	return length;
+}
@@ -0,0 +1,476 @@
+/*
+ * device.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#include "device.h"
+
+#include <string.h>
+
+/*
+ * Device striping
+ *
+ * All filesystem addresses are logical: address = block_id * block_size + offset.
+ * They are relative to the partition, which starts partition_offset bytes after the beginning of the (striped) device.
+ * When several devices are bound, block n of the device is stored in block n / num_devices of device n % num_devices,
+ * so that consecutive blocks of a chain land on different devices.
+ *
+ * Header cache
+ *
+ * Reads which fall within the first CACHED_HEADER_SIZE bytes of a block are served from the header cache (LRU).
+ * Every write goes through rfs_device_write(), which programs the cached copy as the device does (bits are only cleared),
+ * and every erase through rfs_device_erase(), which caches the erased header of the block (0xFF) since a header is
+ * programmed right after an erase: the cache is never flushed.
+ *
+ * Erase suspension
+ *
+ * Only the erase of the block erased ahead of its allocation (fs->erased_block) is suspended. While it is, the device
+ * accepts reads and programs of the other blocks. Any access to the erased block (its header aside, which is cached), and
+ * any other erase, resumes it first: the device then completes the erase before it performs the access.
+ *
+ * NAND policy
+ *
+ * With fs->page_size set, writes are staged in fs->staged_pages and each page is programmed whole, once its last byte is
+ * written, when its buffer is needed for another page, or by rfs_device_sync(). Reads see the staged pages.
+ * Headers are written back instead: their updates (usage table, successor) only reach the header cache, which programs
+ * them together with the first page of the block, or alone once evicted or synced. A NAND page can be programmed a few
+ * times only between two erases, whereas a header changes with nearly every write.
+ */
+
+/*
+ * Non-exported function prototypes
+ */
+static Device* rfs_device_map(FileSystem* fs, uint32_t* address);
+static void rfs_device_load(FileSystem* fs, uint32_t address, uint8_t* buffer, uint32_t length);
+static CachedHeader* rfs_device_header(FileSystem* fs, uint32_t block_id, bool load);
+static CachedHeader* rfs_device_lookup(FileSystem* fs, uint32_t block_id);
+static void rfs_device_program_headers(FileSystem* fs, uint32_t address, const uint8_t* buffer, uint32_t length);
+static void rfs_device_settle(FileSystem* fs, uint32_t address, uint32_t length);
+static void rfs_device_program(FileSystem* fs, uint32_t address, uint8_t* buffer, uint32_t length);
+static void rfs_device_write_back(FileSystem* fs, CachedHeader* cached);
+#ifdef RFS_NAND
+static void rfs_device_stage(FileSystem* fs, uint32_t address, const uint8_t* buffer, uint32_t length);
+static StagedPage* rfs_device_page(FileSystem* fs, uint32_t page_address, bool erased);
+static void rfs_device_program_page(FileSystem* fs, StagedPage* page);
+#endif
+
+
+
+void rfs_device_read(FileSystem* fs, uint32_t address, uint8_t* buffer, uint32_t length) {
+	uint32_t offset = address % fs->block_size;
+
+	if(length && offset + length <= CACHED_HEADER_SIZE) {
+		memcpy(buffer, rfs_device_header(fs, address / fs->block_size, true)->header + offset, length);
+		return;
+	}
+
+	if(fs->page_size && length && offset < CACHED_HEADER_SIZE) { // The header may not be programmed yet
+		uint32_t header_length = CACHED_HEADER_SIZE - offset;
+
+		memcpy(buffer, rfs_device_header(fs, address / fs->block_size, true)->header + offset, header_length);
+
+		address += header_length;
+		buffer += header_length;
+		length -= header_length;
+	}
+
+	rfs_device_load(fs, address, buffer, length);
+}
+
+void rfs_device_write(FileSystem* fs, uint32_t address, uint8_t* buffer, uint32_t length) {
+	rfs_device_program_headers(fs, address, buffer, length);
+
+#ifdef RFS_NAND
+	if(fs->page_size) {
+		rfs_device_stage(fs, address, buffer, length);
+		return;
+	}
+#endif
+
+	rfs_device_program(fs, address, buffer, length);
+}
+
+/*
+ * Returns false if the device reported the erase as failed (NAND): the block has to be retired.
+ */
+bool rfs_device_erase(FileSystem* fs, uint32_t address) {
+	uint32_t block_id = address / fs->block_size;
+	CachedHeader* cached = rfs_device_lookup(fs, block_id);
+
+	if(cached->loaded && cached->block_id != block_id) {
+		rfs_device_write_back(fs, cached);
+	}
+
+#ifdef RFS_NAND
+	for(uint8_t i = 0; i < NAND_STAGED_PAGES; i++) {
+		if(fs->staged_pages[i].staged && fs->staged_pages[i].address / fs->block_size == block_id) {
+			fs->staged_pages[i].staged = false; // Erased anyway
+		}
+	}
+#endif
+
+	Device* device = rfs_device_map(fs, &address);
+
+	rfs_device_resume(fs); // One erase at a time
+	device->erase_block(address);
+
+	memset(cached->header, 0xFF, CACHED_HEADER_SIZE);
+	cached->block_id = block_id;
+	cached->loaded = true;
+	cached->dirty = false;
+	cached->last_use = ++fs->header_clock;
+
+	return !device->failed || !device->failed();
+}
+
+/*
+ * Suspends the erase of the erased block if it is still in progress. Returns true if it is suspended.
+ */
+bool rfs_device_suspend(FileSystem* fs) {
+	if(fs->suspended_device || !fs->erased_block_count) {
+		return fs->suspended_device != 0; // Complete once its erase count is programmed
+	}
+
+	uint32_t address = fs->erased_block * fs->block_size;
+	Device* device = rfs_device_map(fs, &address);
+
+	if(device->erase_suspend && device->erase_resume && device->busy && device->busy() && device->erase_suspend()) {
+		fs->suspended_device = device;
+	}
+
+	return fs->suspended_device != 0;
+}
+
+void rfs_device_resume(FileSystem* fs) {
+	Device* device = fs->suspended_device;
+
+	if(device) {
+		fs->suspended_device = 0;
+		device->erase_resume();
+	}
+}
+
+/*
+ * Returns the address in memory of the byte at the given address (0 if its device is not memory-mapped).
+ * The bytes which follow are mapped contiguously up to the end of the block.
+ */
+const uint8_t* rfs_device_pointer(FileSystem* fs, uint32_t address) {
+	Device* device = rfs_device_map(fs, &address);
+
+	return device->map && !fs->page_size ? device->map(address) : 0; // The device may lag behind the staged pages
+}
+
+/*
+ * Programs the headers and pages staged by the NAND policy.
+ */
+void rfs_device_sync(FileSystem* fs) {
+	if(!fs->page_size) {
+		return;
+	}
+
+	for(uint32_t i = 0; i < CACHED_HEADERS; i++) {
+		rfs_device_write_back(fs, &(fs->header_cache[i]));
+	}
+
+#ifdef RFS_NAND
+	for(uint8_t i = 0; i < NAND_STAGED_PAGES; i++) {
+		if(fs->staged_pages[i].staged) {
+			rfs_device_program_page(fs, &(fs->staged_pages[i]));
+		}
+	}
+#endif
+}
+
+/*
+ * Returns true if the block is marked bad on its device (NAND).
+ */
+bool rfs_device_bad_block(FileSystem* fs, uint32_t block_id) {
+	uint32_t address = block_id * fs->block_size;
+	Device* device = rfs_device_map(fs, &address);
+
+	return device->bad_block && device->bad_block(address);
+}
+
+void rfs_device_clear_cache(FileSystem* fs) {
+	for(uint32_t i = 0; i < CACHED_HEADERS; i++) {
+		fs->header_cache[i].loaded = false;
+		fs->header_cache[i].dirty = false;
+	}
+
+	fs->header_clock = 0;
+	fs->header_hits = 0;
+	fs->header_misses = 0;
+
+#ifdef RFS_NAND
+	for(uint8_t i = 0; i < NAND_STAGED_PAGES; i++) {
+		fs->staged_pages[i].staged = false;
+	}
+
+	fs->page_clock = 0;
+#endif
+}
+
+
+
+static void rfs_device_load(FileSystem* fs, uint32_t address, uint8_t* buffer, uint32_t length) {
+	rfs_device_settle(fs, address, length);
+
+	if(fs->num_devices == 1) {
+		fs->devices[0].read(fs->partition_offset + address, buffer, length);
+	} else {
+		for(uint32_t done = 0; done < length;) {
+			uint32_t physical_address = address + done;
+			uint32_t chunk = fs->block_size - physical_address % fs->block_size; // Accesses must not cross a block boundary
+
+			if(chunk > length - done) {
+				chunk = length - done;
+			}
+
+			rfs_device_map(fs, &physical_address)->read(physical_address, buffer + done, chunk);
+			done += chunk;
+		}
+	}
+
+#ifdef RFS_NAND
+	for(uint8_t i = 0; fs->page_size && i < NAND_STAGED_PAGES; i++) {
+		StagedPage* page = &(fs->staged_pages[i]);
+
+		if(page->staged && page->address < address + length && address < page->address + fs->page_size) {
+			uint32_t begin = page->address > address ? page->address : address;
+			uint32_t end = page->address + fs->page_size < address + length ? page->address + fs->page_size : address + length;
+
+			memcpy(buffer + begin - address, page->data + begin - page->address, end - begin);
+		}
+	}
+#endif
+}
+
+static Device* rfs_device_map(FileSystem* fs, uint32_t* address) {
+	uint32_t block_id = (fs->partition_offset + *address) / fs->block_size;
+
+	*address = (block_id / fs->num_devices) * fs->block_size + *address % fs->block_size;
+
+	return &(fs->devices[block_id % fs->num_devices]);
+}
+
+/*
+ * Returns the cached header of the block, loading it in place of the least recently used one if needed (0 if not cached and !load).
+ */
+static CachedHeader* rfs_device_header(FileSystem* fs, uint32_t block_id, bool load) {
+	CachedHeader* victim = rfs_device_lookup(fs, block_id);
+
+	if(victim->loaded && victim->block_id == block_id) {
+		victim->last_use = load ? ++fs->header_clock : victim->last_use;
+		fs->header_hits += load ? 1 : 0;
+		return victim;
+	}
+
+	if(!load) {
+		return 0;
+	}
+
+	fs->header_misses++;
+
+	if(victim->loaded) {
+		rfs_device_write_back(fs, victim);
+	}
+
+	rfs_device_load(fs, block_id * fs->block_size, victim->header, CACHED_HEADER_SIZE);
+	victim->block_id = block_id;
+	victim->loaded = true;
+	victim->last_use = ++fs->header_clock;
+
+	return victim;
+}
+
+/*
+ * Returns the cached header of the block or, if not cached, the entry to replace (a free one or the least recently used).
+ */
+static CachedHeader* rfs_device_lookup(FileSystem* fs, uint32_t block_id) {
+	CachedHeader* victim = &(fs->header_cache[0]);
+
+	for(uint32_t i = 0; i < CACHED_HEADERS; i++) {
+		CachedHeader* cached = &(fs->header_cache[i]);
+
+		if(cached->loaded && cached->block_id == block_id) {
+			return cached;
+		}
+
+		if(victim->loaded && (!cached->loaded || cached->last_use < victim->last_use)) {
+			victim = cached; // Least recently used header
+		}
+	}
+
+	return victim;
+}
+
+/*
+ * Applies a write to the cached headers it overlaps. NOR flash memories only clear bits.
+ * With the NAND policy, the header is cached first: the cache holds it until it is written back.
+ */
+static void rfs_device_program_headers(FileSystem* fs, uint32_t address, const uint8_t* buffer, uint32_t length) {
+	while(length) {
+		uint32_t offset = address % fs->block_size;
+		uint32_t chunk = fs->block_size - offset;
+
+		if(chunk > length) {
+			chunk = length;
+		}
+
+		CachedHeader* cached = offset < CACHED_HEADER_SIZE ? rfs_device_header(fs, address / fs->block_size, fs->page_size != 0) : 0;
+
+		for(uint32_t i = offset; cached && i < CACHED_HEADER_SIZE && i < offset + chunk; i++) {
+			uint8_t programmed = cached->header[i] & buffer[i - offset];
+
+			cached->dirty = cached->dirty || (fs->page_size && programmed != cached->header[i]);
+			cached->header[i] = programmed;
+		}
+
+		address += chunk;
+		buffer += chunk;
+		length -= chunk;
+	}
+}
+
+/*
+ * Resumes the suspended erase if the access overlaps the erased block.
+ */
+static void rfs_device_settle(FileSystem* fs, uint32_t address, uint32_t length) {
+	uint32_t erased_address = fs->erased_block * fs->block_size;
+
+	if(fs->suspended_device && address < erased_address + fs->block_size && erased_address < address + length) {
+		rfs_device_resume(fs);
+	}
+}
+
+static void rfs_device_program(FileSystem* fs, uint32_t address, uint8_t* buffer, uint32_t length) {
+	rfs_device_settle(fs, address, length);
+
+	while(length) {
+		uint32_t physical_address = fs->partition_offset + address;
+		uint32_t chunk = length;
+		Device* device = &(fs->devices[0]);
+
+		if(fs->num_devices > 1) {
+			physical_address = address;
+			chunk = fs->block_size - address % fs->block_size;
+			chunk = chunk < length ? chunk : length;
+			device = rfs_device_map(fs, &physical_address);
+		}
+
+		device->write(physical_address, buffer, chunk);
+
+		if(device->failed && device->failed()) {
+			fs->log("Error: Page program failed"); // The data is lost
+		}
+
+		address += chunk;
+		buffer += chunk;
+		length -= chunk;
+	}
+}
+
+/*
+ * Programs the header if it is dirty, with the data staged for its page if any. Headers are only dirty with the NAND policy.
+ */
+static void rfs_device_write_back(FileSystem* fs, CachedHeader* cached) {
+#ifdef RFS_NAND
+	if(cached->loaded && cached->dirty) {
+		rfs_device_program_page(fs, rfs_device_page(fs, cached->block_id * fs->block_size, true));
+	}
+#else
+	(void) fs;
+	(void) cached;
+#endif
+}
+
+#ifdef RFS_NAND
+/*
+ * Applies a write to the staged pages, the headers aside (see rfs_device_program_headers()). Complete pages are programmed.
+ */
+static void rfs_device_stage(FileSystem* fs, uint32_t address, const uint8_t* buffer, uint32_t length) {
+	while(length) {
+		uint32_t offset = address % fs->page_size;
+		uint32_t chunk = fs->page_size - offset;
+		uint32_t block_offset = address % fs->block_size;
+		uint32_t skipped = block_offset < CACHED_HEADER_SIZE ? CACHED_HEADER_SIZE - block_offset : 0;
+
+		if(chunk > length) {
+			chunk = length;
+		}
+
+		if(skipped < chunk) {
+			StagedPage* page = rfs_device_page(fs, address - offset, offset == 0 && chunk == fs->page_size);
+
+			for(uint32_t i = offset + skipped; i < offset + chunk; i++) {
+				page->data[i] &= buffer[i - offset];
+			}
+
+			if(offset + chunk == fs->page_size) {
+				rfs_device_program_page(fs, page); // Appended up to its end
+			}
+		}
+
+		address += chunk;
+		buffer += chunk;
+		length -= chunk;
+	}
+}
+
+/*
+ * Returns the staged page at the given address, staging it in place of the least recently used one if needed.
+ * A page which is written whole (erased: true) is not read from the device.
+ */
+static StagedPage* rfs_device_page(FileSystem* fs, uint32_t page_address, bool erased) {
+	StagedPage* victim = &(fs->staged_pages[0]);
+
+	for(uint8_t i = 0; i < NAND_STAGED_PAGES; i++) {
+		StagedPage* page = &(fs->staged_pages[i]);
+
+		if(page->staged && page->address == page_address) {
+			page->last_use = ++fs->page_clock;
+			return page;
+		}
+
+		if(victim->staged && (!page->staged || page->last_use < victim->last_use)) {
+			victim = page; // Least recently used page
+		}
+	}
+
+	if(victim->staged) {
+		rfs_device_program_page(fs, victim); // Programmed before its end: the next write to the page programs it again
+	}
+
+	if(erased) {
+		memset(victim->data, 0xFF, fs->page_size); // Programming 0xFF leaves the cells as they are
+	} else {
+		rfs_device_load(fs, page_address, victim->data, fs->page_size);
+	}
+
+	victim->address = page_address;
+	victim->staged = true;
+	victim->last_use = ++fs->page_clock;
+
+	return victim;
+}
+
+/*
+ * Programs the page, together with the header of the block if the page is the first one.
+ */
+static void rfs_device_program_page(FileSystem* fs, StagedPage* page) {
+	CachedHeader* cached = page->address % fs->block_size == 0 ? rfs_device_header(fs, page->address / fs->block_size, false) : 0;
+
+	if(cached && cached->dirty) {
+		for(uint32_t i = 0; i < CACHED_HEADER_SIZE; i++) {
+			page->data[i] &= cached->header[i];
+		}
+
+		cached->dirty = false;
+	}
+
+	page->staged = false;
+	rfs_device_program(fs, page->address, page->data, fs->page_size);
+}
+#endif
@@ -0,0 +1,257 @@
+/*
+ * ecc.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#include "ecc.h"
+
+/*
+ * Reed-Solomon code over GF(256)
+ *
+ * Each codeword is a (shortened) RS(255, 255 - ECC_PARITY_SIZE) codeword: the data bytes followed by ECC_PARITY_SIZE parity bytes.
+ * The byte at position p of a codeword of length n is the coefficient of degree n - 1 - p.
+ * The roots of the generator polynomial are alpha^0 ... alpha^(ECC_PARITY_SIZE - 1) and up to ECC_PARITY_SIZE / 2 corrupted bytes are corrected.
+ */
+
+#define GF_POLYNOMIAL 0x11D // x^8 + x^4 + x^3 + x^2 + 1
+
+/*
+ * Arithmetic tables, generated at compile time so that they are stored in flash
+ */
+typedef struct GaloisTables {
+	uint8_t exp[512]; // Doubled to avoid reducing the sum of two logarithms
+	uint8_t log[256];
+	uint8_t generator[ECC_PARITY_SIZE + 1]; // Highest degree first, generator[0] = 1
+	uint8_t generator_product[ECC_PARITY_SIZE][256]; // generator_product[j][x] = generator[j + 1] * x
+
+	constexpr GaloisTables() : exp(), log(), generator(), generator_product() {
+		uint32_t x = 1;
+
+		for(uint32_t i = 0; i < 255; i++) {
+			exp[i] = x;
+			exp[i + 255] = x;
+			log[x] = i;
+
+			x <<= 1;
+
+			if(x & 0x100) {
+				x ^= GF_POLYNOMIAL;
+			}
+		}
+
+		exp[510] = exp[0];
+		exp[511] = exp[1];
+
+		generator[0] = 1;
+
+		for(uint32_t root = 0; root < ECC_PARITY_SIZE; root++) {
+			// generator *= (x - alpha^root)
+			for(uint32_t i = root + 1; i > 0; i--) {
+				uint8_t product = generator[i - 1] ? exp[log[generator[i - 1]] + root] : 0;
+				generator[i] ^= product;
+			}
+		}
+
+		for(uint32_t j = 0; j < ECC_PARITY_SIZE; j++) {
+			for(uint32_t x = 1; x < 256; x++) {
+				generator_product[j][x] = generator[j + 1] ? exp[log[generator[j + 1]] + log[x]] : 0;
+			}
+		}
+	}
+} GaloisTables;
+
+static constexpr GaloisTables gf;
+
+/*
+ * Non-exported function prototypes
+ */
+static inline uint8_t __gf_mul(uint8_t a, uint8_t b);
+static inline uint8_t __gf_div(uint8_t a, uint8_t b);
+static inline uint8_t __gf_pow(uint8_t exponent);
+static uint8_t __poly_eval(const uint8_t* poly, uint32_t degree, uint8_t x);
+
+
+
+/*
+ * Continues the systematic encoding of a codeword (start with zeroed parity bytes).
+ */
+void rfs_ecc_update(uint8_t* parity, const uint8_t* buffer, uint32_t length) {
+	for(uint32_t i = 0; i < length; i++) {
+		uint8_t feedback = buffer[i] ^ parity[0];
+
+		for(uint32_t j = 0; j < ECC_PARITY_SIZE - 1; j++) {
+			parity[j] = parity[j + 1] ^ gf.generator_product[j][feedback];
+		}
+
+		parity[ECC_PARITY_SIZE - 1] = gf.generator_product[ECC_PARITY_SIZE - 1][feedback];
+	}
+}
+
+/*
+ * Corrects the codeword in place.
+ * Returns the number of corrected bytes or -1 if the codeword holds too many errors to be corrected.
+ */
+int32_t rfs_ecc_correct(uint8_t* codeword, uint32_t length) {
+	uint8_t parity[ECC_PARITY_SIZE] = { 0 };
+	bool valid = true;
+
+	/*
+	 * Fast path: the codeword is valid if its data bytes encode to its parity bytes.
+	 */
+	rfs_ecc_update(parity, codeword, length - ECC_PARITY_SIZE);
+
+	for(uint32_t i = 0; i < ECC_PARITY_SIZE; i++) {
+		valid &= parity[i] == codeword[length - ECC_PARITY_SIZE + i];
+	}
+
+	if(valid) {
+		return 0;
+	}
+
+	/*
+	 * Syndromes: S_j = c(alpha^j)
+	 */
+	uint8_t syndromes[ECC_PARITY_SIZE] = { 0 };
+
+	for(uint32_t j = 0; j < ECC_PARITY_SIZE; j++) {
+		uint8_t syndrome = 0;
+
+		for(uint32_t p = 0; p < length; p++) {
+			syndrome = (syndrome ? gf.exp[gf.log[syndrome] + j] : 0) ^ codeword[p];
+		}
+
+		syndromes[j] = syndrome;
+	}
+
+	/*
+	 * Berlekamp-Massey: error locator polynomial (lowest degree first)
+	 */
+	uint8_t locator[ECC_PARITY_SIZE + 1] = { 1 };
+	uint8_t previous[ECC_PARITY_SIZE + 1] = { 1 };
+	uint8_t previous_discrepancy = 1;
+	uint32_t errors = 0;
+	uint32_t shift = 1;
+
+	for(uint32_t n = 0; n < ECC_PARITY_SIZE; n++) {
+		uint8_t discrepancy = syndromes[n];
+
+		for(uint32_t i = 1; i <= errors; i++) {
+			discrepancy ^= __gf_mul(locator[i], syndromes[n - i]);
+		}
+
+		if(discrepancy == 0) {
+			shift++;
+			continue;
+		}
+
+		uint8_t scale = __gf_div(discrepancy, previous_discrepancy);
+		uint8_t backup[ECC_PARITY_SIZE + 1];
+
+		for(uint32_t i = 0; i <= ECC_PARITY_SIZE; i++) {
+			backup[i] = locator[i];
+		}
+
+		for(uint32_t i = shift; i <= ECC_PARITY_SIZE; i++) {
+			locator[i] ^= __gf_mul(scale, previous[i - shift]);
+		}
+
+		if(2 * errors <= n) {
+			errors = n + 1 - errors;
+
+			for(uint32_t i = 0; i <= ECC_PARITY_SIZE; i++) {
+				previous[i] = backup[i];
+			}
+
+			previous_discrepancy = discrepancy;
+			shift = 1;
+		} else {
+			shift++;
+		}
+	}
+
+	if(2 * errors > ECC_PARITY_SIZE) {
+		return -1;
+	}
+
+	/*
+	 * Error evaluator polynomial: S(x) * locator(x) mod x^ECC_PARITY_SIZE
+	 */
+	uint8_t evaluator[ECC_PARITY_SIZE] = { 0 };
+
+	for(uint32_t i = 0; i < ECC_PARITY_SIZE; i++) {
+		for(uint32_t j = 0; j <= i && j <= errors; j++) {
+			evaluator[i] ^= __gf_mul(syndromes[i - j], locator[j]);
+		}
+	}
+
+	/*
+	 * Chien search and Forney algorithm
+	 */
+	uint32_t corrected = 0;
+
+	for(uint32_t p = 0; p < length && corrected < errors; p++) {
+		uint32_t degree = length - 1 - p;
+		uint8_t inverse_location = __gf_pow((255 - degree) % 255); // X^-1
+
+		if(__poly_eval(locator, errors, inverse_location) != 0) {
+			continue;
+		}
+
+		// Formal derivative of the locator: only the odd terms remain in GF(2^8)
+		uint8_t derivative = 0;
+		uint8_t x_squared = __gf_mul(inverse_location, inverse_location);
+		uint8_t power = 1;
+
+		for(uint32_t i = 1; i <= errors; i += 2) {
+			derivative ^= __gf_mul(locator[i], power);
+			power = __gf_mul(power, x_squared);
+		}
+
+		if(derivative == 0) {
+			return -1;
+		}
+
+		uint8_t magnitude = __gf_mul(__gf_pow(degree), __gf_div(__poly_eval(evaluator, ECC_PARITY_SIZE - 1, inverse_location), derivative));
+
+		codeword[p] ^= magnitude;
+		corrected++;
+	}
+
+	if(corrected != errors) {
+		return -1; // The locator does not have as many roots in the codeword as its degree
+	}
+
+	return corrected;
+}
+
+
+
+/*
+ * GF(256) utility functions
+ */
+static inline uint8_t __gf_mul(uint8_t a, uint8_t b) {
+	return a && b ? gf.exp[gf.log[a] + gf.log[b]] : 0;
+}
+
+static inline uint8_t __gf_div(uint8_t a, uint8_t b) {
+	return a ? gf.exp[gf.log[a] + 255 - gf.log[b]] : 0;
+}
+
+static inline uint8_t __gf_pow(uint8_t exponent) {
+	return gf.exp[exponent];
+}
+
+/*
+ * Evaluates a polynomial given lowest degree first.
+ */
+static uint8_t __poly_eval(const uint8_t* poly, uint32_t degree, uint8_t x) {
+	uint8_t result = 0;
+
+	for(uint32_t i = degree + 1; i > 0; i--) {
+		result = __gf_mul(result, x) ^ poly[i - 1];
+	}
+
+	return result;
+}
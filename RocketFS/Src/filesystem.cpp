@@ -8,33 +8,34 @@
 #include "filesystem.h"
 
 #include "block_management.h"
+#include "checksum.h"
+#include "device.h"
 #include "file.h"
+#include "partition.h"
 #include "stream.h"
 
 /*
  * FileSystem structure
  *
- * Each 4KB subsector is called a 'block'.
+ * Each 4KB subsector is called a 'block'. Block IDs are relative to the beginning of the partition.
+ * P = partition_page_count, N = num_blocks (4080 blocks and 2 partition pages by default)
  *
  * Block 0: Core block
  * 		2KB: RocketFS heuristic magic number
- * 		2KB: Metadata
- * Block 1: Master partition (bit 0...3: FileType, 4...7: relative initialisation time)
- * Block 2: Recovery partition
- * Block 3: Backup slot 1
- * Block 4: Backup slot 2
- * Block 5: Backup slot 3
- * Block 6: Backup slot 4
- * Block 7: Journal
+ * 		2KB: Metadata (geometry of the filesystem)
+ * Block 1...P: Master partition pages (bit 0...3: relative initialisation time, 4...7: FileType)
+ * Block P+1: Recovery partition
+ * Block P+2: Backup slot 1
+ * Block P+3: Backup slot 2
+ * Block P+4: Backup slot 3
+ * Block P+5: Backup slot 4
+ * Block P+6: Journal
  *
- * Block 8: Data
+ * Block P+7: Data
  * ...
- * Block 4091: Data
+ * Block N-1: Data
  *
- * Block 4092: Reserved
- * Block 4093: Reserved
- * Block 4094: Reserved (INVASIVE_TEST for flash memory)
- * Block 4095: Reserved (GENTLE_TEST for flash memory)
+ * The remaining blocks of the device are reserved (e.g. INVASIVE_TEST and GENTLE_TEST for flash memory).
  */
 
 #define CORRUPTION_THRESHOLD 4
@@ -45,6 +46,11 @@
  * Utility functions
  */
 static void fs_check_mounted(FileSystem *fs);
+static void fs_init_chain(FileSystem* fs, File* file, uint32_t block_id, const char* filename);
+static void fs_free_chain(FileSystem* fs, File* file);
+static File* fs_new_copy(FileSystem* fs, File* file, uint8_t copy, uint8_t copies);
+static bool fs_copy_chain(FileSystem* fs, File* source, File* destination);
+static bool fs_sealed(FileSystem* fs, File* file);
 
 static uint8_t __clamp(uint8_t input, uint8_t start, uint8_t end);
 static uint64_t __signed_shift(int64_t input, int8_t amount);
@@ -66,33 +72,130 @@ void rocket_fs_bind(
 	FileSystem* fs,
 	void (*read)(uint32_t, uint8_t*, uint32_t),
 	void (*write)(uint32_t, uint8_t*, uint32_t),
-	void (*erase_block)(uint32_t)
+	void (*erase_block)(uint32_t),
+	const uint8_t* (*map)(uint32_t),
+	bool (*busy)(),
+	bool (*erase_suspend)(),
+	void (*erase_resume)()
 ) {
-	fs->read = read;
-	fs->write = write;
-	fs->erase_block = erase_block;
-	fs->io_bound = true;
+	rocket_fs_bind_device(fs, 0, read, write, erase_block, map, busy, erase_suspend, erase_resume);
+}
+
+void rocket_fs_bind_device(
+	FileSystem* fs,
+	uint8_t device,
+	void (*read)(uint32_t, uint8_t*, uint32_t),
+	void (*write)(uint32_t, uint8_t*, uint32_t),
+	void (*erase_block)(uint32_t),
+	const uint8_t* (*map)(uint32_t),
+	bool (*busy)(),
+	bool (*erase_suspend)(),
+	void (*erase_resume)()
+) {
+	if(!fs->debug) {
+		fs->log = &__no_log;
+	}
+
+	if(device >= MAX_DEVICES) {
+		fs->log("Fatal: Too many devices. Consider increasing MAX_DEVICES.");
+		return;
+	}
+
+	if(fs->mounted) {
+		fs->log("Error: Cannot bind a device to a mounted filesystem.");
+		return;
+	}
+
+	fs->devices[device].read = read;
+	fs->devices[device].write = write;
+	fs->devices[device].erase_block = erase_block;
+	fs->devices[device].map = map;
+	fs->devices[device].busy = busy;
+	fs->devices[device].erase_suspend = erase_suspend;
+	fs->devices[device].erase_resume = erase_resume;
+	fs->devices[device].bad_block = 0;
+	fs->devices[device].failed = 0;
+
+	if(device >= fs->num_devices) {
+		fs->num_devices = device + 1;
+	}
 
-   if(!fs->debug) {
-      fs->log = &__no_log;
-   }
+	fs->io_bound = true;
 }
 
-void rocket_fs_device(FileSystem* fs, const char *id, uint32_t capacity, uint32_t block_size) {
-	if(block_size < NUM_BLOCKS) {
-		fs->log("Fatal: Device's sub-sector granularity is too high. Consider using using a device with higher block_size.");
-	} else if(block_size * NUM_BLOCKS > capacity) {
-		fs->log("Fatal: Device's sub-sector granularity is too low. Consider using using a device with lower block_size.");
+void rocket_fs_device(FileSystem* fs, const char *id, uint32_t capacity, uint32_t block_size, uint32_t partition_offset, uint32_t partition_length) {
+	if(!fs->debug) {
+		fs->log = &__no_log;
+	}
+
+	if(!partition_length && partition_offset < capacity) {
+		partition_length = capacity - partition_offset;
+	}
+
+	uint32_t num_blocks = partition_length / block_size;
+	bool clamped = num_blocks > NUM_BLOCKS;
+
+	if(clamped) {
+		num_blocks = NUM_BLOCKS; // The remaining blocks are reserved
+	}
+
+	uint32_t partition_pages = (num_blocks + PARTITION_PAGE_SIZE - 1) / PARTITION_PAGE_SIZE;
+
+	if(block_size < PARTITION_PAGE_SIZE + BLOCK_HEADER_SIZE) {
+		fs->log("Fatal: Device's sub-sector granularity is too high. Consider using using a device with higher block_size or a lower PARTITION_PAGE_SIZE.");
+	} else if(block_size > 65536) {
+		fs->log("Fatal: Blocks larger than 64 KiB are not supported, the tail log of the block headers holds 16-bit offsets.");
+	} else if(partition_offset % block_size != 0) {
+		fs->log("Fatal: Partition offset is not aligned on a block boundary.");
+	} else if((uint64_t) partition_offset + partition_length > capacity) {
+		fs->log("Fatal: Partition exceeds the capacity of the device.");
+	} else if(num_blocks <= partition_pages + 7) {
+		fs->log("Fatal: Partition is too small. Consider using using a device with lower block_size.");
 	} else {
+		if(clamped) {
+			fs->log("Warning: Partition exceeds NUM_BLOCKS blocks, the remaining blocks are left unused. Consider increasing NUM_BLOCKS.");
+		}
+
 		fs->id = id;
 		fs->addressable_space = capacity;
 		fs->block_size = block_size;
+		fs->partition_offset = partition_offset;
+		fs->num_blocks = num_blocks;
+		fs->partition_page_count = partition_pages;
+		fs->protected_blocks = partition_pages + 7;
 		fs->device_configured = true;
 		fs->partition_table_modified = false;
 	}
 }
 
-void rocket_fs_mount(FileSystem* fs) {
+#ifdef RFS_NAND
+void rocket_fs_nand(FileSystem* fs, uint32_t page_size, uint8_t device, bool (*bad_block)(uint32_t), bool (*failed)()) {
+	if(fs->mounted) {
+		fs->log("Error: Cannot change the policy of a mounted filesystem.");
+		return;
+	}
+
+	if(device >= MAX_DEVICES) {
+		fs->log("Fatal: Too many devices. Consider increasing MAX_DEVICES.");
+		return;
+	}
+
+	if(page_size < BLOCK_HEADER_SIZE || page_size > NAND_MAX_PAGE_SIZE || fs->block_size % page_size != 0) {
+		fs->log("Fatal: Unsupported page size. Consider increasing NAND_MAX_PAGE_SIZE.");
+		return;
+	}
+
+	fs->page_size = page_size;
+	fs->devices[device].bad_block = bad_block;
+	fs->devices[device].failed = failed;
+}
+#endif
+
+/*
+ * A lazy mount only reads the partition table and the roots of the files. The chain of each file is resolved when the file
+ * is first accessed, or by rocket_fs_resolve() in the background.
+ */
+void rocket_fs_mount(FileSystem* fs, bool lazy) {
 	fs->log("Mounting filesystem...");
 
 	if(fs->mounted) {
@@ -101,28 +204,36 @@ void rocket_fs_mount(FileSystem* fs) {
 	}
 
 	uint32_t core_base = rfs_get_block_base_address(fs, 0);
-	uint32_t master_base = rfs_get_block_base_address(fs, 1);
+
+	rfs_device_clear_cache(fs); // The device may have been written while unmounted
+
+	BlockHeader core_header;
+
+	if(!rfs_block_read_header(fs, 0, &core_header) && (core_header.magic & 0xFFFFFF00) == BLOCK_MAGIC_PREFIX) {
+		fs->log("Fatal: Filesystem was formatted with another format version.");
+		return;
+	}
 
 	Stream stream;
 	init_stream(&stream, fs, core_base, RAW);
 
 	uint64_t magic = stream.read64();
+	uint32_t num_blocks = stream.read32();
+	uint32_t num_files = stream.read32();
+	uint32_t block_size = stream.read32();
+	uint8_t num_devices = stream.read8();
 	stream.close();
 
 	if(__periodic_magic_match(MAGIC_PERIOD, magic)) {
-		init_stream(&stream, fs, master_base, RAW);
+		if(num_blocks != fs->num_blocks || num_files != NUM_FILES || block_size != fs->block_size || num_devices != fs->num_devices) {
+			fs->log("Fatal: Filesystem was formatted with another geometry.");
+			return;
+		}
 
 		fs->log("Reading partition table...");
 
-		stream.read(fs->reverse_partition_table, NUM_BLOCKS);
-		stream.close();
-
-		for(uint32_t i = 0; i < NUM_BLOCKS; i++) {
-			// Reverse bits to increase the lifetime of NOR flash memories (do not do this if the targeted device is a NAND flash).
-			fs->partition_table[i] = ~fs->reverse_partition_table[i];
-		}
-
-		rfs_init_block_management(fs); // in block_management.c
+		rfs_partition_init(fs);
+		rfs_init_block_management(fs, lazy); // in block_management.c
 
 		fs->mounted = true;
 
@@ -134,7 +245,7 @@ void rocket_fs_mount(FileSystem* fs) {
 
 		rocket_fs_format(fs);
 
-		rocket_fs_mount(fs);
+		rocket_fs_mount(fs, lazy);
 	}
 }
 
@@ -148,44 +259,44 @@ void rocket_fs_unmount(FileSystem* fs) {
 	fs->log("FileSystem unmounted.");
 }
 
+/*
+ * Resolves the chain of the next file left unresolved by a lazy mount. Returns false once all files are resolved.
+ */
+bool rocket_fs_resolve(FileSystem* fs) {
+	fs_check_mounted(fs);
+
+	for(uint32_t file_id = 0; file_id < NUM_FILES; file_id++) {
+		File* file = &(fs->files[file_id]);
+
+		if(file->first_block && !file->resolved) {
+			rfs_resolve_file(fs, file);
+			return true;
+		}
+	}
+
+	return false;
+}
+
 
 void rocket_fs_format(FileSystem* fs) {
 	fs->log("Formatting FileSystem...");
 
 	uint32_t core_base = rfs_get_block_base_address(fs, 0);
-	uint32_t master_base = rfs_get_block_base_address(fs, 1);
-
-	fs->erase_block(core_base);   // Core block
-	fs->erase_block(master_base); // Master partition block
-
-
-	Stream stream;
-	init_stream(&stream, fs, master_base, RAW);
 
 	/*
-	 * Blocks 0 to 7 are reserved anyways
+	 * The core, partition, recovery, backup and journal blocks are reserved anyways
 	 */
+	for(uint32_t block_id = 0; block_id < fs->protected_blocks; block_id++) {
+		if(rfs_device_bad_block(fs, block_id) || !rfs_block_erase(fs, block_id)) {
+			fs->log("Fatal: Protected block is bad. Consider moving the partition.");
+		}
 
-	stream.write8(~0b00001110); // Core block (used as internal relative clock)
-	stream.write8(~0b00001111); // Master partition block
-	stream.write8(~0b00001111); // Recovery partition block
-	stream.write8(~0b00001111); // Backup partition block 1
-	stream.write8(~0b00001111); // Backup partition block 2
-	stream.write8(~0b00001111); // Backup partition block 3
-	stream.write8(~0b00001111); // Backup partition block 4
-	stream.write8(~0b00001111); // Journal block
-
-	stream.close();
+		rfs_block_write_header(fs, block_id, 0, 0);
+	}
 
-	rfs_block_write_header(fs, 0, 0, 0);
-	rfs_block_write_header(fs, 1, 0, 0);
-	rfs_block_write_header(fs, 2, 0, 0);
-	rfs_block_write_header(fs, 3, 0, 0);
-	rfs_block_write_header(fs, 4, 0, 0);
-	rfs_block_write_header(fs, 5, 0, 0);
-	rfs_block_write_header(fs, 6, 0, 0);
-	rfs_block_write_header(fs, 7, 0, 0);
+	rfs_partition_format(fs);
 
+	Stream stream;
 	init_stream(&stream, fs, core_base, RAW);
 
 	uint64_t magic = __generate_periodic(MAGIC_PERIOD);
@@ -194,10 +305,19 @@ void rocket_fs_format(FileSystem* fs) {
 	/*
 	 * ... write heuristic magic number and metadata
 	 */
+	stream.write32(fs->num_blocks);
+	stream.write32(NUM_FILES);
+	stream.write32(fs->block_size);
+	stream.write8(fs->num_devices);
 
 	stream.close();
 
-	fs->total_used_blocks = 8;
+	fs->total_used_blocks = fs->protected_blocks;
+	fs->erased_block = 0;
+	fs->erased_block_count = 0;
+	fs->suspended_device = 0;
+
+	rfs_device_sync(fs); // Not mounted yet: the stream did not flush
 
 	fs->log("FileSystem formatted.");
 }
@@ -206,57 +326,51 @@ void rocket_fs_format(FileSystem* fs) {
  * Flushes the partition table
  */
 void rocket_fs_flush(FileSystem* fs) {
+	if(fs->mounted) {
+		rfs_block_settle_erase(fs);
+	}
+
 	if(fs->mounted && fs->partition_table_modified) {
 		fs->log("Flushing partition table...");
 
 		fs->partition_table_modified = false;
 
-		fs->erase_block(fs->block_size); // Erase the master partition block
-
-		fs->log("Master partition block erased.");
-
-		rfs_block_write_header(fs, 1, 0, 0);
-
-		uint32_t master_base = rfs_get_block_base_address(fs, 1);
-
-		Stream stream;
-		init_stream(&stream, fs, master_base, RAW);
-
-		for(uint32_t i = 0; i < NUM_BLOCKS; i++) {
-			// Reverse bits to increase the lifetime of NOR flash memories (do not do this if the targeted device is a NAND flash).
-		   fs->reverse_partition_table[i] = ~fs->partition_table[i];
-		}
-
-		fs->log("Partition data encoded.");
-
-		stream.write(fs->reverse_partition_table, NUM_BLOCKS);
-		stream.close();
+		rfs_partition_flush(fs); // Rewrites the modified partition pages
 
 		fs->log("Partition table flushed.");
 	}
+
+	if(fs->mounted) {
+		rfs_device_sync(fs);
+	}
 }
 
 /*
  * Names at most 15 characters long.
  * Storing file names in a hashtable.
  */
-File* rocket_fs_newfile(FileSystem* fs, const char* name, FileType type) {
+File* rocket_fs_newfile(FileSystem* fs, const char* name, FileType type, uint32_t block_budget) {
    static char filename[16];
 
    fs_check_mounted(fs);
 
 	fs->log("Creating new file...");
 
+	if(type == CIRCULAR && block_budget < 2) {
+		fs->log("Error: The ring of a circular file needs at least 2 blocks");
+		return 0;
+	}
+
 	filename_copy(name, filename);
 
 	File* file;
 	uint32_t hash = hash_filename(filename);
-	uint8_t bucket = hash % NUM_FILES;
+	uint32_t bucket = hash % NUM_FILES;
 
-	for(uint8_t file_id = bucket; file_id < bucket + NUM_FILES; file_id++) {
+	for(uint32_t file_id = bucket; file_id < bucket + NUM_FILES; file_id++) {
 		file = &(fs->files[file_id % NUM_FILES]);
 
-		if(filename_equals(file->filename, name)) {
+		if(file->first_block && filename_equals(file->filename, filename)) {
 			fs->log("File with the given filename already exists:");
 			fs->log(name);
 			return 0;
@@ -265,20 +379,34 @@ File* rocket_fs_newfile(FileSystem* fs, const char* name, FileType type) {
 		if(file->first_block == 0) {
 			// Yey! We found an available file identifier
 
-			uint16_t first_block_id = rfs_block_alloc(fs, type);
-			rfs_block_write_header(fs, first_block_id, file_id, 0);
-			rfs_set_file_root(fs, first_block_id);
+			uint32_t first_block_id = rfs_block_alloc(fs, type);
+
+			if(!first_block_id) {
+				fs->log("Unable to allocate the file root.");
+				return 0;
+			}
+
+			fs_init_chain(fs, file, first_block_id, filename);
+			file->replica_count = 0;
+
+			if(type == CIRCULAR) {
+				rfs_ring_init(fs, file, block_budget); // The ring grows with the first write
+			}
 
-			uint32_t address = rfs_get_block_base_address(fs, first_block_id);
+			// Mirrored files: the replicas are independent chains which hold the same filename
+			uint8_t copies = type == LOW_REDUNDANCE ? 2 : (type == HIGH_REDUNDANCE ? 3 : 1);
 
-			fs->write(address, (uint8_t*) filename, 16); // Write the filename
+			for(uint8_t copy = 1; copy < copies; copy++) {
+				File* replica = fs_new_copy(fs, file, copy, copies);
 
-			filename_copy(filename, file->filename);
-			file->hash = hash;
-			file->first_block = first_block_id;
-			file->last_block = first_block_id;
-			file->used_blocks = 1;
-			file->length = 0;
+				if(!replica) {
+					fs->log("Unable to allocate a replica.");
+					rocket_fs_delfile(fs, file);
+					return 0;
+				}
+
+				file->replicas[file->replica_count++] = replica - fs->files;
+			}
 
 			rocket_fs_flush(fs);
 
@@ -297,24 +425,17 @@ void rocket_fs_delfile(FileSystem* fs, File* file) {
 
 	fs->log("Deleting file...");
 
-	uint16_t block_id = file->first_block;
-	DataBlock* block;
-
-	if(block_id) {
-		do {
-			rfs_block_free(fs, block_id);
+	if(file->first_block) {
+		rfs_resolve_file(fs, file); // The lost blocks and the ring are freed as well
 
-			block = &(fs->data_blocks[block_id]);
+		for(uint8_t i = 0; i < file->replica_count; i++) {
+			fs_free_chain(fs, &(fs->files[file->replicas[i]]));
+		}
 
-			block_id = block->successor;
-			block->successor = 0;
-		} while(block_id);
+		fs_free_chain(fs, file);
 
-		file->hash = 0;
-		file->first_block = 0;
-		file->last_block = 0;
-		file->length = 0;
-		file->used_blocks = 0;
+		file->replica_count = 0;
+		file->degraded = 0;
 
 		rocket_fs_flush(fs);
 
@@ -332,13 +453,13 @@ File* rocket_fs_getfile(FileSystem* fs, const char* name) {
 
 	File* file;
 	uint32_t hash = hash_filename(filename);
-	uint8_t bucket = hash % NUM_FILES;
+	uint32_t bucket = hash % NUM_FILES;
 
-	for(uint8_t file_id = bucket; file_id < bucket + NUM_FILES; file_id++) {
+	for(uint32_t file_id = bucket; file_id < bucket + NUM_FILES; file_id++) {
 		file = &(fs->files[file_id % NUM_FILES]);
 
-		if(file->first_block && filename_equals(file->filename, filename)) {
-		   //rfs_load_file_meta(fs, file);
+		if(file->first_block && file->primary == NO_FILE && filename_equals(file->filename, filename)) {
+			rfs_resolve_file(fs, file);
 			return file;
 		}
 	}
@@ -361,23 +482,52 @@ bool rocket_fs_touch(FileSystem* fs, File* file) {
 bool rocket_fs_stream(Stream* stream, FileSystem* fs, File* file, StreamMode mode) {
 	fs_check_mounted(fs);
 
+	uint32_t base_address;
+	FileType type = rfs_get_file_type(fs, file);
+
+	rfs_resolve_file(fs, file);
+
 	switch(mode) {
 	case OVERWRITE: {
-		uint16_t first_block = file->first_block;
-		uint32_t base_address = rfs_get_block_base_address(fs, first_block) + 16; // Do not overwrite the 16-characters long identifier
+		uint32_t first_block = file->first_block;
+		base_address = rfs_get_block_base_address(fs, first_block) + 16; // Do not overwrite the 16-characters long identifier
 
-		FileType type = static_cast<FileType>(fs->partition_table[first_block] >> 4);
+		if(type == CIRCULAR) {
+			// The data starts at the oldest block of the ring (or after the root, which holds no data)
+			base_address = file->head_block ? rfs_get_block_base_address(fs, file->head_block) : (first_block + 1) * fs->block_size;
+		}
 
-		return init_stream(stream, fs, base_address, type);
+		break;
 	}
 
 	case APPEND: {
-		uint16_t last_block = file->last_block;
-		uint32_t base_address = last_block * fs->block_size + rfs_compute_block_length(fs, last_block);
+		uint32_t last_block = file->last_block;
+		base_address = last_block * fs->block_size + file->tail_offset; // Right after the last byte, no flash access needed
+
+		if(type == CIRCULAR && last_block == file->first_block) {
+			base_address = (last_block + 1) * fs->block_size; // Grows the ring on the first write
+		} else if(fs_sealed(fs, file)) {
+			base_address = (last_block + 1) * fs->block_size; // The tail log of the last block is full: continue in a new block
+		}
 
-		FileType type = static_cast<FileType>(fs->partition_table[last_block] >> 4);
+		if(type == COMPRESSED) {
+			// The last frame is padded: continue in the next one. A sealed chunk ends at its trailer already.
+			base_address = (base_address + STREAM_CHUNK_SIZE - 1) / STREAM_CHUNK_SIZE * STREAM_CHUNK_SIZE;
+		}
 
-		return init_stream(stream, fs, base_address, type);
+		break;
+	}
+
+	case FOLLOW: {
+		uint32_t last_block = file->last_block;
+		base_address = rfs_get_block_base_address(fs, last_block);
+
+		if(last_block == file->first_block) {
+			// Same start as OVERWRITE streams
+			base_address = type == CIRCULAR ? (last_block + 1) * fs->block_size : base_address + 16;
+		}
+
+		break;
 	}
 
 	default:
@@ -385,9 +535,255 @@ bool rocket_fs_stream(Stream* stream, FileSystem* fs, File* file, StreamMode mod
 		return false;
 	}
 
+	if(!init_stream(stream, fs, base_address, type)) {
+		return false;
+	}
+
+	stream->file = file;
+
+	if(mode == FOLLOW) {
+		stream->following = true;
+		return true;
+	}
+
+	file->writer = stream;
+	stream->replica_count = file->replica_count;
+
+	for(uint8_t i = 0; i < file->replica_count; i++) {
+		File* replica = &(fs->files[file->replicas[i]]);
+		uint32_t base_block = mode == OVERWRITE ? file->first_block : file->last_block;
+		uint32_t replica_block = mode == OVERWRITE ? replica->first_block : replica->last_block;
+
+		// The copies have the same layout: the replica stream starts at the same offset from its block (or at the next one)
+		stream->checked.replica_write_address[i] = replica_block * fs->block_size + (base_address - base_block * fs->block_size);
+		stream->checked.replica_write_chunk[i] = stream->checked.write_chunk;
+		stream->checked.replica_write_checksum[i] = 0;
+	}
+
 	return true;
 }
 
+/*
+ * The stream has data to read if it is not in the last block of the file yet, or before its end,
+ * or if the writer of the file holds bytes which it did not read.
+ */
+bool rocket_fs_poll(Stream* stream) {
+	if(!stream->open || !stream->file) {
+		return false;
+	}
+
+	FileSystem* fs = stream->fs;
+	File* file = stream->file;
+	Stream* writer = file->writer;
+	uint32_t block_id = (stream->read_address - 1) / fs->block_size;
+
+	if(block_id != file->last_block || stream->read_address - block_id * fs->block_size < file->tail_offset) {
+		return true;
+	}
+
+	if(stream->type == COMPRESSED && stream->compressed.read_frame_offset < stream->compressed.read_frame_length) {
+		return true;
+	}
+
+	return writer && writer->type == COMPRESSED && writer->compressed.write_frame_length > stream->follow_skip;
+}
+
+uint32_t rocket_fs_verify(FileSystem* fs, File* file) {
+	fs_check_mounted(fs);
+
+	FileType type = rfs_get_file_type(fs, file);
+
+	if(!rfs_chunk_type(type)) {
+		fs->log("Warning: File has no checksums");
+		return 0;
+	}
+
+	uint32_t corrupted_chunks = 0;
+
+	for(uint8_t copy = 0; copy <= file->replica_count; copy++) {
+		File* chain = copy ? &(fs->files[file->replicas[copy - 1]]) : file;
+		uint32_t chain_corrupted_chunks = 0;
+		uint32_t block_id = chain->first_block;
+		uint32_t counter = 0;
+
+		while(block_id && counter++ < fs->num_blocks) {
+			chain_corrupted_chunks += rfs_chunk_check_block(fs, type, block_id);
+			block_id = rfs_block_successor(fs, block_id);
+		}
+
+		if(chain_corrupted_chunks) {
+			file->degraded |= 1 << copy;
+		}
+
+		corrupted_chunks += chain_corrupted_chunks;
+	}
+
+	return corrupted_chunks;
+}
+
+/*
+ * The chunks of a copy cannot be reprogrammed without erasing whole blocks: each corrupted copy is rebuilt
+ * from the intact chunks of the other copies in a new chain, which then replaces it. The corrupted chain is only freed
+ * once the new one is complete. A rebuilt original chain belongs to another file identifier: the file is then found
+ * at another File, to be looked up again with rocket_fs_getfile().
+ * Returns false if a copy could not be rebuilt.
+ */
+bool rocket_fs_repair(FileSystem* fs, File* file) {
+	fs_check_mounted(fs);
+
+	bool repaired = true;
+	uint8_t copies = 1 + file->replica_count;
+
+	for(uint8_t i = 0; i < file->replica_count; i++) {
+		if(!(file->degraded & (0b10 << i))) {
+			continue;
+		}
+
+		File* replica = fs_new_copy(fs, file, 1 + i, copies);
+
+		if(!replica) {
+			fs->log("Unable to allocate a replica.");
+			repaired = false;
+		} else if(!fs_copy_chain(fs, file, replica)) {
+			fs_free_chain(fs, replica);
+			repaired = false;
+		} else {
+			fs_free_chain(fs, &(fs->files[file->replicas[i]]));
+			file->replicas[i] = replica - fs->files;
+			file->degraded &= ~(0b10 << i);
+		}
+	}
+
+	if(file->degraded & 0b1) {
+		// The original chain is rebuilt from an intact replica in a new file identifier, and only then replaces the old chain
+		File* source = 0;
+
+		for(uint8_t i = 0; i < file->replica_count && !source; i++) {
+			if(!(file->degraded & (0b10 << i))) {
+				source = &(fs->files[file->replicas[i]]);
+			}
+		}
+
+		if(!source) {
+			fs->log("Error: No intact copy left");
+			return false;
+		}
+
+		File* original = fs_new_copy(fs, file, 0, copies);
+
+		if(!original) {
+			fs->log("Unable to allocate the file root.");
+			return false;
+		}
+
+		if(!fs_copy_chain(fs, source, original)) {
+			fs_free_chain(fs, original);
+			return false;
+		}
+
+		original->replica_count = file->replica_count;
+		original->degraded = file->degraded & ~0b1;
+
+		for(uint8_t i = 0; i < file->replica_count; i++) {
+			original->replicas[i] = file->replicas[i];
+			fs->files[file->replicas[i]].primary = original - fs->files;
+		}
+
+		fs_free_chain(fs, file);
+		file->replica_count = 0;
+		file->degraded = 0;
+	}
+
+	rocket_fs_flush(fs);
+
+	return repaired;
+}
+
+uint32_t rocket_fs_erase_count(FileSystem* fs, uint32_t block_id) {
+	fs_check_mounted(fs);
+
+	if(block_id >= fs->num_blocks) {
+		fs->log("Error: Block ID out of range");
+		return 0;
+	}
+
+	return rfs_block_erase_count(fs, block_id);
+}
+
+void rocket_fs_wear(FileSystem* fs, WearStats* stats) {
+	fs_check_mounted(fs);
+
+	stats->min_erase_count = 0xFFFFFFFF;
+	stats->max_erase_count = 0;
+	stats->total_erase_count = 0;
+	stats->bad_blocks = 0;
+
+	for(uint32_t block_id = 0; block_id < fs->num_blocks; block_id++) {
+		if(rfs_partition_get(fs, block_id) == BAD_BLOCK_META) {
+			stats->bad_blocks++;
+			continue;
+		}
+
+		uint32_t erase_count = rfs_block_erase_count(fs, block_id);
+
+		if(erase_count < stats->min_erase_count) {
+			stats->min_erase_count = erase_count;
+		}
+
+		if(erase_count > stats->max_erase_count) {
+			stats->max_erase_count = erase_count;
+		}
+
+		stats->total_erase_count += erase_count;
+	}
+}
+
+void rocket_fs_cache_stats(FileSystem* fs, CacheStats* stats) {
+	stats->header_hits = fs->header_hits;
+	stats->header_misses = fs->header_misses;
+}
+
+bool rocket_fs_busy(FileSystem* fs) {
+	for(uint8_t device = 0; device < fs->num_devices; device++) {
+		if(fs->devices[device].busy && fs->devices[device].busy()) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * The next allocation takes the erased block instead of erasing one: on an asynchronous device, the erase proceeds
+ * while the caller does something else.
+ */
+bool rocket_fs_prepare(FileSystem* fs) {
+	if(!fs->mounted) {
+		fs->log("Error: FileSystem not mounted");
+		return false;
+	}
+
+	return rfs_block_erase_ahead(fs);
+}
+
+/*
+ * A suspended erase does not hold back the accesses to the other blocks, e.g. the reads of a critical stream.
+ */
+bool rocket_fs_suspend(FileSystem* fs) {
+	if(!fs->mounted) {
+		fs->log("Error: FileSystem not mounted");
+		return false;
+	}
+
+	return rfs_device_suspend(fs);
+}
+
+void rocket_fs_resume(FileSystem* fs) {
+	if(fs->mounted) {
+		rfs_device_resume(fs);
+	}
+}
+
 
 static void fs_check_mounted(FileSystem *fs) {
 	if(!fs->mounted) {
@@ -396,6 +792,144 @@ static void fs_check_mounted(FileSystem *fs) {
 }
 
 
+/*
+ * Chain utility functions
+ */
+
+/*
+ * Writes the root of a new chain of the given file.
+ */
+static void fs_init_chain(FileSystem* fs, File* file, uint32_t block_id, const char* filename) {
+	rfs_block_write_header(fs, block_id, file - fs->files, 0);
+	rfs_set_file_root(fs, block_id);
+
+	uint32_t address = rfs_get_block_base_address(fs, block_id);
+
+	rfs_device_write(fs, address, (uint8_t*) filename, 16); // Write the filename
+
+	filename_copy(filename, file->filename);
+	file->hash = hash_filename(filename);
+	file->first_block = block_id;
+	file->last_block = block_id;
+	file->lost_block = 0;
+	file->break_block = 0;
+	file->used_blocks = 1;
+
+	rfs_clear_file_extents(file);
+	rfs_append_file_extent(file, block_id);
+	file->length = 0;
+	file->tail_offset = BLOCK_HEADER_SIZE + 16;
+
+	file->primary = NO_FILE;
+	file->degraded = 0;
+	file->head_block = 0;
+	file->resolved = true;
+}
+
+static void fs_free_chain(FileSystem* fs, File* file) {
+	uint32_t block_id = file->first_block;
+	uint32_t counter = 0;
+
+	while(block_id && counter++ < fs->num_blocks) {
+		uint32_t successor = rfs_block_successor(fs, block_id);
+
+		if(block_id == file->first_block && file->head_block) {
+			successor = file->head_block; // The root of a ring does not link to it once it has wrapped
+		}
+
+		rfs_block_free(fs, block_id);
+
+		block_id = successor;
+	}
+
+	file->hash = 0;
+	file->first_block = 0;
+	file->last_block = 0;
+	file->lost_block = 0;
+	file->break_block = 0;
+	file->length = 0;
+	file->tail_offset = 0;
+
+	rfs_clear_file_extents(file);
+	file->used_blocks = 0;
+	file->primary = NO_FILE;
+	file->head_block = 0;
+	file->block_budget = 0;
+	file->writer = 0;
+}
+
+/*
+ * Creates an empty chain of the given file in a free file identifier: a REPLICA chain (copy > 0), or a new chain of the
+ * original (copy = 0) which replaces it once it is complete. Returns 0 if none is left.
+ */
+static File* fs_new_copy(FileSystem* fs, File* file, uint8_t copy, uint8_t copies) {
+	uint32_t file_id = file - fs->files;
+
+	for(uint32_t i = 1; i < NUM_FILES; i++) {
+		File* replica = &(fs->files[(file_id + i) % NUM_FILES]);
+
+		if(replica->first_block == 0) {
+			FileType type = copy ? REPLICA : rfs_get_file_type(fs, file);
+			uint32_t first_block_id = copy ? rfs_block_alloc_mirror(fs, type, file->first_block, copy, copies) : rfs_block_alloc(fs, type);
+
+			if(!first_block_id) {
+				return 0;
+			}
+
+			fs_init_chain(fs, replica, first_block_id, file->filename);
+			replica->primary = copy ? file_id : NO_FILE;
+			replica->replica_count = 0;
+
+			return replica;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Copies the content of the source file (read from any intact copy) to the empty destination chain.
+ * The chunks are written at the same offsets, so that both chains have the same layout (see rfs_stream_copy()).
+ */
+static bool fs_copy_chain(FileSystem* fs, File* source, File* destination) {
+	Stream input;
+	Stream output;
+
+	rocket_fs_stream(&input, fs, source, OVERWRITE);
+	init_stream(&output, fs, rfs_get_block_base_address(fs, destination->first_block) + 16, rfs_get_file_type(fs, destination));
+	output.file = destination;
+
+	bool complete = rfs_stream_copy(&input, &output) && input.corrupted_chunks == 0;
+
+	input.close();
+	output.close();
+
+	return complete;
+}
+
+/*
+ * Returns true if the last block of any copy of the file is sealed, in which case the last blocks of the other copies
+ * are sealed as well: all copies continue in a new block and keep the same layout.
+ */
+static bool fs_sealed(FileSystem* fs, File* file) {
+	bool sealed = rfs_block_sealed(fs, file->last_block);
+
+	for(uint8_t i = 0; i < file->replica_count; i++) {
+		sealed |= rfs_block_sealed(fs, fs->files[file->replicas[i]].last_block);
+	}
+
+	if(sealed) {
+		rfs_block_record_end(fs, file, true);
+
+		for(uint8_t i = 0; i < file->replica_count; i++) {
+			rfs_block_record_end(fs, &(fs->files[file->replicas[i]]), true);
+		}
+	}
+
+	return sealed;
+}
+
+
 /*
  * Corruption utility functions
  */
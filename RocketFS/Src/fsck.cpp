@@ -0,0 +1,261 @@
+/*
+ * fsck.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#include "fsck.h"
+
+#include "block_management.h"
+#include "file.h"
+#include "partition.h"
+
+#include <string.h>
+
+#define NO_SUCCESSOR 0xFFFFFFFF
+
+/*
+ * Non-exported function prototypes
+ */
+static void rfs_fsck_chain(FileSystem* fs, Fsck* fsck, uint8_t file_id, uint32_t block_id, uint32_t end_block);
+static uint32_t rfs_fsck_successor(FileSystem* fs, uint8_t file_id, uint32_t block_id, BlockHeader* header);
+static void rfs_fsck_plan(Fsck* fsck, FsckAction action, uint32_t block_id, uint8_t file_id);
+static bool rfs_fsck_is_reachable(const Fsck* fsck, uint32_t block_id);
+
+
+
+bool rocket_fs_fsck(FileSystem* fs, Fsck* fsck) {
+	if(!fs->mounted) {
+		fs->log("Error: Filesystem not mounted");
+		return false;
+	}
+
+	rfs_fsck_walk(fs, fsck);
+	rfs_fsck_sweep(fs, fsck, fsck, 0, fs->num_blocks);
+
+	return !fsck->orphan_blocks && !fsck->unclaimed_blocks && !fsck->cycles;
+}
+
+/*
+ * Applies the planned repairs to the partition table.
+ * The successor IDs are programmed once and cannot be rewritten without an erase: the chains themselves are left as they are.
+ */
+void rocket_fs_fsck_repair(FileSystem* fs, Fsck* fsck) {
+	for(uint16_t i = 0; i < fsck->repair_count; i++) {
+		FsckRepair* repair = &(fsck->repairs[i]);
+
+		if(repair->action == FSCK_FREE_BLOCK) {
+			fs->log("Orphan block freed");
+			rfs_block_free(fs, repair->block_id);
+			continue;
+		}
+
+		File* file = &(fs->files[repair->file_id]);
+		FileType type = rfs_get_file_type(fs, file);
+		uint8_t meta = type == CIRCULAR ? (type << 4) | 0b1111 : (type << 4) | 0b1100; // The blocks of a ring are immortal
+
+		fs->log("Chained block claimed");
+
+		if(rfs_partition_get(fs, repair->block_id) == 0) {
+			fs->total_used_blocks++;
+		}
+
+		rfs_partition_set(fs, repair->block_id, meta);
+
+		if(repair->block_id == file->lost_block) {
+			// The lost block is part of the chain already
+			file->lost_block = 0;
+			file->break_block = 0;
+		}
+
+		rfs_load_file_meta(fs, file);
+	}
+
+	fsck->repair_count = 0;
+
+	rocket_fs_flush(fs);
+}
+
+/*
+ * First pass: marks the blocks reachable from the files and resets the statistics.
+ * The chains are followed as at mount, from their root to the lost block once the chain ends (or at the break block).
+ */
+void rfs_fsck_walk(FileSystem* fs, Fsck* fsck) {
+	memset(fsck, 0, sizeof(Fsck));
+
+	for(uint8_t file_id = 0; file_id < NUM_FILES; file_id++) {
+		File* file = &(fs->files[file_id]);
+
+		if(!file->first_block) {
+			continue;
+		}
+
+		rfs_resolve_file(fs, file);
+
+		if(rfs_get_file_type(fs, file) == CIRCULAR) {
+			rfs_fsck_chain(fs, fsck, file_id, file->first_block, file->first_block);
+
+			if(file->head_block) {
+				rfs_fsck_chain(fs, fsck, file_id, file->head_block, file->last_block);
+			}
+		} else {
+			rfs_fsck_chain(fs, fsck, file_id, file->first_block, 0);
+		}
+	}
+}
+
+/*
+ * Second pass: checks the used blocks of [first_block, end_block) against the blocks marked by the walk.
+ * The statistics and repairs are added to those of fsck, which may be the walked structure itself.
+ */
+void rfs_fsck_sweep(FileSystem* fs, const Fsck* walked, Fsck* fsck, uint32_t first_block, uint32_t end_block) {
+	BlockHeader header;
+
+	if(first_block < fs->protected_blocks) {
+		first_block = fs->protected_blocks;
+	}
+
+	if(end_block > fs->num_blocks) {
+		end_block = fs->num_blocks;
+	}
+
+	for(uint32_t block_id = first_block; block_id < end_block; block_id++) {
+		uint8_t meta = rfs_partition_get(fs, block_id);
+
+		if(meta == 0 || meta == BAD_BLOCK_META) {
+			continue;
+		}
+
+		fsck->checked_blocks++;
+
+		if(rfs_fsck_is_reachable(walked, block_id)) {
+			continue;
+		}
+
+		bool valid = rfs_block_read_header(fs, block_id, &header) && header.file_id < NUM_FILES;
+
+		if(!valid) {
+			fsck->invalid_blocks++;
+		}
+
+		fsck->orphan_blocks++;
+		rfs_fsck_plan(fsck, FSCK_FREE_BLOCK, block_id, valid ? header.file_id : NO_FILE);
+	}
+}
+
+/*
+ * Adds the statistics and the repairs of a part of the sweep. The bitmap of fsck is left as it is.
+ */
+void rfs_fsck_merge(Fsck* fsck, const Fsck* part) {
+	fsck->checked_blocks += part->checked_blocks;
+	fsck->chained_blocks += part->chained_blocks;
+	fsck->invalid_blocks += part->invalid_blocks;
+	fsck->orphan_blocks += part->orphan_blocks;
+	fsck->unclaimed_blocks += part->unclaimed_blocks;
+	fsck->cycles += part->cycles;
+	fsck->dropped_repairs += part->dropped_repairs;
+
+	for(uint16_t i = 0; i < part->repair_count; i++) {
+		rfs_fsck_plan(fsck, part->repairs[i].action, part->repairs[i].block_id, part->repairs[i].file_id);
+	}
+}
+
+
+
+/*
+ * Marks the chain starting at block_id, up to end_block included (0: up to the end of the chain).
+ * The walk stops at the first block already marked: each block has a single predecessor, so that only
+ * an inconsistent lost block or ring can lead there.
+ */
+static void rfs_fsck_chain(FileSystem* fs, Fsck* fsck, uint8_t file_id, uint32_t block_id, uint32_t end_block) {
+	File* file = &(fs->files[file_id]);
+	bool lost_attached = !file->lost_block;
+	BlockHeader header;
+
+	if(!rfs_block_read_header(fs, block_id, &header)) {
+		return;
+	}
+
+	while(block_id) {
+		if(rfs_fsck_is_reachable(fsck, block_id)) {
+			fs->log("Warning: Cyclic block chain detected");
+			fsck->cycles++;
+
+			if(block_id == file->lost_block) {
+				rfs_fsck_plan(fsck, FSCK_CLAIM_BLOCK, block_id, file_id); // Clears the lost flag
+			}
+
+			return;
+		}
+
+		fsck->reachable[block_id / 8] |= 1 << (block_id % 8);
+		fsck->chained_blocks++;
+
+		if(rfs_partition_get(fs, block_id) == 0) {
+			fsck->unclaimed_blocks++;
+			rfs_fsck_plan(fsck, FSCK_CLAIM_BLOCK, block_id, file_id);
+		}
+
+		if(block_id == end_block) {
+			return;
+		}
+
+		if(block_id == file->lost_block) {
+			lost_attached = true;
+		}
+
+		uint32_t successor = rfs_fsck_successor(fs, file_id, block_id, &header);
+
+		if(!successor && !lost_attached) {
+			lost_attached = true;
+			successor = file->lost_block;
+
+			if(!rfs_block_read_header(fs, successor, &header)) {
+				return;
+			}
+		}
+
+		block_id = successor;
+	}
+}
+
+/*
+ * Returns the successor of the block whose header is given or 0 if the link is not confirmed by the successor.
+ * The header of the successor replaces the given one, so that each header is read once.
+ */
+static uint32_t rfs_fsck_successor(FileSystem* fs, uint8_t file_id, uint32_t block_id, BlockHeader* header) {
+	File* file = &(fs->files[file_id]);
+	uint32_t successor = header->successor;
+
+	if(block_id == file->break_block && file->lost_block) {
+		// The chain continues at the lost block, whose predecessor was recycled
+		return rfs_block_read_header(fs, file->lost_block, header) && header->file_id == file_id ? file->lost_block : 0;
+	}
+
+	if(successor == NO_SUCCESSOR || successor < fs->protected_blocks || successor >= fs->num_blocks) {
+		return 0;
+	}
+
+	if(!rfs_block_read_header(fs, successor, header) || header->file_id != file_id || header->predecessor != block_id) {
+		return 0;
+	}
+
+	return successor;
+}
+
+static void rfs_fsck_plan(Fsck* fsck, FsckAction action, uint32_t block_id, uint8_t file_id) {
+	if(fsck->repair_count == FSCK_MAX_REPAIRS) {
+		fsck->dropped_repairs++;
+		return;
+	}
+
+	fsck->repairs[fsck->repair_count].action = action;
+	fsck->repairs[fsck->repair_count].block_id = block_id;
+	fsck->repairs[fsck->repair_count].file_id = file_id;
+	fsck->repair_count++;
+}
+
+static bool rfs_fsck_is_reachable(const Fsck* fsck, uint32_t block_id) {
+	return fsck->reachable[block_id / 8] & (1 << (block_id % 8));
+}
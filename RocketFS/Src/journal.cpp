@@ -0,0 +1,187 @@
+/*
+ * journal.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#include "journal.h"
+
+#include "encoding.h"
+
+#include <string.h>
+
+/*
+ * Non-exported function prototypes
+ */
+static bool rfs_journal_read_batch(Channel* channel);
+
+
+
+bool rocket_fs_journal_create(FileSystem* fs, Journal* journal, const char* name, FileType type) {
+	if(type == CIRCULAR) {
+		fs->log("Error: Journals cannot be CIRCULAR files.");
+		return false;
+	}
+
+	if(!rocket_fs_newfile(fs, name, type)) {
+		fs->log("Unable to create the journal.");
+		return false;
+	}
+
+	return rocket_fs_journal_open(fs, journal, name);
+}
+
+bool rocket_fs_journal_open(FileSystem* fs, Journal* journal, const char* name) {
+	File* file = rocket_fs_getfile(fs, name);
+
+	if(!file) {
+		fs->log("Error: Journal not found");
+		return false;
+	}
+
+	journal->fs = fs;
+	journal->buffered_bytes = JOURNAL_BATCH_HEADER_SIZE;
+	journal->channels = 0;
+
+	return rocket_fs_stream(&(journal->stream), fs, file, APPEND);
+}
+
+/*
+ * The record is buffered until the batch is full or flushed. Returns false if the record is too long or the channel invalid.
+ */
+bool rocket_fs_journal_write(Journal* journal, uint8_t channel, const uint8_t* data, uint8_t length) {
+	if(channel >= JOURNAL_CHANNELS || length > JOURNAL_MAX_RECORD) {
+		journal->fs->log("Error: Invalid journal record");
+		return false;
+	}
+
+	if(journal->buffered_bytes + JOURNAL_RECORD_HEADER_SIZE + length > JOURNAL_BUFFER_SIZE) {
+		rocket_fs_journal_flush(journal);
+	}
+
+	uint8_t* record = journal->buffer + journal->buffered_bytes;
+
+	record[0] = channel;
+	record[1] = length;
+	memcpy(record + JOURNAL_RECORD_HEADER_SIZE, data, length);
+
+	journal->buffered_bytes += JOURNAL_RECORD_HEADER_SIZE + length;
+	journal->channels |= 1UL << channel;
+
+	return true;
+}
+
+/*
+ * Writes the buffered records as one batch, with a single write to the stream.
+ */
+void rocket_fs_journal_flush(Journal* journal) {
+	uint16_t length = journal->buffered_bytes - JOURNAL_BATCH_HEADER_SIZE;
+
+	if(length == 0) {
+		return;
+	}
+
+	journal->buffer[0] = JOURNAL_BATCH;
+	journal->buffer[1] = 0;
+	journal->buffer[2] = length;
+	journal->buffer[3] = length >> 8;
+	__encode32(journal->buffer + 4, journal->channels);
+
+	journal->stream.write(journal->buffer, journal->buffered_bytes);
+
+	journal->buffered_bytes = JOURNAL_BATCH_HEADER_SIZE;
+	journal->channels = 0;
+}
+
+void rocket_fs_journal_close(Journal* journal) {
+	rocket_fs_journal_flush(journal);
+	journal->stream.close();
+}
+
+
+
+bool rocket_fs_channel_open(FileSystem* fs, Channel* channel, const char* name, uint8_t index) {
+	File* file = rocket_fs_getfile(fs, name);
+
+	if(!file || index >= JOURNAL_CHANNELS) {
+		fs->log("Error: Journal not found");
+		return false;
+	}
+
+	channel->channel = index;
+	channel->remaining_bytes = 0;
+
+	return rocket_fs_stream(&(channel->stream), fs, file, OVERWRITE);
+}
+
+/*
+ * Copies the data of the next record of the channel (JOURNAL_MAX_RECORD bytes at most).
+ */
+int32_t rocket_fs_channel_next(Channel* channel, uint8_t* data) {
+	uint8_t header[JOURNAL_RECORD_HEADER_SIZE];
+
+	while(true) {
+		if(channel->remaining_bytes == 0 && !rfs_journal_read_batch(channel)) {
+			return -1;
+		}
+
+		if(channel->remaining_bytes < JOURNAL_RECORD_HEADER_SIZE || channel->stream.read(header, JOURNAL_RECORD_HEADER_SIZE) != JOURNAL_RECORD_HEADER_SIZE) {
+			return -1;
+		}
+
+		uint8_t length = header[1];
+
+		if(channel->remaining_bytes < JOURNAL_RECORD_HEADER_SIZE + length || header[0] >= JOURNAL_CHANNELS) {
+			channel->stream.fs->log("Warning: Corrupted journal batch");
+			return -1;
+		}
+
+		channel->remaining_bytes -= JOURNAL_RECORD_HEADER_SIZE + length;
+
+		if(header[0] == channel->channel) {
+			return channel->stream.read(data, length) == length ? length : -1;
+		}
+
+		channel->stream.skip(length);
+	}
+}
+
+void rocket_fs_channel_close(Channel* channel) {
+	channel->stream.close();
+}
+
+
+
+/*
+ * Enters the next batch which holds records of the channel. The other batches are skipped.
+ * Returns false at the end of the journal.
+ */
+static bool rfs_journal_read_batch(Channel* channel) {
+	Stream* stream = &(channel->stream);
+	uint8_t header[JOURNAL_BATCH_HEADER_SIZE];
+
+	while(true) {
+		do {
+			if(stream->read(header, 1) != 1) {
+				return false;
+			}
+		} while(header[0] == 0xFF); // Erased bytes, e.g. the padding of a chunk
+
+		if(header[0] != JOURNAL_BATCH || stream->read(header + 1, JOURNAL_BATCH_HEADER_SIZE - 1) != JOURNAL_BATCH_HEADER_SIZE - 1) {
+			return false; // Foreign data
+		}
+
+		uint16_t length = header[2] | header[3] << 8;
+		uint32_t channels = __decode32(header + 4);
+
+		if(channels & (1UL << channel->channel)) {
+			channel->remaining_bytes = length;
+			return true;
+		}
+
+		if(stream->skip(length) != length) {
+			return false;
+		}
+	}
+}
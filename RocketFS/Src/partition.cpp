@@ -0,0 +1,397 @@
+/*
+ * partition.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#include "partition.h"
+
+#include "block_management.h"
+#include "device.h"
+
+/*
+ * Partition table paging
+ *
+ * Entry n of the partition table describes block n (bit 0...3: relative initialisation time, 4...7: FileType).
+ * Page p holds the entries [p * PARTITION_PAGE_SIZE, (p + 1) * PARTITION_PAGE_SIZE) and is stored right after the header of block 1 + p.
+ *
+ * Only CACHED_PARTITION_PAGES pages are held in memory. The number of free entries and a lower bound
+ * of the relative time of each page are kept aside, so that allocations do not need to load every page.
+ *
+ * Entries are stored bit-inverted, so that an erased page holds free entries only and an allocation only clears bits:
+ * on NOR flash, the entry is programmed in place. With the NAND policy, the page is marked dirty and rewritten instead.
+ *
+ * Relative time
+ *
+ * The relative times are stored relative to the epoch of their page, held in the predecessor field of its block.
+ * All entries age at once by advancing fs->partition_epoch: a relative time reads as its stored value minus the epochs
+ * elapsed since, down to 0. Pages are rebased on the current epoch when they are stored anyway, or when a new relative
+ * time cannot be expressed relative to their epoch any more. The current epoch is the epoch of page 0 plus the number
+ * of bits cleared in the successor field of block 1 (programmed in place on NOR flash, up to 32 epochs).
+ */
+
+/*
+ * Non-exported function prototypes
+ */
+static PartitionPage* rfs_partition_page(FileSystem* fs, uint16_t page_id);
+static void rfs_partition_load(FileSystem* fs, PartitionPage* page, uint16_t page_id);
+static void rfs_partition_store(FileSystem* fs, PartitionPage* page);
+static void rfs_partition_summarise(FileSystem* fs, PartitionPage* page);
+static uint32_t rfs_partition_page_address(FileSystem* fs, uint16_t page_id);
+static uint8_t rfs_partition_age(FileSystem* fs, uint16_t page_id, uint8_t meta);
+static void rfs_partition_rebase(FileSystem* fs, PartitionPage* page);
+
+
+
+void rfs_partition_init(FileSystem* fs) {
+	uint32_t free_blocks = 0;
+
+	for(uint16_t i = 0; i < CACHED_PARTITION_PAGES; i++) {
+		fs->partition_pages[i].loaded = false;
+		fs->partition_pages[i].dirty = false;
+	}
+
+	fs->partition_clock = 0;
+	fs->partition_table_modified = false;
+	fs->partition_epoch = 0;
+
+	for(uint16_t page_id = 0; page_id < fs->partition_page_count; page_id++) {
+		BlockHeader header;
+		bool valid = rfs_block_read_header(fs, 1 + page_id, &header);
+		uint32_t epoch = valid ? header.predecessor : 0;
+
+		fs->partition_epochs[page_id] = epoch;
+
+		for(uint8_t tick = 0; page_id == 0 && valid && tick < 32 && !((header.successor >> tick) & 1); tick++) {
+			epoch++; // Epochs advanced since page 0 was stored
+		}
+
+		fs->partition_epoch = epoch > fs->partition_epoch ? epoch : fs->partition_epoch; // Pages stored since count as well
+
+		rfs_partition_page(fs, page_id); // Computes the page summary
+		free_blocks += fs->partition_free[page_id];
+	}
+
+	fs->total_used_blocks = fs->num_blocks - free_blocks;
+}
+
+/*
+ * Expects all partition blocks to be erased.
+ * Only the entries of the protected blocks and of the bad blocks (NAND) have to be programmed, all other entries are free.
+ */
+void rfs_partition_format(FileSystem* fs) {
+	for(uint16_t i = 0; i < CACHED_PARTITION_PAGES; i++) {
+		fs->partition_pages[i].loaded = false;
+		fs->partition_pages[i].dirty = false;
+	}
+
+	for(uint16_t page_id = 0; page_id < fs->partition_page_count; page_id++) {
+		fs->partition_epochs[page_id] = 0; // Predecessor field of the partition blocks
+	}
+
+	fs->partition_epoch = 0;
+
+	for(uint32_t block_id = 0; block_id < fs->num_blocks; block_id++) {
+		uint8_t entry = block_id ? ~0b00001111 : ~0b00001110; // The core block is used as internal relative clock
+		uint32_t address = rfs_partition_page_address(fs, block_id / PARTITION_PAGE_SIZE) + block_id % PARTITION_PAGE_SIZE;
+
+		if(block_id >= fs->protected_blocks) {
+			if(!fs->page_size) {
+				break;
+			}
+
+			if(!rfs_device_bad_block(fs, block_id)) {
+				continue; // Free
+			}
+
+			entry = (uint8_t) ~BAD_BLOCK_META; // Marked bad by the manufacturer
+		}
+
+		rfs_device_write(fs, address, &entry, 1);
+	}
+}
+
+/*
+ * Stores the dirty pages, then programs the epochs advanced since page 0 was stored (see Relative time).
+ */
+void rfs_partition_flush(FileSystem* fs) {
+	uint32_t elapsed = fs->partition_epoch - fs->partition_epochs[0];
+
+	if(elapsed && (fs->page_size || elapsed > 32)) {
+		rfs_partition_page(fs, 0)->dirty = true; // Rebased once stored
+	}
+
+	for(uint16_t i = 0; i < CACHED_PARTITION_PAGES; i++) {
+		PartitionPage* page = &(fs->partition_pages[i]);
+
+		if(page->loaded && page->dirty) {
+			rfs_partition_store(fs, page);
+		}
+	}
+
+	elapsed = fs->partition_epoch - fs->partition_epochs[0];
+
+	if(elapsed) {
+		uint32_t ticks = elapsed < 32 ? 0xFFFFFFFF << elapsed : 0;
+		uint8_t buffer[4] = { (uint8_t) ticks, (uint8_t) (ticks >> 8), (uint8_t) (ticks >> 16), (uint8_t) (ticks >> 24) };
+
+		rfs_device_write(fs, fs->block_size + 12, buffer, 4); // Successor field of block 1, only clears bits
+	}
+}
+
+uint8_t rfs_partition_get(FileSystem* fs, uint32_t block_id) {
+	uint16_t page_id = block_id / PARTITION_PAGE_SIZE;
+	PartitionPage* page = rfs_partition_page(fs, page_id);
+
+	return rfs_partition_age(fs, page_id, page->entries[block_id % PARTITION_PAGE_SIZE]);
+}
+
+void rfs_partition_set(FileSystem* fs, uint32_t block_id, uint8_t meta) {
+	uint16_t page_id = block_id / PARTITION_PAGE_SIZE;
+	uint16_t offset = block_id % PARTITION_PAGE_SIZE;
+
+	PartitionPage* page = rfs_partition_page(fs, page_id);
+	uint8_t age = meta & 0xF;
+
+	if(meta && age != 0xF) {
+		uint32_t elapsed = fs->partition_epoch - fs->partition_epochs[page_id];
+
+		if(elapsed > (uint32_t) (0xE - age)) {
+			rfs_partition_rebase(fs, page); // The relative time cannot be expressed relative to the epoch of the page
+			page->dirty = true;
+			elapsed = 0;
+		}
+
+		meta += elapsed; // As stored
+	}
+
+	uint8_t previous = page->entries[offset];
+
+	if(previous == meta) {
+		return;
+	}
+
+	if(previous == 0) {
+		fs->partition_free[page_id]--;
+	} else if(meta == 0) {
+		fs->partition_free[page_id]++;
+	}
+
+	if(meta && block_id >= fs->protected_blocks && (meta & 0xF) < fs->partition_min_age[page_id]) {
+		fs->partition_min_age[page_id] = meta & 0xF;
+	}
+
+	page->entries[offset] = meta;
+
+	if(!fs->page_size && !page->dirty && (previous & ~meta) == 0) {
+		// Only clears bits of the inverted entry: the flash copy can be programmed in place without erasing the page.
+		uint8_t inverted = ~meta;
+		rfs_device_write(fs, rfs_partition_page_address(fs, page_id) + offset, &inverted, 1);
+	} else {
+		page->dirty = true;
+		fs->partition_table_modified = true;
+	}
+}
+
+/*
+ * Returns the first free block ID from the given block ID on (wrapping around the end of the device) or 0 if the device is full.
+ */
+uint32_t rfs_partition_find_free(FileSystem* fs, uint32_t from) {
+	if(from < fs->protected_blocks || from >= fs->num_blocks) {
+		from = fs->protected_blocks;
+	}
+
+	uint32_t start_page = from / PARTITION_PAGE_SIZE;
+
+	// The start page is visited twice: from the given block ID on, and before it once the search wrapped around.
+	for(uint32_t i = 0; i <= fs->partition_page_count; i++) {
+		uint32_t page_id = (start_page + i) % fs->partition_page_count;
+
+		if(fs->partition_free[page_id]) {
+			PartitionPage* page = rfs_partition_page(fs, page_id);
+
+			uint32_t first_block = page_id * PARTITION_PAGE_SIZE;
+			uint32_t block_id = i == 0 ? from : (first_block < fs->protected_blocks ? fs->protected_blocks : first_block);
+			uint32_t last_block = i == fs->partition_page_count ? from : first_block + PARTITION_PAGE_SIZE;
+
+			for(; block_id < last_block && block_id < fs->num_blocks; block_id++) {
+				if(page->entries[block_id - first_block] == 0) {
+					return block_id;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the recyclable block with the lowest relative time or 0 if all blocks are immortal.
+ * Only the pages which may contain an older block than the current candidate are loaded.
+ */
+uint32_t rfs_partition_find_oldest(FileSystem* fs, uint8_t* age) {
+	uint32_t oldest_block_id = 0;
+	uint8_t oldest_block_age = 0xF;
+
+	for(uint16_t page_id = 0; page_id < fs->partition_page_count && oldest_block_age > 0; page_id++) {
+		if(rfs_partition_age(fs, page_id, fs->partition_min_age[page_id]) < oldest_block_age) {
+			PartitionPage* page = rfs_partition_page(fs, page_id);
+
+			uint32_t first_block = page_id * PARTITION_PAGE_SIZE;
+			uint32_t block_id = first_block < fs->protected_blocks ? fs->protected_blocks : first_block;
+			uint8_t min_age = 0xF;
+
+			for(; block_id < first_block + PARTITION_PAGE_SIZE && block_id < fs->num_blocks; block_id++) {
+				uint8_t meta = page->entries[block_id - first_block];
+				uint8_t block_age = rfs_partition_age(fs, page_id, meta) & 0xF;
+
+				if(meta && (meta & 0xF) < min_age) {
+					min_age = meta & 0xF;
+				}
+
+				if(meta && block_age < oldest_block_age) {
+					oldest_block_id = block_id;
+					oldest_block_age = block_age;
+				}
+			}
+
+			fs->partition_min_age[page_id] = min_age;
+		}
+	}
+
+	*age = oldest_block_age;
+
+	return oldest_block_id;
+}
+
+/*
+ * Ages all recyclable entries by one (down to 0), without rewriting any page.
+ */
+void rfs_partition_advance_time(FileSystem* fs) {
+	fs->partition_epoch++;
+	fs->partition_table_modified = true; // The epoch is programmed by rfs_partition_flush()
+}
+
+
+
+/*
+ * Page cache functions
+ */
+static PartitionPage* rfs_partition_page(FileSystem* fs, uint16_t page_id) {
+	PartitionPage* victim = &(fs->partition_pages[0]);
+
+	for(uint16_t i = 0; i < CACHED_PARTITION_PAGES; i++) {
+		PartitionPage* page = &(fs->partition_pages[i]);
+
+		if(page->loaded && page->index == page_id) {
+			page->last_use = ++fs->partition_clock;
+			return page;
+		}
+
+		if(victim->loaded && (!page->loaded || page->last_use < victim->last_use)) {
+			victim = page; // Least recently used page
+		}
+	}
+
+	if(victim->loaded && victim->dirty) {
+		rfs_partition_store(fs, victim);
+	}
+
+	rfs_partition_load(fs, victim, page_id);
+	victim->last_use = ++fs->partition_clock;
+
+	return victim;
+}
+
+static void rfs_partition_load(FileSystem* fs, PartitionPage* page, uint16_t page_id) {
+	rfs_device_read(fs, rfs_partition_page_address(fs, page_id), page->entries, PARTITION_PAGE_SIZE);
+
+	for(uint32_t i = 0; i < PARTITION_PAGE_SIZE; i++) {
+		page->entries[i] = ~page->entries[i]; // Free entries are erased
+	}
+
+	page->index = page_id;
+	page->loaded = true;
+	page->dirty = false;
+
+	rfs_partition_summarise(fs, page);
+}
+
+/*
+ * The page is encoded in small chunks so that no full-size copy of the page is needed.
+ */
+static void rfs_partition_store(FileSystem* fs, PartitionPage* page) {
+	uint8_t buffer[64];
+	uint32_t block_id = 1 + page->index;
+	uint32_t address = rfs_partition_page_address(fs, page->index);
+
+	rfs_partition_rebase(fs, page);
+
+	if(!rfs_block_erase(fs, block_id)) {
+		fs->log("Fatal: Partition block is bad");
+	}
+
+	rfs_block_write_header(fs, block_id, 0, fs->partition_epochs[page->index]);
+
+	for(uint32_t i = 0; i < PARTITION_PAGE_SIZE; i += sizeof(buffer)) {
+		uint32_t length = PARTITION_PAGE_SIZE - i < sizeof(buffer) ? PARTITION_PAGE_SIZE - i : sizeof(buffer);
+
+		for(uint32_t j = 0; j < length; j++) {
+			buffer[j] = ~page->entries[i + j];
+		}
+
+		rfs_device_write(fs, address + i, buffer, length);
+	}
+
+	page->dirty = false;
+}
+
+static void rfs_partition_summarise(FileSystem* fs, PartitionPage* page) {
+	uint32_t first_block = page->index * PARTITION_PAGE_SIZE;
+	uint16_t free_entries = 0;
+	uint8_t min_age = 0xF;
+
+	for(uint32_t block_id = first_block; block_id < first_block + PARTITION_PAGE_SIZE && block_id < fs->num_blocks; block_id++) {
+		uint8_t meta = page->entries[block_id - first_block];
+
+		if(meta == 0 && block_id >= fs->protected_blocks) { // The entry of the core block reads as 0 once its relative time ran out
+			free_entries++;
+		} else if(block_id >= fs->protected_blocks && (meta & 0xF) < min_age) {
+			min_age = meta & 0xF;
+		}
+	}
+
+	fs->partition_free[page->index] = free_entries;
+	fs->partition_min_age[page->index] = min_age;
+}
+
+static uint32_t rfs_partition_page_address(FileSystem* fs, uint16_t page_id) {
+	return rfs_get_block_base_address(fs, 1 + page_id);
+}
+
+/*
+ * Returns the entry with its current relative time, given the entry as stored in the page.
+ */
+static uint8_t rfs_partition_age(FileSystem* fs, uint16_t page_id, uint8_t meta) {
+	uint8_t age = meta & 0xF;
+	uint32_t elapsed = fs->partition_epoch - fs->partition_epochs[page_id];
+
+	if(age == 0xF) {
+		return meta; // Immortal
+	}
+
+	return (meta & 0xF0) | (age > elapsed ? age - elapsed : 0);
+}
+
+/*
+ * Stores the current relative times in the page, relative to the current epoch.
+ */
+static void rfs_partition_rebase(FileSystem* fs, PartitionPage* page) {
+	for(uint32_t i = 0; i < PARTITION_PAGE_SIZE; i++) {
+		page->entries[i] = rfs_partition_age(fs, page->index, page->entries[i]);
+	}
+
+	fs->partition_epochs[page->index] = fs->partition_epoch;
+	rfs_partition_summarise(fs, page);
+}
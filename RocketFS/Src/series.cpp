@@ -0,0 +1,424 @@
+/*
+ * series.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+#include "series.h"
+
+#include "encoding.h"
+#include "stream.h"
+
+/*
+ * Non-exported function prototypes
+ */
+static bool rfs_series_column_name(const char* name, uint8_t column, char* filename);
+static bool rfs_series_read_header(Stream* stream, uint16_t column, uint16_t* samples);
+static bool rfs_series_read_record(Stream* stream, uint8_t* record, uint32_t length);
+static void rfs_series_summary_flush(Series* series);
+static uint32_t rfs_series_read_summaries(Stream* stream, uint8_t channel, Summary* summaries, uint32_t max_summaries, uint32_t merged_records);
+
+
+
+bool rocket_fs_series_create(FileSystem* fs, Series* series, const char* name, uint8_t channel_count, FileType type, bool summaries) {
+	char filename[16];
+
+	if(channel_count == 0 || channel_count > SERIES_MAX_CHANNELS) {
+		fs->log("Error: Unsupported number of channels. Consider increasing SERIES_MAX_CHANNELS.");
+		return false;
+	}
+
+	uint32_t copies = type == LOW_REDUNDANCE ? 2 : (type == HIGH_REDUNDANCE ? 3 : 1);
+	uint32_t free_files = 0;
+
+	for(uint32_t file_id = 0; file_id < NUM_FILES; file_id++) {
+		free_files += fs->files[file_id].first_block == 0;
+	}
+
+	if((1 + channel_count) * copies + summaries > free_files) {
+		fs->log("Error: Not enough file identifiers for the columns of the series. Consider increasing NUM_FILES.");
+		return false;
+	}
+
+	if(summaries && !(rfs_series_column_name(name, SERIES_SUMMARY_COLUMN, filename) && rocket_fs_newfile(fs, filename, RAW))) {
+		fs->log("Unable to create the summary file of the series.");
+		return false;
+	}
+
+	for(uint8_t column = 0; column <= channel_count; column++) {
+		File* file = rfs_series_column_name(name, column, filename) ? rocket_fs_newfile(fs, filename, type) : 0;
+
+		if(!file) {
+			fs->log("Unable to create the column files of the series.");
+
+			while(column-- > 0) {
+				rfs_series_column_name(name, column, filename);
+				rocket_fs_delfile(fs, rocket_fs_getfile(fs, filename));
+			}
+
+			if(summaries) {
+				rfs_series_column_name(name, SERIES_SUMMARY_COLUMN, filename);
+				rocket_fs_delfile(fs, rocket_fs_getfile(fs, filename));
+			}
+
+			return false;
+		}
+	}
+
+	return rocket_fs_series_open(fs, series, name);
+}
+
+bool rocket_fs_series_open(FileSystem* fs, Series* series, const char* name) {
+	char filename[16];
+	File* files[1 + SERIES_MAX_CHANNELS];
+	uint8_t column_count = 0;
+
+	while(column_count <= SERIES_MAX_CHANNELS && rfs_series_column_name(name, column_count, filename)) {
+		files[column_count] = rocket_fs_getfile(fs, filename);
+
+		if(!files[column_count]) {
+			break;
+		}
+
+		column_count++;
+	}
+
+	if(column_count < 2) {
+		fs->log("Error: Series not found");
+		return false;
+	}
+
+	series->fs = fs;
+	series->channel_count = column_count - 1;
+	series->buffered_samples = 0;
+
+	for(uint8_t column = 0; column < column_count; column++) {
+		if(!rocket_fs_stream(&(series->writer), fs, files[column], APPEND)) {
+			return false;
+		}
+
+		rfs_stream_suspend(&(series->writer), &(series->columns[column]));
+	}
+
+	File* summaries = rfs_series_column_name(name, SERIES_SUMMARY_COLUMN, filename) ? rocket_fs_getfile(fs, filename) : 0;
+
+	series->summarized = summaries != 0;
+	series->summary_samples = 0;
+
+	if(summaries) {
+		rocket_fs_stream(&(series->writer), fs, summaries, APPEND);
+		rfs_stream_suspend(&(series->writer), &(series->summaries));
+	}
+
+	return true;
+}
+
+void rocket_fs_series_append(Series* series, uint32_t time, const uint32_t* values) {
+	series->times[series->buffered_samples] = time;
+
+	for(uint8_t channel = 0; channel < series->channel_count; channel++) {
+		series->samples[channel][series->buffered_samples] = values[channel];
+	}
+
+	if(series->summarized) {
+		if(series->summary_samples == 0) {
+			series->summary_first_time = time;
+
+			for(uint8_t channel = 0; channel < series->channel_count; channel++) {
+				series->minimum[channel] = values[channel];
+				series->maximum[channel] = values[channel];
+			}
+		}
+
+		for(uint8_t channel = 0; channel < series->channel_count; channel++) {
+			int32_t value = values[channel];
+
+			series->minimum[channel] = value < series->minimum[channel] ? value : series->minimum[channel];
+			series->maximum[channel] = value > series->maximum[channel] ? value : series->maximum[channel];
+		}
+
+		series->summary_last_time = time;
+
+		if(++series->summary_samples == SERIES_SUMMARY_SAMPLES) {
+			rfs_series_summary_flush(series);
+		}
+	}
+
+	if(++series->buffered_samples == SERIES_BUFFERED_SAMPLES) {
+		rocket_fs_series_flush(series);
+	}
+}
+
+/*
+ * Writes one segment to each column, one column after the other.
+ */
+void rocket_fs_series_flush(Series* series) {
+	uint8_t segment[SERIES_SEGMENT_HEADER_SIZE + 4 * SERIES_BUFFERED_SAMPLES];
+	uint16_t samples = series->buffered_samples;
+
+	if(samples == 0) {
+		return;
+	}
+
+	for(uint8_t column = 0; column <= series->channel_count; column++) {
+		const uint32_t* values = column ? series->samples[column - 1] : series->times;
+
+		segment[0] = column;
+		segment[1] = column >> 8;
+		segment[2] = samples;
+		segment[3] = samples >> 8;
+		__encode32(segment + 4, series->times[0]);
+
+		for(uint16_t i = 0; i < samples; i++) {
+			__encode32(segment + SERIES_SEGMENT_HEADER_SIZE + 4 * i, values[i]);
+		}
+
+		rfs_stream_resume(&(series->writer), series->fs, &(series->columns[column]));
+		series->writer.write(segment, SERIES_SEGMENT_HEADER_SIZE + 4 * samples);
+		rfs_stream_suspend(&(series->writer), &(series->columns[column]));
+	}
+
+	series->buffered_samples = 0;
+}
+
+void rocket_fs_series_close(Series* series) {
+	rocket_fs_series_flush(series);
+
+	for(uint8_t column = 0; column <= series->channel_count; column++) {
+		rfs_stream_resume(&(series->writer), series->fs, &(series->columns[column]));
+		series->writer.close();
+	}
+
+	if(series->summarized) {
+		rfs_series_summary_flush(series);
+		rfs_stream_resume(&(series->writer), series->fs, &(series->summaries));
+		series->writer.close();
+	}
+}
+
+/*
+ * Writes the summary record of the samples appended since the last one.
+ */
+static void rfs_series_summary_flush(Series* series) {
+	uint8_t record[SERIES_SUMMARY_HEADER_SIZE + 8 * SERIES_MAX_CHANNELS];
+
+	if(series->summary_samples == 0) {
+		return;
+	}
+
+	record[0] = series->channel_count;
+	record[1] = 0;
+	record[2] = series->summary_samples;
+	record[3] = series->summary_samples >> 8;
+	__encode32(record + 4, series->summary_first_time);
+	__encode32(record + 8, series->summary_last_time);
+
+	for(uint8_t channel = 0; channel < series->channel_count; channel++) {
+		__encode32(record + SERIES_SUMMARY_HEADER_SIZE + 8 * channel, series->minimum[channel]);
+		__encode32(record + SERIES_SUMMARY_HEADER_SIZE + 8 * channel + 4, series->maximum[channel]);
+	}
+
+	rfs_stream_resume(&(series->writer), series->fs, &(series->summaries));
+	series->writer.write(record, SERIES_SUMMARY_HEADER_SIZE + 8 * series->channel_count);
+	rfs_stream_suspend(&(series->writer), &(series->summaries));
+	series->summary_samples = 0;
+}
+
+
+
+/*
+ * Only the timestamps and the column of the given channel (0...channel_count - 1) are read.
+ */
+bool rocket_fs_column_open(FileSystem* fs, Column* column, const char* name, uint8_t channel) {
+	char filename[16];
+	File* times = rfs_series_column_name(name, 0, filename) ? rocket_fs_getfile(fs, filename) : 0;
+	File* values = rfs_series_column_name(name, 1 + channel, filename) ? rocket_fs_getfile(fs, filename) : 0;
+
+	if(!times || !values) {
+		fs->log("Error: Column not found");
+		return false;
+	}
+
+	rocket_fs_stream(&(column->times), fs, times, OVERWRITE);
+	rocket_fs_stream(&(column->values), fs, values, OVERWRITE);
+
+	column->column = 1 + channel;
+	column->remaining_samples = 0;
+
+	return true;
+}
+
+bool rocket_fs_column_next(Column* column, uint32_t* time, uint32_t* value) {
+	if(column->remaining_samples == 0) {
+		uint16_t time_samples;
+		uint16_t value_samples;
+
+		if(!rfs_series_read_header(&(column->times), 0, &time_samples) || !rfs_series_read_header(&(column->values), column->column, &value_samples)) {
+			return false;
+		}
+
+		if(time_samples != value_samples) {
+			column->values.fs->log("Warning: Columns out of sync");
+			return false;
+		}
+
+		column->remaining_samples = value_samples;
+	}
+
+	*time = column->times.read32();
+	*value = column->values.read32();
+
+	column->remaining_samples--;
+
+	return !column->times.eof && !column->values.eof;
+}
+
+void rocket_fs_column_close(Column* column) {
+	column->times.close();
+	column->values.close();
+}
+
+
+
+uint32_t rocket_fs_summarize(FileSystem* fs, const char* name, uint8_t channel, Summary* summaries, uint32_t max_summaries) {
+	char filename[16];
+	File* file = rfs_series_column_name(name, SERIES_SUMMARY_COLUMN, filename) ? rocket_fs_getfile(fs, filename) : 0;
+	Stream stream;
+
+	if(!file || max_summaries == 0) {
+		return 0;
+	}
+
+	// First pass: count the records, so that they are merged evenly
+	rocket_fs_stream(&stream, fs, file, OVERWRITE);
+	uint32_t records = rfs_series_read_summaries(&stream, channel, 0, 0, 1);
+	stream.close();
+
+	if(records == 0) {
+		return 0;
+	}
+
+	rocket_fs_stream(&stream, fs, file, OVERWRITE);
+	uint32_t summary_count = rfs_series_read_summaries(&stream, channel, summaries, max_summaries, (records + max_summaries - 1) / max_summaries);
+	stream.close();
+
+	return summary_count;
+}
+
+/*
+ * Merges each run of merged_records summary records into a summary of the given channel.
+ * Only counts the records if no summary buffer is given.
+ */
+static uint32_t rfs_series_read_summaries(Stream* stream, uint8_t channel, Summary* summaries, uint32_t max_summaries, uint32_t merged_records) {
+	uint8_t record[SERIES_SUMMARY_HEADER_SIZE + 8 * SERIES_MAX_CHANNELS];
+	uint32_t record_count = 0;
+
+	while(rfs_series_read_record(stream, record, SERIES_SUMMARY_HEADER_SIZE)) {
+		uint8_t channel_count = record[0];
+		uint16_t samples = record[2] | record[3] << 8;
+
+		if(samples == 0 || samples > SERIES_SUMMARY_SAMPLES || channel_count > SERIES_MAX_CHANNELS || channel >= channel_count) {
+			break; // Erased or foreign data
+		}
+
+		if(stream->read(record + SERIES_SUMMARY_HEADER_SIZE, 8 * channel_count) != (int32_t) (8 * channel_count)) {
+			break;
+		}
+
+		if(summaries) {
+			Summary* summary = &(summaries[record_count / merged_records]);
+			int32_t minimum = __decode32(record + SERIES_SUMMARY_HEADER_SIZE + 8 * channel);
+			int32_t maximum = __decode32(record + SERIES_SUMMARY_HEADER_SIZE + 8 * channel + 4);
+
+			if(record_count % merged_records == 0) {
+				summary->first_time = __decode32(record + 4);
+				summary->sample_count = 0;
+				summary->minimum = minimum;
+				summary->maximum = maximum;
+			}
+
+			summary->last_time = __decode32(record + 8);
+			summary->sample_count += samples;
+			summary->minimum = minimum < summary->minimum ? minimum : summary->minimum;
+			summary->maximum = maximum > summary->maximum ? maximum : summary->maximum;
+		}
+
+		if(++record_count == max_summaries * merged_records) {
+			break;
+		}
+	}
+
+	return summaries ? (record_count + merged_records - 1) / merged_records : record_count;
+}
+
+
+
+/*
+ * Returns false if the name of the series is too long.
+ */
+static bool rfs_series_column_name(const char* name, uint8_t column, char* filename) {
+	uint8_t length = 0;
+
+	while(name[length] != '\0') {
+		if(length == 12) {
+			return false;
+		}
+
+		filename[length] = name[length];
+		length++;
+	}
+
+	filename[length++] = '.';
+
+	if(column == SERIES_SUMMARY_COLUMN) {
+		filename[length++] = 's';
+	} else {
+		if(column >= 10) {
+			filename[length++] = '0' + column / 10;
+		}
+
+		filename[length++] = '0' + column % 10;
+	}
+
+	filename[length] = '\0';
+
+	return true;
+}
+
+/*
+ * Returns false at the end of the column or if the segment does not belong to the given column.
+ */
+static bool rfs_series_read_header(Stream* stream, uint16_t column, uint16_t* samples) {
+	uint8_t header[SERIES_SEGMENT_HEADER_SIZE];
+
+	if(!rfs_series_read_record(stream, header, SERIES_SEGMENT_HEADER_SIZE)) {
+		return false;
+	}
+
+	uint16_t header_column = header[0] | header[1] << 8;
+	*samples = header[2] | header[3] << 8;
+
+	if(header_column != column || *samples == 0 || *samples > SERIES_BUFFERED_SAMPLES) {
+		return false; // Erased or foreign data
+	}
+
+	return true;
+}
+
+/*
+ * Reads a segment header or a summary record, whose first byte is not 0xFF.
+ * Appending to a COMPRESSED file continues in the next area of the usage table of its last block, so that erased bytes
+ * may be found between the records written before and after the series was reopened: they are skipped.
+ */
+static bool rfs_series_read_record(Stream* stream, uint8_t* record, uint32_t length) {
+	uint32_t skipped_bytes = 0;
+
+	do {
+		if(stream->read(record, 1) != 1 || skipped_bytes++ == stream->fs->block_size / 64) {
+			return false;
+		}
+	} while(record[0] == 0xFF);
+
+	return stream->read(record + 1, length - 1) == (int32_t) (length - 1);
+}
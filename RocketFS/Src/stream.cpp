@@ -8,6 +8,31 @@
 #include "stream.h"
 
 #include "block_management.h"
+#include "checksum.h"
+#include "codec.h"
+#include "device.h"
+#include "ecc.h"
+#include "encoding.h"
+
+#include <string.h>
+
+#define NO_CHUNK 0xFFFFFFFF
+
+/*
+ * Non-exported function prototypes
+ */
+static uint32_t rfs_stream_read_chunk(Stream* stream, uint8_t* buffer, uint32_t length);
+static uint32_t rfs_stream_write_chunks(Stream* stream, uint8_t* buffer, uint32_t length, uint32_t span);
+static void rfs_stream_encode_chunk(Stream* stream, const uint8_t* buffer, uint32_t length);
+static void rfs_stream_encode_trailer(Stream* stream, uint8_t* trailer);
+static void rfs_stream_seal_chunk(Stream* stream);
+static bool rfs_stream_read_replica(Stream* stream, uint32_t chunk_address);
+static void rfs_stream_write_chain(Stream* stream, uint8_t* buffer, uint32_t length);
+static void rfs_stream_swap_replica(Stream* stream, uint8_t replica);
+static int32_t rfs_stream_read_frames(Stream* stream, uint8_t* buffer, uint32_t length);
+static bool rfs_stream_load_frame(Stream* stream);
+static void rfs_stream_write_frames(Stream* stream, uint8_t* buffer, uint32_t length);
+static void rfs_stream_store_frame(Stream* stream);
 
 
 bool init_stream(Stream* stream, FileSystem* fs, uint32_t base_address, FileType type) {
@@ -18,6 +43,24 @@ bool init_stream(Stream* stream, FileSystem* fs, uint32_t base_address, FileType
 		stream->type = type;
 		stream->open = true;
 		stream->eof = false;
+		stream->corrupted_chunks = 0;
+		stream->corrected_bytes = 0;
+		stream->file = 0;
+		stream->replica_count = 0;
+		stream->following = false;
+		stream->follow_skip = 0;
+
+		if(type == COMPRESSED) {
+			stream->compressed.write_frame_length = 0;
+			stream->compressed.read_frame_length = 0;
+			stream->compressed.read_frame_offset = 0;
+			stream->compressed.read_block = NO_CHUNK;
+
+			memset(stream->compressed.write_history, 0, sizeof(stream->compressed.write_history));
+		} else {
+			stream->checked.write_chunk = NO_CHUNK;
+			stream->checked.read_chunk = NO_CHUNK;
+		}
 
 		return true;
 	} else {
@@ -27,11 +70,53 @@ bool init_stream(Stream* stream, FileSystem* fs, uint32_t base_address, FileType
 
 }
 
-Stream::Stream() : fs(0), type(RAW), eof(false), open(false), read_address(0xFFFFFFFFL), write_address(0xFFFFFFFFL) {
-	;
+Stream::Stream() : fs(0), type(RAW), eof(false), open(false), read_address(0xFFFFFFFFL), write_address(0xFFFFFFFFL),
+                   corrupted_chunks(0), corrected_bytes(0), file(0), replica_count(0), following(false), follow_skip(0), checked() {
+	checked.write_chunk = NO_CHUNK;
+	checked.read_chunk = NO_CHUNK;
 }
 
 void Stream::close() {
+	rfs_stream_seal_chunk(this);
+
+	/*
+	 * The pending bytes are stored in a short frame, which also clears the history of the decoder.
+	 * It is required if the history is not clear already, so that a stream appending to the file starts in sync with the decoder.
+	 */
+	if(type == COMPRESSED && open) {
+		bool history = false;
+
+		for(uint32_t i = 0; i < CODEC_FRAME_WORDS; i++) {
+			history |= compressed.write_history[i] != 0;
+		}
+
+		if(compressed.write_frame_length || history) {
+			rfs_stream_store_frame(this);
+		}
+	}
+
+	for(uint8_t i = 0; i < replica_count; i++) {
+		rfs_stream_swap_replica(this, i);
+		rfs_stream_seal_chunk(this);
+		rfs_stream_swap_replica(this, i);
+	}
+
+	if(file && !following) {
+		// The end of the data is exact to the byte at the next mount, even if it is 0xFF
+		rfs_block_record_end(fs, file);
+
+		for(uint8_t i = 0; i < file->replica_count; i++) {
+			rfs_block_record_end(fs, &(fs->files[file->replicas[i]]));
+		}
+	}
+
+	if(file && file->writer == this) {
+		file->writer = 0;
+	}
+
+	file = 0;
+	replica_count = 0;
+
 	read_address = 0xFFFFFFFFL;
 	write_address = 0xFFFFFFFFL;
 	open = false;
@@ -41,6 +126,71 @@ void Stream::close() {
 	fs = 0;
 }
 
+/*
+ * Saves the position of the writer and releases the stream, without sealing anything: the file is neither closed nor
+ * followable until the cursor is resumed. The pending bytes of a COMPRESSED file are stored in a short frame first.
+ */
+void rfs_stream_suspend(Stream* stream, StreamCursor* cursor) {
+	if(stream->type == COMPRESSED && stream->compressed.write_frame_length) {
+		rfs_stream_store_frame(stream);
+	}
+
+	cursor->file = stream->file;
+	cursor->type = stream->type;
+	cursor->replica_count = stream->replica_count;
+	cursor->write_address = stream->write_address;
+
+	if(stream->type == COMPRESSED) {
+		memcpy(cursor->compressed.write_history, stream->compressed.write_history, sizeof(cursor->compressed.write_history));
+	} else {
+		cursor->checked.write_chunk = stream->checked.write_chunk;
+		cursor->checked.write_checksum = stream->checked.write_checksum;
+		memcpy(cursor->checked.write_parity, stream->checked.write_parity, ECC_PARITY_SIZE);
+
+		for(uint8_t i = 0; i < stream->replica_count; i++) {
+			cursor->checked.replica_write_address[i] = stream->checked.replica_write_address[i];
+			cursor->checked.replica_write_chunk[i] = stream->checked.replica_write_chunk[i];
+			cursor->checked.replica_write_checksum[i] = stream->checked.replica_write_checksum[i];
+		}
+	}
+
+	if(stream->file && stream->file->writer == stream) {
+		stream->file->writer = 0;
+	}
+
+	stream->file = 0;
+	stream->open = false;
+}
+
+/*
+ * Opens the stream where the writer of the cursor was suspended.
+ */
+bool rfs_stream_resume(Stream* stream, FileSystem* fs, const StreamCursor* cursor) {
+	if(!init_stream(stream, fs, cursor->write_address, cursor->type)) {
+		return false;
+	}
+
+	stream->file = cursor->file;
+	stream->replica_count = cursor->replica_count;
+	cursor->file->writer = stream;
+
+	if(cursor->type == COMPRESSED) {
+		memcpy(stream->compressed.write_history, cursor->compressed.write_history, sizeof(stream->compressed.write_history));
+	} else {
+		stream->checked.write_chunk = cursor->checked.write_chunk;
+		stream->checked.write_checksum = cursor->checked.write_checksum;
+		memcpy(stream->checked.write_parity, cursor->checked.write_parity, ECC_PARITY_SIZE);
+
+		for(uint8_t i = 0; i < cursor->replica_count; i++) {
+			stream->checked.replica_write_address[i] = cursor->checked.replica_write_address[i];
+			stream->checked.replica_write_chunk[i] = cursor->checked.replica_write_chunk[i];
+			stream->checked.replica_write_checksum[i] = cursor->checked.replica_write_checksum[i];
+		}
+	}
+
+	return true;
+}
+
 /* RAW IO FUNCTIONS */
 static uint8_t coder[8]; // Used as encoder and decoder
 
@@ -48,6 +198,10 @@ int32_t Stream::read(uint8_t* buffer, uint32_t length) {
 	uint32_t index = 0;
 	int32_t readable_length = 0;
 
+	if(type == COMPRESSED) {
+		return rfs_stream_read_frames(this, buffer, length);
+	}
+
 	do {
 	   readable_length = rfs_access_memory(fs, &read_address, length - index, READ); // Transforms the write address (or fails if end of file) if we are at the end of a readable section
 
@@ -58,15 +212,81 @@ int32_t Stream::read(uint8_t* buffer, uint32_t length) {
     	  eof = false;
       }
 
-		fs->read(read_address, buffer + index, readable_length);
+		if(rfs_chunk_type(type)) {
+			readable_length = rfs_stream_read_chunk(this, buffer + index, readable_length);
+		} else {
+			rfs_device_read(fs, read_address, buffer + index, readable_length);
+			read_address += readable_length;
+		}
 
 		index += readable_length;
-		read_address += readable_length;
 	} while(index < length);
 
 	return length;
 }
 
+/*
+ * Points span to the next bytes of a RAW file in the memory of a mapped device, so that they can be parsed in place.
+ * The span holds up to length bytes and ends at the end of the data of the current block at the latest: the next call
+ * returns the following span. The bytes remain valid until the block is recycled.
+ * Returns the length of the span (0 at the end of the file) or -1 if the file cannot be read in place (use read()).
+ */
+int32_t Stream::read_span(const uint8_t** span, uint32_t length) {
+	if(type != RAW) {
+		fs->log("Error: Only RAW files can be read in place.");
+		return -1;
+	}
+
+	int32_t readable_length = rfs_access_memory(fs, &read_address, length, READ);
+
+	if(readable_length <= 0) {
+		eof = true;
+		return 0;
+	}
+
+	const uint8_t* data = rfs_device_pointer(fs, read_address);
+
+	if(!data) {
+		fs->log("Error: Device not memory-mapped");
+		return -1;
+	}
+
+	eof = false;
+	*span = data;
+	read_address += readable_length;
+
+	return readable_length;
+}
+
+/*
+ * The bytes of RAW files are skipped without being read. The others are read, since they are checked or decoded in sequence.
+ * Returns the number of skipped bytes.
+ */
+uint32_t Stream::skip(uint32_t length) {
+	uint8_t discarded[32];
+	uint32_t index = 0;
+
+	while(index < length) {
+		int32_t skipped_length;
+
+		if(type == RAW) {
+			skipped_length = rfs_access_memory(fs, &read_address, length - index, READ);
+			read_address += skipped_length > 0 ? skipped_length : 0;
+		} else {
+			skipped_length = read(discarded, length - index < sizeof(discarded) ? length - index : sizeof(discarded));
+		}
+
+		if(skipped_length <= 0) {
+			eof = true;
+			break;
+		}
+
+		index += skipped_length;
+	}
+
+	return index;
+}
+
 uint8_t Stream::read8() {
 	read(coder, 1);
 	return coder[0];
@@ -115,24 +335,57 @@ uint64_t Stream::read64() {
 
 #include <stdio.h>
 
+/*
+ * The same data is written to each copy of a mirrored file right after the original, so that a device
+ * which programs asynchronously can overlap the writes. The end of file is only reported for the original.
+ */
 void Stream::write(uint8_t* buffer, uint32_t length) {
+	if(following) {
+		fs->log("Error: FOLLOW streams are read-only.");
+		return;
+	}
+
+	rfs_stream_write_chain(this, buffer, length);
+
+	bool original_eof = eof;
+
+	for(uint8_t i = 0; i < replica_count; i++) {
+		rfs_stream_swap_replica(this, i);
+		rfs_stream_write_chain(this, buffer, length);
+		rfs_stream_swap_replica(this, i);
+	}
+
+	eof = original_eof;
+}
+
+static void rfs_stream_write_chain(Stream* stream, uint8_t* buffer, uint32_t length) {
+   FileSystem* fs = stream->fs;
    uint32_t index = 0;
    int32_t writable_length = 0;
 
+   if(stream->type == COMPRESSED) {
+      rfs_stream_write_frames(stream, buffer, length);
+      return;
+   }
+
    do {
-      writable_length = rfs_access_memory(fs, &write_address, length - index, WRITE); // Transforms the write address (or fails if end of file) if we are at the end of a readable section
+      writable_length = rfs_access_memory(fs, &stream->write_address, length - index, WRITE); // Transforms the write address (or fails if end of file) if we are at the end of a readable section
 
       if(writable_length <= 0) {
-         eof = true;
+         stream->eof = true;
          return;
       } else {
-         eof = false;
+         stream->eof = false;
       }
 
-      fs->write(write_address, buffer + index, writable_length);
+      if(rfs_chunk_type(stream->type)) {
+         writable_length = rfs_stream_write_chunks(stream, buffer + index, length - index, writable_length);
+      } else {
+         rfs_device_write(fs, stream->write_address, buffer + index, writable_length);
+         stream->write_address += writable_length;
+      }
 
       index += writable_length;
-      write_address += writable_length;
    } while(index < length);
 }
 
@@ -168,3 +421,503 @@ void Stream::write64(uint64_t data) {
 
 	write(coder, 8);
 }
+
+
+
+/* CHUNKED IO FUNCTIONS */
+
+/*
+ * Chunks are verified (and corrected) when the stream enters them and are then served from the chunk buffer, up to their fill.
+ * The chunk which the writer of the file is filling has no trailer yet: FOLLOW streams read it as is, without keeping it.
+ * Returns the number of bytes copied into the buffer (0 if the end of the chunk was skipped).
+ */
+static uint32_t rfs_stream_read_chunk(Stream* stream, uint8_t* buffer, uint32_t length) {
+	FileSystem* fs = stream->fs;
+	uint32_t chunk_size = rfs_chunk_size(stream->type);
+	uint32_t offset = stream->read_address % chunk_size;
+	uint32_t chunk_address = stream->read_address - offset;
+	uint32_t data_end = rfs_chunk_data_end(stream->type);
+
+	if(offset >= data_end) {
+		stream->read_address += chunk_size - offset; // Skip the trailer
+		return 0;
+	}
+
+	Stream* writer = stream->following ? stream->file->writer : 0;
+
+	if(writer && writer->checked.write_chunk == chunk_address) {
+		if(length > data_end - offset) {
+			length = data_end - offset;
+		}
+
+		rfs_device_read(fs, stream->read_address, buffer, length);
+		stream->read_address += length;
+		stream->checked.read_chunk = NO_CHUNK;
+
+		return length;
+	}
+
+	if(stream->checked.read_chunk != chunk_address) {
+		rfs_device_read(fs, chunk_address, stream->checked.chunk, chunk_size);
+
+		int32_t corrected_bytes = rfs_chunk_check(fs, stream->type, chunk_address, stream->checked.chunk);
+
+		if(corrected_bytes < 0 && rfs_stream_read_replica(stream, chunk_address)) {
+			corrected_bytes = 0;
+		}
+
+		if(corrected_bytes < 0) {
+			fs->log("Warning: Corrupted chunk");
+			stream->corrupted_chunks++;
+		} else {
+			stream->corrected_bytes += corrected_bytes;
+		}
+
+		stream->checked.read_chunk = chunk_address;
+	}
+
+	uint32_t fill = rfs_chunk_fill(stream->type, stream->checked.chunk);
+
+	if(offset >= fill) {
+		stream->read_address += chunk_size - offset; // Sealed before it was full
+		return 0;
+	}
+
+	if(length > fill - offset) {
+		length = fill - offset;
+	}
+
+	memcpy(buffer, stream->checked.chunk + offset, length);
+	stream->read_address += length;
+
+	if(offset + length == fill) {
+		stream->read_address += chunk_size - fill;
+	}
+
+	return length;
+}
+
+/*
+ * Writes as many bytes as possible in the span which was marked as used by rfs_access_memory().
+ * The trailer is computed on the fly and programmed together with the data as soon as the chunk is full.
+ * The bytes are staged so that whole pages are programmed at once. Returns the number of bytes written.
+ */
+static uint32_t rfs_stream_write_chunks(Stream* stream, uint8_t* buffer, uint32_t length, uint32_t span) {
+	FileSystem* fs = stream->fs;
+	uint32_t chunk_size = rfs_chunk_size(stream->type);
+	uint32_t data_end = rfs_chunk_data_end(stream->type);
+	uint32_t end_address = stream->write_address + span;
+	uint32_t index = 0;
+
+	uint8_t staging[2 * CHECKSUM_CHUNK_SIZE];
+	uint32_t staged = 0;
+	uint32_t staging_address = stream->write_address;
+
+	while(index < length && stream->write_address < end_address) {
+		uint32_t offset = stream->write_address % chunk_size;
+		uint32_t chunk_address = stream->write_address - offset;
+
+		if(offset >= data_end || staged + chunk_size > sizeof(staging)) {
+			if(staged) {
+				rfs_device_write(fs, staging_address, staging, staged);
+			}
+
+			if(offset >= data_end) {
+				stream->write_address += chunk_size - offset; // Skip the trailer
+			}
+
+			staged = 0;
+			staging_address = stream->write_address;
+			continue;
+		}
+
+		if(stream->checked.write_chunk != chunk_address) {
+			// The data which precedes the stream in the chunk (e.g. the filename) is covered as well
+			uint32_t data_begin = rfs_chunk_data_begin(fs, chunk_address);
+			uint8_t previous[CHECKSUM_CHUNK_SIZE];
+
+			if(offset > data_begin) {
+				rfs_device_read(fs, chunk_address + data_begin, previous, offset - data_begin);
+			}
+
+			stream->checked.write_checksum = 0;
+			memset(stream->checked.write_parity, 0, ECC_PARITY_SIZE);
+			stream->checked.write_chunk = chunk_address;
+
+			rfs_stream_encode_chunk(stream, previous, offset - data_begin);
+		}
+
+		if(stream->checked.read_chunk == chunk_address) {
+			stream->checked.read_chunk = NO_CHUNK; // The chunk buffer is outdated
+		}
+
+		uint32_t chunk_length = data_end - offset;
+
+		if(chunk_length > length - index) {
+			chunk_length = length - index;
+		}
+
+		if(chunk_length > end_address - stream->write_address) {
+			chunk_length = end_address - stream->write_address;
+		}
+
+		memcpy(staging + staged, buffer + index, chunk_length);
+		rfs_stream_encode_chunk(stream, buffer + index, chunk_length);
+
+		staged += chunk_length;
+		index += chunk_length;
+		stream->write_address += chunk_length;
+
+		if(offset + chunk_length == data_end) {
+			uint32_t trailer_size = chunk_size - data_end;
+
+			if(stream->write_address + trailer_size <= end_address) {
+				rfs_stream_encode_trailer(stream, staging + staged);
+				staged += trailer_size;
+				stream->write_address += trailer_size;
+			} else {
+				rfs_device_write(fs, staging_address, staging, staged);
+				rfs_stream_seal_chunk(stream);
+
+				staged = 0;
+				staging_address = stream->write_address;
+			}
+
+			stream->checked.write_chunk = NO_CHUNK;
+		}
+	}
+
+	if(staged) {
+		rfs_device_write(fs, staging_address, staging, staged);
+	}
+
+	return index;
+}
+
+static void rfs_stream_encode_chunk(Stream* stream, const uint8_t* buffer, uint32_t length) {
+	if(stream->type == ECC) {
+		rfs_ecc_update(stream->checked.write_parity, buffer, length);
+	} else {
+		stream->checked.write_checksum = rfs_crc32c(stream->checked.write_checksum, buffer, length);
+	}
+}
+
+/*
+ * Completes the trailer of the chunk being written. The unwritten end of the chunk is encoded in its erased state,
+ * followed by the fill (the offset of the write address in the chunk).
+ */
+static void rfs_stream_encode_trailer(Stream* stream, uint8_t* trailer) {
+	uint32_t data_end = rfs_chunk_data_end(stream->type);
+	uint32_t fill = stream->write_address - stream->checked.write_chunk;
+	uint32_t remaining = data_end - fill;
+
+	uint8_t padding[8];
+	memset(padding, 0xFF, sizeof(padding));
+
+	for(; remaining > sizeof(padding); remaining -= sizeof(padding)) {
+		rfs_stream_encode_chunk(stream, padding, sizeof(padding));
+	}
+
+	rfs_stream_encode_chunk(stream, padding, remaining);
+
+	trailer[0] = fill;
+
+	if(CHUNK_FILL_SIZE > 1) {
+		trailer[1] = fill >> 8;
+	}
+
+	rfs_stream_encode_chunk(stream, trailer, CHUNK_FILL_SIZE);
+
+	if(stream->type == ECC) {
+		memcpy(trailer + CHUNK_FILL_SIZE, stream->checked.write_parity, ECC_PARITY_SIZE);
+	} else {
+		__encode32(trailer + CHUNK_FILL_SIZE, stream->checked.write_checksum);
+	}
+}
+
+/*
+ * Programs the trailer of the chunk being written, e.g. when the stream is closed in the middle of a chunk.
+ * The stream then continues with the next chunk.
+ */
+static void rfs_stream_seal_chunk(Stream* stream) {
+	if(!rfs_chunk_type(stream->type) || stream->checked.write_chunk == NO_CHUNK) {
+		return;
+	}
+
+	FileSystem* fs = stream->fs;
+	uint32_t address = stream->checked.write_chunk + rfs_chunk_data_end(stream->type);
+	uint32_t trailer_size = rfs_chunk_size(stream->type) - rfs_chunk_data_end(stream->type);
+	uint8_t trailer[CHUNK_FILL_SIZE + ECC_PARITY_SIZE];
+
+	rfs_stream_encode_trailer(stream, trailer);
+
+	rfs_access_memory(fs, &address, trailer_size, WRITE); // Marks the trailer as used
+	rfs_device_write(fs, address, trailer, trailer_size);
+
+	stream->write_address = address + trailer_size;
+
+	if(stream->checked.read_chunk == stream->checked.write_chunk) {
+		stream->checked.read_chunk = NO_CHUNK;
+	}
+
+	stream->checked.write_chunk = NO_CHUNK;
+}
+
+
+
+/* MIRRORED IO FUNCTIONS */
+
+/*
+ * Replaces the chunk buffer with the first copy of the chunk which passes its check.
+ * The corrupted copies are flagged, so that rocket_fs_repair() rebuilds them later on. Returns false if no copy is intact.
+ */
+static bool rfs_stream_read_replica(Stream* stream, uint32_t chunk_address) {
+	FileSystem* fs = stream->fs;
+	File* file = stream->file;
+
+	if(!file || !file->replica_count) {
+		return false;
+	}
+
+	uint32_t block_id = chunk_address / fs->block_size;
+
+	file->degraded |= 0b1;
+
+	for(uint8_t i = 0; i < file->replica_count; i++) {
+		uint32_t mirror_block = rfs_block_mirror(fs, file, &(fs->files[file->replicas[i]]), block_id);
+
+		if(mirror_block) {
+			uint32_t mirror_address = mirror_block * fs->block_size + chunk_address % fs->block_size;
+
+			rfs_device_read(fs, mirror_address, stream->checked.chunk, rfs_chunk_size(stream->type));
+
+			if(rfs_chunk_check(fs, stream->type, mirror_address, stream->checked.chunk) >= 0) {
+				return true;
+			}
+		}
+
+		file->degraded |= 0b10 << i;
+	}
+
+	return false;
+}
+
+/*
+ * Exchanges the write state of the stream with the one of the given replica.
+ */
+static void rfs_stream_swap_replica(Stream* stream, uint8_t replica) {
+	uint32_t write_address = stream->write_address;
+	uint32_t write_chunk = stream->checked.write_chunk;
+	uint32_t write_checksum = stream->checked.write_checksum;
+
+	stream->write_address = stream->checked.replica_write_address[replica];
+	stream->checked.write_chunk = stream->checked.replica_write_chunk[replica];
+	stream->checked.write_checksum = stream->checked.replica_write_checksum[replica];
+
+	stream->checked.replica_write_address[replica] = write_address;
+	stream->checked.replica_write_chunk[replica] = write_chunk;
+	stream->checked.replica_write_checksum[replica] = write_checksum;
+}
+
+/*
+ * Copies the data read by the input stream to the output stream, at the same offsets in the same blocks of the chains:
+ * the chunks and the blocks which the input seals before they are full end at the same place in the output, so that
+ * the output can serve as a copy of a mirrored file. Returns false if the device is full.
+ */
+bool rfs_stream_copy(Stream* input, Stream* output) {
+	FileSystem* fs = input->fs;
+	uint8_t buffer[CHECKSUM_CHUNK_SIZE];
+	uint32_t input_block = input->read_address / fs->block_size;
+
+	while(true) {
+		int32_t length = rfs_access_memory(fs, &input->read_address, sizeof(buffer), READ);
+
+		if(length <= 0) {
+			return true;
+		}
+
+		uint32_t block_id = input->read_address / fs->block_size;
+		uint32_t output_block = (output->write_address - 1) / fs->block_size;
+
+		if(block_id != input_block) {
+			// The input continues in a new block: so does the output, even if its block is not full
+			rfs_stream_seal_chunk(output);
+
+			if(output->write_address != (output_block + 1) * fs->block_size) {
+				rfs_block_record_end(fs, output->file, true);
+				output->write_address = (output_block + 1) * fs->block_size;
+			}
+
+			input_block = block_id;
+		} else if(output->write_address < output_block * fs->block_size + input->read_address % fs->block_size) {
+			// The input skips the end of a chunk which was sealed before it was full
+			rfs_stream_seal_chunk(output);
+			output->write_address = output_block * fs->block_size + input->read_address % fs->block_size;
+		}
+
+		if(rfs_chunk_type(input->type)) {
+			length = rfs_stream_read_chunk(input, buffer, length);
+		} else {
+			rfs_device_read(fs, input->read_address, buffer, length);
+			input->read_address += length;
+		}
+
+		if(length == 0) {
+			continue; // End of a chunk skipped
+		}
+
+		rfs_stream_write_chain(output, buffer, length);
+
+		if(output->eof) {
+			return false;
+		}
+	}
+}
+
+
+
+/* COMPRESSED IO FUNCTIONS */
+
+/*
+ * Frames are decoded when the stream enters them and are then served from the chunk buffer.
+ * At the end of the file, FOLLOW streams copy the pending frame of the writer instead and skip its bytes once it is stored.
+ */
+static int32_t rfs_stream_read_frames(Stream* stream, uint8_t* buffer, uint32_t length) {
+	Stream* writer = stream->following ? stream->file->writer : 0;
+	uint32_t index = 0;
+
+	while(index < length) {
+		if(stream->compressed.read_frame_offset == stream->compressed.read_frame_length) {
+			if(rfs_stream_load_frame(stream)) {
+				stream->compressed.read_frame_offset = stream->follow_skip < stream->compressed.read_frame_length ? stream->follow_skip : stream->compressed.read_frame_length;
+				stream->follow_skip = 0;
+			} else if(writer && writer->compressed.write_frame_length > stream->follow_skip) {
+				memcpy(stream->compressed.read_frame, writer->compressed.write_frame, writer->compressed.write_frame_length);
+
+				stream->compressed.read_frame_offset = stream->follow_skip;
+				stream->compressed.read_frame_length = writer->compressed.write_frame_length;
+				stream->follow_skip = writer->compressed.write_frame_length;
+			} else {
+				stream->eof = true;
+				return index;
+			}
+
+			continue;
+		}
+
+		uint32_t frame_length = stream->compressed.read_frame_length - stream->compressed.read_frame_offset;
+
+		if(frame_length > length - index) {
+			frame_length = length - index;
+		}
+
+		memcpy(buffer + index, stream->compressed.read_frame + stream->compressed.read_frame_offset, frame_length);
+
+		stream->compressed.read_frame_offset += frame_length;
+		index += frame_length;
+	}
+
+	stream->eof = false;
+
+	return length;
+}
+
+/*
+ * Decodes the next frame into the chunk buffer. Returns false at the end of the file.
+ */
+static bool rfs_stream_load_frame(Stream* stream) {
+	FileSystem* fs = stream->fs;
+	uint8_t frame[CODEC_FRAME_MAX];
+
+	while(true) {
+		int32_t readable_length = rfs_access_memory(fs, &stream->read_address, CODEC_FRAME_MAX, READ);
+
+		if(readable_length <= 0) {
+			return false;
+		}
+
+		uint32_t block_id = stream->read_address / fs->block_size;
+
+		if(block_id != stream->compressed.read_block) {
+			memset(stream->compressed.read_history, 0, sizeof(stream->compressed.read_history)); // Each block is decoded on its own
+			stream->compressed.read_block = block_id;
+		}
+
+		rfs_device_read(fs, stream->read_address, frame, readable_length);
+
+		if(frame[0] == CODEC_PADDING) {
+			// Nothing more in this chunk: the stream was closed or the next frame did not fit in the block
+			stream->read_address += STREAM_CHUNK_SIZE - stream->read_address % STREAM_CHUNK_SIZE;
+			continue;
+		}
+
+		uint32_t decoded_length;
+		int32_t frame_length = rfs_codec_decode(stream->compressed.read_history, frame, readable_length, stream->compressed.read_frame, &decoded_length);
+
+		if(frame_length < 0) {
+			fs->log("Warning: Corrupted frame");
+			stream->corrupted_chunks++;
+			stream->read_address = (block_id + 1) * fs->block_size; // Resume with the next block
+			continue;
+		}
+
+		stream->read_address += frame_length;
+		stream->compressed.read_frame_length = decoded_length;
+		stream->compressed.read_frame_offset = 0;
+
+		if(decoded_length) {
+			return true;
+		}
+	}
+}
+
+static void rfs_stream_write_frames(Stream* stream, uint8_t* buffer, uint32_t length) {
+	uint32_t index = 0;
+
+	stream->eof = false;
+
+	while(index < length && !stream->eof) {
+		uint32_t frame_length = STREAM_CHUNK_SIZE - stream->compressed.write_frame_length;
+
+		if(frame_length > length - index) {
+			frame_length = length - index;
+		}
+
+		memcpy(stream->compressed.write_frame + stream->compressed.write_frame_length, buffer + index, frame_length);
+
+		stream->compressed.write_frame_length += frame_length;
+		index += frame_length;
+
+		if(stream->compressed.write_frame_length == STREAM_CHUNK_SIZE) {
+			rfs_stream_store_frame(stream);
+		}
+	}
+}
+
+/*
+ * Encodes the pending bytes and programs the frame. A frame never crosses a block boundary:
+ * if it does not fit in the current block, it is encoded again without history at the beginning of the next block.
+ */
+static void rfs_stream_store_frame(Stream* stream) {
+	FileSystem* fs = stream->fs;
+	uint8_t frame[CODEC_FRAME_MAX];
+	uint32_t internal_address = 1 + (stream->write_address - 1) % fs->block_size;
+	uint32_t frame_length = rfs_codec_encode(stream->compressed.write_history, stream->compressed.write_frame, stream->compressed.write_frame_length, frame);
+
+	if(internal_address + frame_length > fs->block_size) {
+		memset(stream->compressed.write_history, 0, sizeof(stream->compressed.write_history));
+
+		stream->write_address += fs->block_size - internal_address;
+		frame_length = rfs_codec_encode(stream->compressed.write_history, stream->compressed.write_frame, stream->compressed.write_frame_length, frame);
+	}
+
+	stream->compressed.write_frame_length = 0;
+
+	if(rfs_access_memory(fs, &stream->write_address, frame_length, WRITE) < (int32_t) frame_length) {
+		stream->eof = true; // Device full
+		return;
+	}
+
+	rfs_device_write(fs, stream->write_address, frame, frame_length);
+	stream->write_address += frame_length;
+}
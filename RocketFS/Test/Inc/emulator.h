@@ -10,6 +10,7 @@
 
 
 #include <stdint.h>
+#include <stdbool.h>
 
 /*
  * Export emulator functions and constants only in development mode
@@ -17,13 +18,18 @@
 #ifdef DEBUG
 
 
+#ifndef FS_ADDRESSABLE_SPACE
 #define FS_ADDRESSABLE_SPACE (1 << 24) // 16MB 24
+#endif
 #define FS_SECTOR_SIZE       (1 << 19) // 512KB 19
 #define FS_SUBSECTOR_SIZE    (1 << 12) // 4KB 12
 
 
+#define EMU_DEVICES 4 // Number of independent emulated devices
+
+
 /*
- * Emulator functions
+ * Emulator functions (device 0)
  */
 void emu_init();
 void emu_deinit();
@@ -31,8 +37,42 @@ void emu_read(uint32_t address, uint8_t* buffer, uint32_t length);
 void emu_write(uint32_t address, uint8_t* buffer, uint32_t length);
 void emu_erase_subsector(uint32_t address);
 void emu_erase_sector(uint32_t address);
+const uint8_t* emu_map(uint32_t address);
 void emu_dump(uint32_t block);
 
+/*
+ * Operation counters (all devices)
+ */
+typedef struct EmuStats {
+	uint32_t reads;
+	uint32_t programs;
+	uint32_t erases;
+	uint64_t programmed_bytes;
+	uint32_t violations; // NAND programs which are not whole pages, or exceed the partial programs of a page
+} EmuStats;
+
+void emu_stats(uint8_t device, EmuStats* stats);
+
+/*
+ * NAND emulation: programs must be whole pages, each programmed partial_programs times at most between two erases.
+ * The erase of a bad block fails and leaves its content. The blocks marked bad by the manufacturer report their marker.
+ */
+void emu_nand(uint8_t device, uint32_t page_size, uint8_t partial_programs); // page_size: 0 for NOR
+void emu_nand_bad_block(uint8_t device, uint32_t address, bool factory);
+
+/*
+ * Callback sets of all emulated devices (e.g. for striping tests)
+ */
+typedef struct EmuDevice {
+	void (*read)(uint32_t address, uint8_t* buffer, uint32_t length);
+	void (*write)(uint32_t address, uint8_t* buffer, uint32_t length);
+	void (*erase_subsector)(uint32_t address);
+	bool (*bad_block)(uint32_t address);
+	bool (*failed)();
+} EmuDevice;
+
+extern const EmuDevice emu_devices[EMU_DEVICES];
+
 #endif
 
 
@@ -35,10 +35,112 @@ static void __memand(uint8_t* destination, uint8_t* source, uint32_t length) {
 
 
 /*
- * Memory pointer
+ * Memory pointers
  */
 
-static uint8_t* __emu_memory;
+static uint8_t* __emu_memory[EMU_DEVICES];
+
+/*
+ * NAND state
+ */
+#define EMU_GOOD_BLOCK    0
+#define EMU_GROWN_BLOCK   1
+#define EMU_FACTORY_BLOCK 2
+
+static uint32_t __emu_page_size[EMU_DEVICES];
+static uint8_t __emu_partial_programs[EMU_DEVICES];
+static uint8_t* __emu_page_programs[EMU_DEVICES]; // Programs of each page since its last erase
+static uint8_t __emu_bad_blocks[EMU_DEVICES][FS_ADDRESSABLE_SPACE / FS_SUBSECTOR_SIZE];
+static bool __emu_failed[EMU_DEVICES]; // Status of the last program or erase
+
+static EmuStats __emu_stats[EMU_DEVICES];
+
+/*
+ * Device-specific implementation
+ */
+static void __emu_read(uint8_t device, uint32_t address, uint8_t* buffer, uint32_t length) {
+	if(address + length >= FS_ADDRESSABLE_SPACE) {
+		__emu_fatal("Memory access attempt out of addressable space (emu_read)\n");
+	}
+
+	memcpy(buffer, __emu_memory[device] + address, length);
+	__emu_stats[device].reads++;
+}
+
+static void __emu_write(uint8_t device, uint32_t address, uint8_t* buffer, uint32_t length) {
+	if(address + length >= FS_ADDRESSABLE_SPACE) {
+		__emu_fatal("Memory access attempt out of addressable space (emu_write)\n");
+	}
+
+	uint32_t page_size = __emu_page_size[device];
+
+	if(page_size) {
+		if(address % page_size || length % page_size) {
+			__emu_stats[device].violations++; // Not whole pages
+		}
+
+		for(uint32_t page = address / page_size; length && page <= (address + length - 1) / page_size; page++) {
+			if(++__emu_page_programs[device][page] > __emu_partial_programs[device]) {
+				__emu_stats[device].violations++;
+			}
+		}
+	}
+
+	__memand(__emu_memory[device] + address, buffer, length);
+	__emu_failed[device] = __emu_bad_blocks[device][address / FS_SUBSECTOR_SIZE] != EMU_GOOD_BLOCK;
+	__emu_stats[device].programs++;
+	__emu_stats[device].programmed_bytes += length;
+}
+
+static void __emu_erase_subsector(uint8_t device, uint32_t address) {
+	if(address >= FS_ADDRESSABLE_SPACE) {
+		__emu_fatal("Memory access attempt out of addressable space (emu_erase_subsector)\n");
+	}
+
+	uint32_t block = address / FS_SUBSECTOR_SIZE;
+
+	__emu_failed[device] = __emu_bad_blocks[device][block] != EMU_GOOD_BLOCK;
+	__emu_stats[device].erases++;
+
+	if(__emu_failed[device]) {
+		return; // Worn out: the content is left as it is
+	}
+
+	memset(__emu_memory[device] + block * FS_SUBSECTOR_SIZE, 0xFF, FS_SUBSECTOR_SIZE);
+
+	if(__emu_page_size[device]) {
+		memset(__emu_page_programs[device] + block * (FS_SUBSECTOR_SIZE / __emu_page_size[device]), 0, FS_SUBSECTOR_SIZE / __emu_page_size[device]);
+	}
+}
+
+static bool __emu_bad_block(uint8_t device, uint32_t address) {
+	return __emu_bad_blocks[device][address / FS_SUBSECTOR_SIZE] == EMU_FACTORY_BLOCK;
+}
+
+#define EMU_DEVICE_CALLBACKS(n) \
+	static void __emu_read_##n(uint32_t address, uint8_t* buffer, uint32_t length) { __emu_read(n, address, buffer, length); } \
+	static void __emu_write_##n(uint32_t address, uint8_t* buffer, uint32_t length) { __emu_write(n, address, buffer, length); } \
+	static void __emu_erase_subsector_##n(uint32_t address) { __emu_erase_subsector(n, address); }
+
+#define EMU_NAND_CALLBACKS(n) \
+	static bool __emu_bad_block_##n(uint32_t address) { return __emu_bad_block(n, address); } \
+	static bool __emu_failed_##n() { return __emu_failed[n]; }
+
+EMU_DEVICE_CALLBACKS(1)
+EMU_DEVICE_CALLBACKS(2)
+EMU_DEVICE_CALLBACKS(3)
+
+EMU_NAND_CALLBACKS(0)
+EMU_NAND_CALLBACKS(1)
+EMU_NAND_CALLBACKS(2)
+EMU_NAND_CALLBACKS(3)
+
+const EmuDevice emu_devices[EMU_DEVICES] = {
+	{ &emu_read, &emu_write, &emu_erase_subsector, &__emu_bad_block_0, &__emu_failed_0 },
+	{ &__emu_read_1, &__emu_write_1, &__emu_erase_subsector_1, &__emu_bad_block_1, &__emu_failed_1 },
+	{ &__emu_read_2, &__emu_write_2, &__emu_erase_subsector_2, &__emu_bad_block_2, &__emu_failed_2 },
+	{ &__emu_read_3, &__emu_write_3, &__emu_erase_subsector_3, &__emu_bad_block_3, &__emu_failed_3 }
+};
 
 /*
  * Implementation
@@ -46,56 +148,86 @@ static uint8_t* __emu_memory;
 void emu_init() {
 	printf("Initialising memory emulator... ");
 
-	__emu_memory = (uint8_t*) malloc(sizeof(uint8_t) * FS_ADDRESSABLE_SPACE);
+	for(uint8_t device = 0; device < EMU_DEVICES; device++) {
+		__emu_memory[device] = (uint8_t*) malloc(sizeof(uint8_t) * FS_ADDRESSABLE_SPACE);
 
-	/*FILE* file = fopen("FLASH.DMP", "rb");
-	fread(__emu_memory, 1, FS_ADDRESSABLE_SPACE, file);*/
+		if(!__emu_memory[device]) {
+			__emu_fatal("Unable to allocate memory for the emulator");
+		}
 
-	for(uint32_t i = 0; i < FS_ADDRESSABLE_SPACE; i++) {
-		__emu_memory[i] = i % 256;
-	}
+		/*FILE* file = fopen("FLASH.DMP", "rb");
+		fread(__emu_memory[device], 1, FS_ADDRESSABLE_SPACE, file);*/
 
-	if(!__emu_memory) {
-		__emu_fatal("Unable to allocate memory for the emulator");
+		for(uint32_t i = 0; i < FS_ADDRESSABLE_SPACE; i++) {
+			__emu_memory[device][i] = i % 256;
+		}
 	}
 
 	printf("done\n");
 }
 
 void emu_deinit() {
-	free(__emu_memory);
+	for(uint8_t device = 0; device < EMU_DEVICES; device++) {
+		free(__emu_memory[device]);
+		free(__emu_page_programs[device]);
+		__emu_page_programs[device] = 0;
+	}
 }
 
 void emu_read(uint32_t address, uint8_t* buffer, uint32_t length) {
-	if(address + length >= FS_ADDRESSABLE_SPACE) {
-		__emu_fatal("Memory access attempt out of addressable space (emu_read)\n");
-	}
-
-	memcpy(buffer, __emu_memory + address, length);
+	__emu_read(0, address, buffer, length);
 }
 
 void emu_write(uint32_t address, uint8_t* buffer, uint32_t length) {
-	if(address + length >= FS_ADDRESSABLE_SPACE) {
-		__emu_fatal("Memory access attempt out of addressable space (emu_write)\n");
+	__emu_write(0, address, buffer, length);
+}
+
+void emu_erase_subsector(uint32_t address) {
+	__emu_erase_subsector(0, address);
+}
+
+void emu_erase_sector(uint32_t address) {
+	if(address >= FS_ADDRESSABLE_SPACE) {
+		__emu_fatal("Memory access attempt out of addressable space (emu_erase_sector)\n");
 	}
 
-	__memand(__emu_memory + address, buffer, length);
+	memset(__emu_memory[0] + address - address % FS_SECTOR_SIZE, 0xFF, FS_SECTOR_SIZE);
 }
 
-void emu_erase_subsector(uint32_t address) {
+const uint8_t* emu_map(uint32_t address) {
 	if(address >= FS_ADDRESSABLE_SPACE) {
-		__emu_fatal("Memory access attempt out of addressable space (emu_erase_subsector)\n");
+		__emu_fatal("Memory access attempt out of addressable space (emu_map)\n");
 	}
 
-	memset(__emu_memory + address - address % FS_SUBSECTOR_SIZE, 0xFF, FS_SUBSECTOR_SIZE);
+	return __emu_memory[0] + address;
 }
 
-void emu_erase_sector(uint32_t address) {
+void emu_stats(uint8_t device, EmuStats* stats) {
+	*stats = __emu_stats[device];
+}
+
+void emu_nand(uint8_t device, uint32_t page_size, uint8_t partial_programs) {
+	free(__emu_page_programs[device]);
+	__emu_page_programs[device] = 0;
+
+	if(page_size) {
+		__emu_page_programs[device] = (uint8_t*) calloc(FS_ADDRESSABLE_SPACE / page_size, sizeof(uint8_t));
+
+		if(!__emu_page_programs[device]) {
+			__emu_fatal("Unable to allocate memory for the emulator");
+		}
+	}
+
+	__emu_page_size[device] = page_size;
+	__emu_partial_programs[device] = partial_programs;
+}
+
+void emu_nand_bad_block(uint8_t device, uint32_t address, bool factory) {
 	if(address >= FS_ADDRESSABLE_SPACE) {
-		__emu_fatal("Memory access attempt out of addressable space (emu_erase_sector)\n");
+		__emu_fatal("Memory access attempt out of addressable space (emu_nand_bad_block)\n");
 	}
 
-	memset(__emu_memory + address - address % FS_SECTOR_SIZE, 0xFF, FS_SECTOR_SIZE);
+	__emu_bad_blocks[device][address / FS_SUBSECTOR_SIZE] = factory ? EMU_FACTORY_BLOCK : EMU_GROWN_BLOCK;
 }
 
 void emu_dump(uint32_t block) {
@@ -103,7 +235,7 @@ void emu_dump(uint32_t block) {
 
 	for(uint16_t i = 0; i < FS_SUBSECTOR_SIZE; i++) {
 		uint16_t j = block * FS_SUBSECTOR_SIZE + i;
-		printf("%d: %d\n", j, __emu_memory[j]);
+		printf("%d: %d\n", j, __emu_memory[0][j]);
 	}
 }
 
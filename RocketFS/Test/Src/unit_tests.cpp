@@ -9,7 +9,10 @@
 
 #define TEST_SIZE 819281
 
+#include "block_management.h"
+#include "device.h"
 #include "emulator.h"
+#include "partition.h"
 #include "rocket_fs.h"
 
 #include <stdio.h>
@@ -70,6 +73,146 @@ void stream_garbage(FileSystem* fs, const char* name, uint8_t generator) {
  	stream.close();
  }
 
+ #ifdef __cpp_impl_coroutine
+/*
+ * Asynchronous devices in virtual time: an operation issued to a busy device waits for it, as a blocking driver would.
+ */
+static uint64_t async_clock;
+static uint64_t async_busy_until[EMU_DEVICES];
+static uint64_t async_erase_until[EMU_DEVICES]; // End of the last erase
+static uint32_t async_erase_address[EMU_DEVICES];
+static uint64_t async_erase_left[EMU_DEVICES];  // Remaining time of the suspended erase (0 if none)
+
+static void async_check(uint8_t device, uint32_t address) {
+	if(async_erase_left[device] && address / FS_SUBSECTOR_SIZE == async_erase_address[device] / FS_SUBSECTOR_SIZE) {
+		printf("Access to a block whose erase is suspended mismatch\n");
+	}
+}
+
+static void async_start(uint8_t device, uint64_t duration) {
+	if(async_clock < async_busy_until[device]) {
+		async_clock = async_busy_until[device]; // The whole thread is stalled
+	}
+
+	async_busy_until[device] = async_clock + duration;
+}
+
+template<uint8_t device> static void async_read(uint32_t address, uint8_t* buffer, uint32_t length) {
+	async_check(device, address);
+	async_start(device, 0);
+	emu_devices[device].read(address, buffer, length);
+}
+
+template<uint8_t device> static void async_write(uint32_t address, uint8_t* buffer, uint32_t length) {
+	async_check(device, address);
+	async_start(device, 1 + length / 256); // Page programs
+	emu_devices[device].write(address, buffer, length);
+}
+
+template<uint8_t device> static void async_erase(uint32_t address) {
+	if(async_erase_left[device]) {
+		printf("Erase while another one is suspended mismatch\n");
+	}
+
+	async_start(device, 200);
+	async_erase_until[device] = async_busy_until[device];
+	async_erase_address[device] = address;
+	emu_devices[device].erase_subsector(address);
+}
+
+template<uint8_t device> static bool async_suspend() {
+	if(async_erase_left[device] || async_clock >= async_erase_until[device]) {
+		return false; // No erase in progress
+	}
+
+	async_erase_left[device] = async_erase_until[device] - async_clock;
+	async_busy_until[device] = async_clock;
+
+	return true;
+}
+
+template<uint8_t device> static void async_resume() {
+	if(!async_erase_left[device]) {
+		printf("Resume without a suspended erase mismatch\n");
+	}
+
+	async_start(device, async_erase_left[device] + 5); // The device needs some time to resume
+	async_erase_until[device] = async_busy_until[device];
+	async_erase_left[device] = 0;
+}
+
+template<uint8_t device> static bool async_busy() {
+	return async_clock < async_busy_until[device];
+}
+
+static void async_idle() {
+	uint64_t next_event = ~0ULL;
+
+	for(uint8_t device = 0; device < EMU_DEVICES; device++) {
+		if(async_busy_until[device] > async_clock && async_busy_until[device] < next_event) {
+			next_event = async_busy_until[device];
+		}
+	}
+
+	async_clock = next_event != ~0ULL ? next_event : async_clock;
+}
+
+static AsyncTask async_writer(Stream* stream, uint8_t* data, uint32_t length) {
+	int32_t written_length = co_await rocket_fs_co_write(stream, data, length);
+
+	if(written_length != (int32_t) length) {
+		printf("Coroutine write length mismatch\n");
+	}
+
+	co_await rocket_fs_co_flush(stream->fs);
+}
+
+static AsyncTask async_reader(Stream* stream, uint8_t* data, uint8_t* readback, uint32_t length) {
+	int32_t read_length = co_await rocket_fs_co_read(stream, readback, length + 1); // Up to the end of the file
+
+	if(read_length != (int32_t) length || memcmp(data, readback, length)) {
+		printf("Coroutine read mismatch\n");
+	}
+}
+
+static uint32_t async_ticks() {
+	return async_clock;
+}
+
+/*
+ * Critical records of a flight computer, paced by the writes to another filesystem.
+ */
+static AsyncTask async_recorder(Stream* records, Stream* pace, uint8_t* data, uint32_t count) {
+	for(uint32_t i = 0; i < count; i++) {
+		int32_t paced_length = co_await rocket_fs_co_write(pace, data, 1024);
+		int32_t record_length = co_await rocket_fs_co_write(records, data + i * 32, 32);
+
+		if(paced_length != 1024 || record_length != 32) {
+			printf("Critical write length mismatch\n");
+		}
+
+		co_await rocket_fs_co_flush(records->fs);
+	}
+}
+
+/*
+ * Reads the critical records back while the bulk stream is written, paced by the writes to another filesystem.
+ */
+static AsyncTask async_monitor(Stream* records, Stream* pace, uint8_t* data, uint8_t* readback, uint32_t count, uint64_t* worst) {
+	for(uint32_t i = 0; i < count; i++) {
+		int32_t paced_length = co_await rocket_fs_co_write(pace, data, 1024);
+		uint64_t start_time = async_clock;
+		int32_t record_length = co_await rocket_fs_co_read(records, readback + i * 32, 32);
+
+		if(paced_length != 1024 || record_length != 32 || memcmp(data + i * 32, readback + i * 32, 32)) {
+			printf("Monitored read mismatch\n");
+		}
+
+		*worst = async_clock - start_time > *worst ? async_clock - start_time : *worst;
+	}
+}
+#endif
+
  void wr(uint32_t address, uint8_t* buffer, uint32_t length) {
  	printf("Write at %d with length %d with %c\n", address, length, *buffer);
  	emu_write(address, buffer, length);
@@ -83,7 +226,7 @@ void stream_garbage(FileSystem* fs, const char* name, uint8_t generator) {
 
  	rocket_fs_debug(&fs, &debug);
  	rocket_fs_device(&fs, "emulator", FS_ADDRESSABLE_SPACE, FS_SUBSECTOR_SIZE);
- 	rocket_fs_bind(&fs, &emu_read, &emu_write, &emu_erase_subsector);
+ 	rocket_fs_bind(&fs, &emu_read, &emu_write, &emu_erase_subsector, &emu_map);
  	rocket_fs_mount(&fs);
 
 
@@ -92,11 +235,28 @@ void stream_garbage(FileSystem* fs, const char* name, uint8_t generator) {
 	printf("===== Testing append mode =====\n");
 	stream_garbage(&fs, "file1", 1);
 	validate_garbage(&fs, "file1");
+	uint32_t length_before_append = file1->length;
 	rocket_fs_stream(&stream, &fs, file1, APPEND);
 	stream.write8(42);
 	stream.write((uint8_t*) "THIS TEXT FRAGMENT SHOULD BE APPENDED.", 38);
 	stream.close();
 
+	uint8_t appended[39];
+	uint32_t read_length = 0;
+	rocket_fs_stream(&stream, &fs, file1, OVERWRITE);
+
+	while(stream.read(appended + read_length % 39, 1) == 1) {
+		read_length++;
+	}
+
+	stream.close();
+
+	if(file1->length != length_before_append + 39 || read_length != file1->length) {
+		printf("Append length mismatch: %u bytes read, %u bytes expected\n", read_length, length_before_append + 39);
+	} else if(appended[read_length % 39] != 42 || appended[(read_length + 1) % 39] != 'T' || appended[(read_length + 38) % 39] != '.') {
+		printf("Append content mismatch\n");
+	}
+
 	printf("===== Testing concurrent streams =====\n");
 	rocket_fs_stream(&stream, &fs, file1, OVERWRITE);
 	fs.partition_table_modified = true;
@@ -129,11 +289,1080 @@ void stream_garbage(FileSystem* fs, const char* name, uint8_t generator) {
 	validate_garbage(&fs, "file1");
 	validate_garbage(&fs, "file2");
 
+	printf("===== Testing exact tails =====\n");
+	File* tail_file = rocket_fs_newfile(&fs, "tail", RAW);
+	uint8_t tail_data[64];
+	uint8_t tail_read[64];
+	uint32_t tail_length = 0;
+
+	for(uint8_t round = 0; round < 7; round++) { // Enough closes to seal the block
+		rocket_fs_stream(&stream, &fs, tail_file, round ? APPEND : OVERWRITE);
+
+		for(uint8_t i = 0; i < (round ? 3 : 10); i++) {
+			tail_data[tail_length] = i == 0 ? round : 0xFF; // The data always ends with 0xFF
+			stream.write8(tail_data[tail_length++]);
+		}
+
+		stream.close();
+		rocket_fs_unmount(&fs);
+		rocket_fs_mount(&fs);
+
+		rocket_fs_stream(&stream, &fs, tail_file, OVERWRITE);
+		int32_t tail_read_length = stream.read(tail_read, sizeof(tail_read));
+		stream.close();
+
+		if(tail_file->length != tail_length || tail_read_length != (int32_t) tail_length || memcmp(tail_read, tail_data, tail_length)) {
+			printf("Exact tail mismatch: %u bytes read, %u bytes stored, %u bytes expected\n", tail_read_length, tail_file->length, tail_length);
+		}
+	}
+
+	if(tail_file->used_blocks != 2) {
+		printf("Exact tail mismatch: %u blocks used instead of 2 after the tail log was full\n", tail_file->used_blocks);
+	}
+
+	rocket_fs_delfile(&fs, tail_file);
+
+	printf("===== Testing lazy mount =====\n");
+	uint32_t eager_lengths[] = { file1->length, file2->length };
+	rocket_fs_unmount(&fs);
+	rocket_fs_mount(&fs, true);
+
+	if(file1->resolved || file2->resolved || file2->used_blocks) {
+		printf("Lazy mount mismatch: chain resolved at mount\n");
+	}
+
+	if(rocket_fs_getfile(&fs, "file2") != file2 || !file2->resolved || file2->length != eager_lengths[1] || file1->resolved) {
+		printf("Lazy mount mismatch: chain not resolved on access\n");
+	}
+
+	while(rocket_fs_resolve(&fs));
+
+	if(!file1->resolved || file1->length != eager_lengths[0]) {
+		printf("Lazy mount mismatch: chain not resolved in the background\n");
+	}
+
 	printf("===== Testing file deletion =====\n");
 	rocket_fs_delfile(&fs, file1);
 	validate_garbage(&fs, "file2");
 	rocket_fs_delfile(&fs, file2);
 
+	printf("===== Testing checksums =====\n");
+	FileType chunked_types[] = { CHECKSUM, ECC, LOW_REDUNDANCE, HIGH_REDUNDANCE };
+	uint32_t chunked_writes[] = { 10, 300, 7 }; // Each write ends with 0xFF and is followed by a remount
+	static uint8_t chunked_data[317];
+	static uint8_t chunked_read[sizeof(chunked_data) + 64];
+
+	for(FileType type : chunked_types) {
+		File* chunked_file = rocket_fs_newfile(&fs, "chunked", type);
+		uint32_t chunked_length = 0;
+
+		for(uint8_t i = 0; i < 3; i++) {
+			rocket_fs_stream(&stream, &fs, chunked_file, i ? APPEND : OVERWRITE);
+
+			for(uint32_t j = 0; j < chunked_writes[i]; j++, chunked_length++) {
+				chunked_data[chunked_length] = j + 1 == chunked_writes[i] ? 0xFF : chunked_length * 29 + 3;
+			}
+
+			stream.write(chunked_data + chunked_length - chunked_writes[i], chunked_writes[i]);
+			stream.close();
+
+			uint32_t mounted_length = chunked_file->length;
+			rocket_fs_unmount(&fs);
+			rocket_fs_mount(&fs);
+			chunked_file = rocket_fs_getfile(&fs, "chunked");
+
+			rocket_fs_stream(&stream, &fs, chunked_file, OVERWRITE);
+			int32_t read_length = stream.read(chunked_read, sizeof(chunked_read));
+			stream.close();
+
+			if(chunked_file->length != mounted_length || read_length != (int32_t) chunked_length || memcmp(chunked_read, chunked_data, chunked_length)) {
+				printf("Chunked round trip mismatch (type %u): %d bytes read, %u bytes expected, length %u after remount, %u before\n", type, read_length,
+						chunked_length, chunked_file->length, mounted_length);
+			}
+		}
+
+		if(rocket_fs_verify(&fs, chunked_file) != 0) {
+			printf("Checksum mismatch in a sealed file (type %u)\n", type);
+		}
+
+		rocket_fs_delfile(&fs, chunked_file);
+	}
+
+	File* checked_file = rocket_fs_newfile(&fs, "checked", CHECKSUM);
+	stream_garbage(&fs, "checked", 7);
+	validate_garbage(&fs, "checked");
+
+	if(rocket_fs_verify(&fs, checked_file) != 0) {
+		printf("Checksum mismatch in a healthy file\n");
+	}
+
+	uint8_t bit_flip = 0xFE; // Flips a bit of the filename, which is covered by the first chunk
+	emu_write(checked_file->first_block * FS_SUBSECTOR_SIZE + BLOCK_HEADER_SIZE, &bit_flip, 1);
+
+	if(rocket_fs_verify(&fs, checked_file) != 1) {
+		printf("Corrupted chunk not detected\n");
+	}
+
+	rocket_fs_delfile(&fs, checked_file);
+
+	printf("===== Testing checksum overhead =====\n");
+	static uint8_t overhead_data[4096];
+	EmuStats overhead_stats[2];
+
+	for(uint32_t i = 0; i < sizeof(overhead_data); i++) {
+		overhead_data[i] = i * 37 + (i >> 9);
+	}
+
+	for(uint8_t i = 0; i < 2; i++) {
+		File* overhead_file = rocket_fs_newfile(&fs, "overhead", i ? CHECKSUM : RAW);
+		EmuStats before;
+
+		emu_stats(0, &before);
+		rocket_fs_stream(&stream, &fs, overhead_file, OVERWRITE);
+
+		for(uint32_t j = 0; j < 256; j++) { // 1MB
+			stream.write(overhead_data, sizeof(overhead_data));
+		}
+
+		stream.close();
+		emu_stats(0, &overhead_stats[i]);
+		overhead_stats[i].programs -= before.programs;
+		overhead_stats[i].programmed_bytes -= before.programmed_bytes;
+
+		rocket_fs_delfile(&fs, overhead_file);
+	}
+
+	printf("RAW: %u device writes, %llu bytes / CHECKSUM: %u device writes, %llu bytes\n", overhead_stats[0].programs, (unsigned long long) overhead_stats[0].programmed_bytes,
+			overhead_stats[1].programs, (unsigned long long) overhead_stats[1].programmed_bytes);
+
+	if(overhead_stats[1].programmed_bytes * 100 > overhead_stats[0].programmed_bytes * 105) {
+		printf("Checksum overhead mismatch: more than 5%% of the programmed bytes\n");
+	}
+
+	printf("===== Testing error correction =====\n");
+	File* corrected_file = rocket_fs_newfile(&fs, "corrected", ECC);
+	stream_garbage(&fs, "corrected", 11);
+
+	uint8_t bit_flips[2] = { 0x00, 0x00 }; // Corrupts two bytes of the filename
+	emu_write(corrected_file->first_block * FS_SUBSECTOR_SIZE + BLOCK_HEADER_SIZE + 1, bit_flips, 2);
+
+	if(rocket_fs_verify(&fs, corrected_file) != 0) {
+		printf("Correctable chunk reported as corrupted\n");
+	}
+
+	rocket_fs_stream(&stream, &fs, corrected_file, OVERWRITE);
+	stream.read8();
+
+	if(stream.corrected_bytes != 2) {
+		printf("Corrupted bytes not corrected\n");
+	}
+
+	stream.close();
+	validate_garbage(&fs, "corrected");
+	rocket_fs_delfile(&fs, corrected_file);
+
+	printf("===== Testing mirrored files =====\n");
+	File* mirrored_file = rocket_fs_newfile(&fs, "mirrored", LOW_REDUNDANCE);
+	stream_garbage(&fs, "mirrored", 13);
+	emu_write(mirrored_file->first_block * FS_SUBSECTOR_SIZE + BLOCK_HEADER_SIZE, &bit_flip, 1); // Only the original copy is corrupted
+
+	rocket_fs_stream(&stream, &fs, mirrored_file, OVERWRITE);
+	stream.read8();
+
+	if(stream.corrupted_chunks != 0 || !(mirrored_file->degraded & 0b1)) {
+		printf("Corrupted chunk not read from the replica\n");
+	}
+
+	stream.close();
+	validate_garbage(&fs, "mirrored");
+
+	if(!rocket_fs_repair(&fs, mirrored_file) || rocket_fs_verify(&fs, (mirrored_file = rocket_fs_getfile(&fs, "mirrored"))) != 0) {
+		printf("Mirrored file not repaired\n");
+	}
+
+	rocket_fs_unmount(&fs);
+	rocket_fs_mount(&fs);
+	mirrored_file = rocket_fs_getfile(&fs, "mirrored");
+
+	if(mirrored_file->replica_count != 1) {
+		printf("Replica not resolved at mount\n");
+	}
+
+	validate_garbage(&fs, "mirrored");
+	rocket_fs_delfile(&fs, mirrored_file);
+
+	// The chunks sealed early by the round trip data are laid out alike in the rebuilt chain and in its replica
+	mirrored_file = rocket_fs_newfile(&fs, "mirrored", LOW_REDUNDANCE);
+
+	for(uint32_t i = 0, offset = 0; i < 3; offset += chunked_writes[i++]) {
+		rocket_fs_stream(&stream, &fs, mirrored_file, i ? APPEND : OVERWRITE);
+		stream.write(chunked_data + offset, chunked_writes[i]);
+		stream.close();
+	}
+
+	for(uint8_t i = 0; i < 2; i++) { // Corrupts the original, then its rebuilt chain
+		emu_write(mirrored_file->first_block * FS_SUBSECTOR_SIZE + BLOCK_HEADER_SIZE + 16 + 2 * CHECKSUM_CHUNK_SIZE, &bit_flip, 1);
+
+		if(rocket_fs_verify(&fs, mirrored_file) != 1 || !rocket_fs_repair(&fs, mirrored_file)) {
+			printf("Mirrored file not repaired\n");
+		}
+
+		mirrored_file = rocket_fs_getfile(&fs, "mirrored");
+	}
+
+	rocket_fs_unmount(&fs);
+	rocket_fs_mount(&fs);
+	mirrored_file = rocket_fs_getfile(&fs, "mirrored");
+
+	rocket_fs_stream(&stream, &fs, mirrored_file, OVERWRITE);
+	int32_t mirrored_length = stream.read(chunked_read, sizeof(chunked_read));
+	stream.close();
+
+	if(rocket_fs_verify(&fs, mirrored_file) != 0 || mirrored_length != sizeof(chunked_data) || memcmp(chunked_read, chunked_data, sizeof(chunked_data))) {
+		printf("Mirrored round trip mismatch: %d bytes read, %u bytes expected\n", mirrored_length, (uint32_t) sizeof(chunked_data));
+	}
+
+	rocket_fs_delfile(&fs, mirrored_file);
+
+	printf("===== Testing compression =====\n");
+	File* compressed_file = rocket_fs_newfile(&fs, "compressed", COMPRESSED);
+
+	for(uint32_t i = 0; i < 131072; i++) {
+		if(i % 65536 == 0) {
+			rocket_fs_stream(&stream, &fs, compressed_file, i ? APPEND : OVERWRITE);
+		}
+
+		stream.write32(i * 10); // Slowly varying samples
+		stream.write16(i % 1000);
+		stream.write16(i / 1000);
+
+		if(i % 65536 == 65535) {
+			stream.close();
+		}
+	}
+
+	printf("Compressed size: %d bytes for %d bytes\n", compressed_file->length, 131072 * 8);
+
+	if(compressed_file->length > 131072 * 8 / 4) {
+		printf("Poor compression\n");
+	}
+
+	rocket_fs_stream(&stream, &fs, compressed_file, OVERWRITE);
+
+	for(uint32_t i = 0; i < 131072; i++) {
+		if(stream.read32() != i * 10 || stream.read16() != i % 1000 || stream.read16() != i / 1000) {
+			printf("Compressed content mismatch at index %d\n", i);
+			break;
+		}
+	}
+
+	stream.close();
+	rocket_fs_delfile(&fs, compressed_file);
+
+	compressed_file = rocket_fs_newfile(&fs, "compressed", COMPRESSED);
+	uint8_t short_frame[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 0xFF };
+	uint8_t last_byte;
+
+	rocket_fs_stream(&stream, &fs, compressed_file, OVERWRITE);
+	stream.write(short_frame, sizeof(short_frame));
+	stream.close();
+
+	emu_read(compressed_file->last_block * FS_SUBSECTOR_SIZE + compressed_file->tail_offset - 1, &last_byte, 1);
+	rocket_fs_unmount(&fs);
+	rocket_fs_mount(&fs);
+	compressed_file = rocket_fs_getfile(&fs, "compressed");
+
+	rocket_fs_stream(&stream, &fs, compressed_file, OVERWRITE);
+
+	if(last_byte == 0xFF || stream.read(buffer, sizeof(buffer)) != sizeof(short_frame) || memcmp(buffer, short_frame, sizeof(short_frame))) {
+		printf("Compressed tail mismatch: the last frame ends with 0x%02X\n", last_byte);
+	}
+
+	stream.close();
+	rocket_fs_delfile(&fs, compressed_file);
+
+	printf("===== Testing time series =====\n");
+	Series series;
+	Column column;
+	uint32_t samples[12];
+	uint32_t time, value;
+
+	rocket_fs_series_create(&fs, &series, "imu", 12, COMPRESSED, true);
+
+	for(uint32_t i = 0; i < 10000; i++) {
+		if(i == 5000) { // Resume the series
+			rocket_fs_series_close(&series);
+			rocket_fs_series_open(&fs, &series, "imu");
+		}
+
+		for(uint32_t channel = 0; channel < 12; channel++) {
+			samples[channel] = i * channel;
+		}
+
+		rocket_fs_series_append(&series, 1000 + i, samples);
+	}
+
+	rocket_fs_series_close(&series);
+	rocket_fs_column_open(&fs, &column, "imu", 7);
+
+	uint32_t sample_count = 0;
+
+	while(rocket_fs_column_next(&column, &time, &value)) {
+		if(time != 1000 + sample_count || value != sample_count * 7) {
+			printf("Column content mismatch at index %d\n", sample_count);
+			break;
+		}
+
+		sample_count++;
+	}
+
+	rocket_fs_column_close(&column);
+
+	if(sample_count != 10000) {
+		printf("Column truncated to %d samples\n", sample_count);
+	}
+
+	printf("===== Testing flight summaries =====\n");
+	Summary summaries[4];
+	Summary overview = { 0, 0, 0, 0, 0 };
+
+	if(rocket_fs_summarize(&fs, "imu", 7, summaries, 4) == 4) {
+		overview = { summaries[0].first_time, summaries[3].last_time, 0, summaries[0].minimum, summaries[0].maximum };
+	}
+
+	for(uint32_t i = 0; overview.first_time && i < 4; i++) {
+		overview.sample_count += summaries[i].sample_count;
+		overview.minimum = summaries[i].minimum < overview.minimum ? summaries[i].minimum : overview.minimum;
+		overview.maximum = summaries[i].maximum > overview.maximum ? summaries[i].maximum : overview.maximum;
+	}
+
+	if(overview.first_time != 1000 || overview.last_time != 10999 || overview.sample_count != 10000 || overview.minimum != 0 || overview.maximum != 9999 * 7) {
+		printf("Summary mismatch\n");
+	}
+
+	// The columns of a series of checked files share the writer of the series, whose chunk trailers are saved in between
+	Series checked_series;
+	char column_name[16];
+
+	if(rocket_fs_series_create(&fs, &checked_series, "gyro", 3, CHECKSUM) || rocket_fs_getfile(&fs, "gyro.0")) {
+		printf("Series beyond NUM_FILES mismatch\n");
+	}
+
+	for(uint32_t i = 0; i <= 13; i++) {
+		snprintf(column_name, sizeof(column_name), i < 13 ? "imu.%u" : "imu.s", i);
+		rocket_fs_delfile(&fs, rocket_fs_getfile(&fs, column_name));
+	}
+
+	rocket_fs_series_create(&fs, &checked_series, "gyro", 3, CHECKSUM);
+
+	for(uint32_t i = 0; i < 1000; i++) {
+		for(uint32_t channel = 0; channel < 3; channel++) {
+			samples[channel] = i * (channel + 1) | 0xFF000000;
+		}
+
+		rocket_fs_series_append(&checked_series, 1000 + i, samples);
+
+		if(i % 77 == 0) {
+			rocket_fs_series_flush(&checked_series); // Shorter segments
+		}
+	}
+
+	rocket_fs_series_close(&checked_series);
+	rocket_fs_column_open(&fs, &column, "gyro", 2);
+
+	for(sample_count = 0; rocket_fs_column_next(&column, &time, &value); sample_count++) {
+		if(time != 1000 + sample_count || value != (sample_count * 3 | 0xFF000000)) {
+			printf("Checked column content mismatch at index %d\n", sample_count);
+			break;
+		}
+	}
+
+	rocket_fs_column_close(&column);
+
+	for(uint32_t i = 0; i <= 3; i++) {
+		snprintf(column_name, sizeof(column_name), "gyro.%u", i);
+
+		if(rocket_fs_verify(&fs, rocket_fs_getfile(&fs, column_name)) != 0) {
+			printf("Checked column %u verification mismatch\n", i);
+		}
+	}
+
+	if(sample_count != 1000) {
+		printf("Checked column truncated to %d samples\n", sample_count);
+	}
+
+	printf("===== Testing circular files =====\n");
+	File* circular_file = rocket_fs_newfile(&fs, "circular", CIRCULAR, 3);
+	uint32_t first_sample;
+
+	rocket_fs_stream(&stream, &fs, circular_file, APPEND);
+
+	for(uint32_t i = 0; i < 16384; i++) { // 16 blocks
+		stream.write32(i);
+	}
+
+	stream.close();
+	rocket_fs_unmount(&fs);
+	rocket_fs_mount(&fs);
+
+	circular_file = rocket_fs_getfile(&fs, "circular");
+	rocket_fs_stream(&stream, &fs, circular_file, OVERWRITE);
+	first_sample = stream.read32();
+
+	for(uint32_t i = first_sample + 1; i < 16384; i++) {
+		if(stream.read32() != i) {
+			printf("Circular content mismatch at index %d\n", i);
+			break;
+		}
+	}
+
+	stream.close();
+
+	if(circular_file->used_blocks != 1 + 3 || first_sample < 16384 - 3 * 1024) {
+		printf("Circular file not bounded by its budget\n");
+	}
+
+	rocket_fs_delfile(&fs, circular_file);
+
+	printf("===== Testing follow mode =====\n");
+	FileType followed_types[] = { RAW, CHECKSUM, COMPRESSED };
+	Stream follower;
+
+	for(FileType type : followed_types) {
+		File* log_file = rocket_fs_newfile(&fs, "downlink", type);
+		uint32_t expected_word = 0;
+		uint32_t lagging_writes = 0;
+		uint8_t word[4];
+
+		rocket_fs_stream(&stream, &fs, log_file, OVERWRITE);
+		rocket_fs_stream(&follower, &fs, log_file, FOLLOW);
+
+		for(uint32_t i = 0; i < 5000; i++) { // 5 blocks
+			stream.write32(i);
+
+			if(!rocket_fs_poll(&follower)) {
+				lagging_writes++;
+			}
+
+			while(rocket_fs_poll(&follower) && follower.read(word, 4) == 4) {
+				if((uint32_t) (word[0] | word[1] << 8 | word[2] << 16 | word[3] << 24) != expected_word++) {
+					printf("Followed content mismatch at index %d\n", expected_word - 1);
+				}
+			}
+		}
+
+		stream.close();
+
+		while(follower.read(word, 4) == 4) {
+			expected_word++; // Nothing is left to read, the erased end of the last chunk is skipped
+		}
+
+		if(expected_word != 5000 || lagging_writes) {
+			printf("Follow mismatch: %u words read, %u writes not readable right away\n", expected_word, lagging_writes);
+		}
+
+		follower.close();
+		rocket_fs_delfile(&fs, log_file);
+	}
+
+	printf("===== Testing multiplexed journals =====\n");
+	Journal journal;
+	Channel channel;
+	uint8_t record[JOURNAL_MAX_RECORD];
+
+	rocket_fs_journal_create(&fs, &journal, "events", RAW);
+
+	for(uint32_t i = 0; i < 8000; i++) {
+		if(i == 5000) { // Appends after a remount
+			rocket_fs_journal_close(&journal);
+			rocket_fs_unmount(&fs);
+			rocket_fs_mount(&fs);
+			rocket_fs_journal_open(&fs, &journal, "events");
+		}
+
+		memset(record, 0xFF, sizeof(record)); // Records ending with erased bytes
+		record[0] = i;
+		record[1] = i >> 8;
+		rocket_fs_journal_write(&journal, i % 100 == 0 ? 2 : i % 2, record, 2 + i % 7);
+	}
+
+	rocket_fs_journal_close(&journal);
+
+	for(uint8_t index = 0; index < 3; index++) {
+		int32_t record_length;
+		uint32_t expected_record = index == 2 ? 0 : (index ? 1 : 2);
+
+		rocket_fs_channel_open(&fs, &channel, "events", index);
+
+		while((record_length = rocket_fs_channel_next(&channel, record)) >= 0) {
+			if((uint32_t) (record[0] | record[1] << 8) != expected_record || record_length != (int32_t) (2 + expected_record % 7)) {
+				printf("Journal content mismatch in channel %d at record %d\n", index, expected_record);
+				break;
+			}
+
+			do { // Next record of the channel
+				expected_record += index == 2 ? 100 : 2;
+			} while(index < 2 && expected_record % 100 == 0);
+		}
+
+		rocket_fs_channel_close(&channel);
+
+		if(expected_record < 8000) {
+			printf("Journal channel %d truncated at record %d\n", index, expected_record);
+		}
+	}
+
+	rocket_fs_delfile(&fs, rocket_fs_getfile(&fs, "events"));
+
+	printf("===== Testing filesystem check =====\n");
+	Fsck fsck;
+	bool consistent = rocket_fs_fsck(&fs, &fsck);
+
+	rocket_fs_newfile(&fs, "fsck", RAW);
+	stream_garbage(&fs, "fsck", 5);
+
+	File* fsck_file = rocket_fs_getfile(&fs, "fsck");
+	uint32_t orphan_block = rfs_partition_find_free(&fs, fs.protected_blocks);
+	uint32_t unclaimed_block = fsck_file->last_block;
+
+	rfs_partition_set(&fs, orphan_block, (RAW << 4) | 0b1100); // Taken, but never chained
+	rfs_partition_set(&fs, unclaimed_block, 0);                 // Chained, but regarded as free
+
+	if(!consistent || rocket_fs_fsck(&fs, &fsck) || fsck.orphan_blocks != 1 || fsck.unclaimed_blocks != 1
+			|| fsck.cycles || fsck.repair_count != 2 || fsck.checked_blocks != fsck.chained_blocks) {
+		printf("Fsck mismatch: %u orphan, %u unclaimed blocks\n", fsck.orphan_blocks, fsck.unclaimed_blocks);
+	}
+
+	rocket_fs_fsck_repair(&fs, &fsck);
+	rocket_fs_unmount(&fs);
+	rocket_fs_mount(&fs);
+
+	if(!rocket_fs_fsck(&fs, &fsck) || rfs_partition_get(&fs, orphan_block) || !rfs_partition_get(&fs, unclaimed_block)) {
+		printf("Fsck repair mismatch\n");
+	}
+
+	validate_garbage(&fs, "fsck");
+	rocket_fs_delfile(&fs, rocket_fs_getfile(&fs, "fsck"));
+
+	printf("===== Testing header cache =====\n");
+	CacheStats cache_before, cache_after;
+	uint8_t stored_header[CACHED_HEADER_SIZE];
+
+	rocket_fs_newfile(&fs, "cached", RAW);
+	rocket_fs_cache_stats(&fs, &cache_before);
+	stream_garbage(&fs, "cached", 9);
+	validate_garbage(&fs, "cached");
+	rocket_fs_cache_stats(&fs, &cache_after);
+
+	uint32_t header_hits = cache_after.header_hits - cache_before.header_hits;
+	uint32_t header_misses = cache_after.header_misses - cache_before.header_misses;
+
+	printf("Header cache: %u hits, %u misses\n", header_hits, header_misses);
+
+	if(header_hits < header_misses) {
+		printf("Poor header cache hit rate\n");
+	}
+
+	for(uint32_t i = 0; i < CACHED_HEADERS; i++) { // The cached headers were kept coherent by the writes and erases
+		CachedHeader* cached = &(fs.header_cache[i]);
+		emu_read(cached->block_id * fs.block_size, stored_header, CACHED_HEADER_SIZE);
+
+		if(cached->loaded && memcmp(cached->header, stored_header, CACHED_HEADER_SIZE)) {
+			printf("Header cache mismatch in block %u\n", cached->block_id);
+		}
+	}
+
+	rocket_fs_delfile(&fs, rocket_fs_getfile(&fs, "cached"));
+
+	printf("===== Testing bulk writes =====\n");
+	static uint8_t bulk_data[4 * FS_SUBSECTOR_SIZE + 100], bulk_readback[4 * FS_SUBSECTOR_SIZE + 100];
+	File* bulk_file = rocket_fs_newfile(&fs, "bulk", RAW);
+
+	for(uint32_t i = 0; i < sizeof(bulk_data); i++) {
+		bulk_data[i] = i * 7 + (i >> 8);
+	}
+
+	rocket_fs_stream(&stream, &fs, bulk_file, OVERWRITE);
+	stream.write(bulk_data, sizeof(bulk_data)); // Spans several blocks in one call
+	stream.close();
+
+	rocket_fs_unmount(&fs);
+	rocket_fs_mount(&fs); // The usage tables programmed with the headers give the length back
+	bulk_file = rocket_fs_getfile(&fs, "bulk");
+	rocket_fs_stream(&stream, &fs, bulk_file, OVERWRITE);
+
+	if(bulk_file->length != sizeof(bulk_data) || stream.read(bulk_readback, sizeof(bulk_readback)) != (int32_t) sizeof(bulk_readback) || memcmp(bulk_data, bulk_readback, sizeof(bulk_data))) {
+		printf("Bulk write mismatch\n");
+	}
+
+	stream.close();
+
+	printf("===== Testing zero-copy reads =====\n");
+	const uint8_t* span;
+	int32_t span_length;
+	uint32_t mapped_length = 0;
+
+	rocket_fs_stream(&stream, &fs, bulk_file, OVERWRITE);
+
+	while((span_length = stream.read_span(&span, FS_SUBSECTOR_SIZE)) > 0) { // Spans end with the data of each block
+		if(span_length > FS_SUBSECTOR_SIZE - BLOCK_HEADER_SIZE || memcmp(span, bulk_data + mapped_length, span_length)) {
+			printf("Zero-copy read mismatch at byte %u\n", mapped_length);
+			break;
+		}
+
+		mapped_length += span_length;
+	}
+
+	if(span_length < 0 || mapped_length != sizeof(bulk_data) || !stream.eof) {
+		printf("Zero-copy read length mismatch: %u bytes read, %u bytes expected\n", mapped_length, (uint32_t) sizeof(bulk_data));
+	}
+
+	stream.close();
+	rocket_fs_delfile(&fs, bulk_file);
+
+	printf("===== Testing striped devices =====\n");
+	FileSystem striped_fs = { 0 };
+
+	rocket_fs_debug(&striped_fs, &debug);
+	rocket_fs_device(&striped_fs, "emulator x2", 2 * FS_ADDRESSABLE_SPACE, FS_SUBSECTOR_SIZE);
+	rocket_fs_bind_device(&striped_fs, 0, emu_devices[1].read, emu_devices[1].write, emu_devices[1].erase_subsector);
+	rocket_fs_bind_device(&striped_fs, 1, emu_devices[2].read, emu_devices[2].write, emu_devices[2].erase_subsector);
+	rocket_fs_mount(&striped_fs);
+
+	static uint8_t striped_data[FS_SUBSECTOR_SIZE];
+	static uint8_t striped_read[FS_SUBSECTOR_SIZE];
+	EmuStats striped_stats[2][2];
+
+	emu_stats(1, &striped_stats[0][0]);
+	emu_stats(2, &striped_stats[0][1]);
+
+	File* striped_file = rocket_fs_newfile(&striped_fs, "striped", RAW);
+	rocket_fs_stream(&stream, &striped_fs, striped_file, OVERWRITE);
+
+	for(uint32_t i = 0; i < 64; i++) {
+		for(uint32_t j = 0; j < sizeof(striped_data); j++) {
+			striped_data[j] = j * 3 + i * 7 + (j >> 8);
+		}
+
+		stream.write(striped_data, sizeof(striped_data));
+	}
+
+	stream.close();
+	emu_stats(1, &striped_stats[1][0]);
+	emu_stats(2, &striped_stats[1][1]);
+
+	uint32_t striped_blocks = 1;
+	uint32_t same_device_blocks = 0;
+
+	for(uint32_t block_id = striped_file->first_block; block_id != striped_file->last_block; striped_blocks++) {
+		uint32_t successor = rfs_block_successor(&striped_fs, block_id);
+
+		same_device_blocks += successor % 2 == block_id % 2;
+		block_id = successor;
+	}
+
+	uint64_t programmed_bytes[2] = {
+		striped_stats[1][0].programmed_bytes - striped_stats[0][0].programmed_bytes,
+		striped_stats[1][1].programmed_bytes - striped_stats[0][1].programmed_bytes
+	};
+
+	printf("Striped chain: %u blocks, %u on the device of their predecessor, %llu / %llu bytes programmed\n", striped_blocks, same_device_blocks,
+			(unsigned long long) programmed_bytes[0], (unsigned long long) programmed_bytes[1]);
+
+	if(same_device_blocks > 0 || programmed_bytes[0] * 10 < programmed_bytes[1] * 9 || programmed_bytes[1] * 10 < programmed_bytes[0] * 9) {
+		printf("Striped chain alternation mismatch\n");
+	}
+
+	rocket_fs_unmount(&striped_fs);
+	rocket_fs_mount(&striped_fs);
+	striped_file = rocket_fs_getfile(&striped_fs, "striped");
+	rocket_fs_stream(&stream, &striped_fs, striped_file, OVERWRITE);
+
+	for(uint32_t i = 0; i < 64; i++) {
+		for(uint32_t j = 0; j < sizeof(striped_data); j++) {
+			striped_data[j] = j * 3 + i * 7 + (j >> 8);
+		}
+
+		if(stream.read(striped_read, sizeof(striped_read)) != sizeof(striped_read) || memcmp(striped_read, striped_data, sizeof(striped_data))) {
+			printf("Striped read mismatch at %u\n", i * (uint32_t) sizeof(striped_data));
+			break;
+		}
+	}
+
+	if(stream.read(striped_read, 1) != 0 || striped_file->length != 64 * sizeof(striped_data)) {
+		printf("Striped length mismatch\n");
+	}
+
+	stream.close();
+	rocket_fs_unmount(&striped_fs);
+
+	printf("===== Testing partitions =====\n");
+	FileSystem config_fs = { 0 };
+	FileSystem bulk_fs = { 0 };
+	Stream config_stream;
+
+	rocket_fs_debug(&config_fs, &debug);
+	rocket_fs_device(&config_fs, "emulator config", FS_ADDRESSABLE_SPACE, FS_SUBSECTOR_SIZE, 0, FS_ADDRESSABLE_SPACE / 16);
+	rocket_fs_bind_device(&config_fs, 0, emu_devices[3].read, emu_devices[3].write, emu_devices[3].erase_subsector);
+	rocket_fs_mount(&config_fs);
+
+	rocket_fs_debug(&bulk_fs, &debug);
+	rocket_fs_device(&bulk_fs, "emulator bulk", FS_ADDRESSABLE_SPACE, FS_SUBSECTOR_SIZE, FS_ADDRESSABLE_SPACE / 16);
+	rocket_fs_bind_device(&bulk_fs, 0, emu_devices[3].read, emu_devices[3].write, emu_devices[3].erase_subsector);
+	rocket_fs_mount(&bulk_fs);
+
+	rocket_fs_stream(&config_stream, &config_fs, rocket_fs_newfile(&config_fs, "config", RAW), OVERWRITE);
+
+	for(uint32_t i = 0; i < 1024; i++) {
+		config_stream.write32(i * 2654435761U);
+	}
+
+	config_stream.close();
+
+	rocket_fs_newfile(&bulk_fs, "bulk", RAW);
+	stream_garbage(&bulk_fs, "bulk", 5);
+
+	rocket_fs_unmount(&config_fs);
+	rocket_fs_unmount(&bulk_fs);
+	rocket_fs_mount(&bulk_fs);
+	rocket_fs_mount(&config_fs);
+
+	validate_garbage(&bulk_fs, "bulk");
+
+	rocket_fs_stream(&config_stream, &config_fs, rocket_fs_getfile(&config_fs, "config"), OVERWRITE);
+
+	for(uint32_t i = 0; i < 1024; i++) {
+		if(config_stream.read32() != (uint32_t) (i * 2654435761U)) {
+			printf("Partition content mismatch at index %d\n", i);
+			break;
+		}
+	}
+
+	config_stream.close();
+
+	rocket_fs_unmount(&config_fs);
+	rocket_fs_unmount(&bulk_fs);
+
+	printf("===== Testing wear levelling =====\n");
+	rocket_fs_mount(&config_fs);
+
+	for(uint32_t i = 0; i < 4 * config_fs.num_blocks; i++) {
+		File* churn = rocket_fs_newfile(&config_fs, "churn", RAW);
+		rocket_fs_delfile(&config_fs, churn);
+	}
+
+	// Every free block should be used in turn: no block is erased much more often than once per sweep.
+	uint32_t free_blocks = config_fs.num_blocks - config_fs.total_used_blocks;
+	uint32_t sweeps = (4 * config_fs.num_blocks + free_blocks - 1) / free_blocks;
+	uint32_t most_worn = 0;
+
+	for(uint32_t block_id = config_fs.protected_blocks; block_id < config_fs.num_blocks; block_id++) {
+		uint32_t erase_count = rocket_fs_erase_count(&config_fs, block_id);
+		most_worn = erase_count > most_worn ? erase_count : most_worn;
+	}
+
+	printf("Most worn data block: %d erases over %d sweeps\n", most_worn, sweeps);
+
+	if(most_worn > sweeps + 1) {
+		printf("Uneven wear detected\n");
+	}
+
+	rocket_fs_unmount(&config_fs);
+
+	printf("===== Testing relative time =====\n");
+	EmuStats aging_before, aging_after;
+
+	rocket_fs_mount(&config_fs);
+
+	uint32_t aged_block = rocket_fs_getfile(&config_fs, "config")->last_block;
+	uint8_t birth_age = rfs_partition_get(&config_fs, aged_block) & 0xF;
+
+	emu_stats(3, &aging_before);
+
+	for(uint8_t i = 0; i < 3; i++) {
+		rfs_partition_advance_time(&config_fs); // Ages all entries
+	}
+
+	rocket_fs_unmount(&config_fs); // Only programs the epoch
+	emu_stats(3, &aging_after);
+	rocket_fs_mount(&config_fs);
+
+	uint8_t aged = rfs_partition_get(&config_fs, aged_block) & 0xF;
+
+	printf("Relative time: %u at birth, %u after 3 epochs, %u programs, %u erases\n", birth_age, aged,
+			aging_after.programs - aging_before.programs, aging_after.erases - aging_before.erases);
+
+	if(aged != birth_age - 3 || aging_after.programs - aging_before.programs > 1 || aging_after.erases != aging_before.erases) {
+		printf("Relative time mismatch\n");
+	}
+
+	for(uint8_t i = 0; i < 40; i++) {
+		rfs_partition_advance_time(&config_fs); // Beyond the epochs programmed in place
+	}
+
+	rocket_fs_unmount(&config_fs);
+	rocket_fs_mount(&config_fs);
+
+	if((rfs_partition_get(&config_fs, aged_block) & 0xF) != 0 || (rfs_partition_get(&config_fs, rocket_fs_getfile(&config_fs, "config")->first_block) & 0xF) != 0xF) {
+		printf("Relative time saturation mismatch\n");
+	}
+
+	rocket_fs_unmount(&config_fs);
+
+#ifdef RFS_NAND
+	printf("===== Testing NAND policy =====\n");
+	FileSystem nor_fs = { 0 }, nand_fs = { 0 };
+	FileSystem* media_fs[2] = { &nor_fs, &nand_fs };
+	EmuStats media_stats[2];
+	static uint8_t video_frame[1000], video_readback[1000];
+	WearStats nand_wear;
+
+	for(uint32_t i = 0; i < sizeof(video_frame); i++) {
+		video_frame[i] = i * 29 + 3;
+	}
+
+	for(uint8_t i = 0; i < 2; i++) {
+		FileSystem* media = media_fs[i];
+		Stream video_stream, log_stream;
+		EmuStats before;
+
+		rocket_fs_debug(media, &debug);
+		rocket_fs_device(media, i ? "emulator NAND" : "emulator NOR", FS_ADDRESSABLE_SPACE, FS_SUBSECTOR_SIZE);
+		rocket_fs_bind_device(media, 0, emu_devices[3].read, emu_devices[3].write, emu_devices[3].erase_subsector);
+		emu_devices[3].erase_subsector(0); // Leftovers of the partitions
+
+		if(i) {
+			emu_nand(3, 512, 4);
+			emu_nand_bad_block(3, 100 * FS_SUBSECTOR_SIZE, true);
+			emu_nand_bad_block(3, 2000 * FS_SUBSECTOR_SIZE, true);
+			rocket_fs_nand(media, 512, 0, emu_devices[3].bad_block, emu_devices[3].failed);
+		}
+
+		emu_stats(3, &before);
+		rocket_fs_mount(media); // Formats
+
+		if(i) {
+			emu_nand_bad_block(3, media->wear_cursor * FS_SUBSECTOR_SIZE, false); // Wears out before its next erase
+		}
+
+		rocket_fs_stream(&video_stream, media, rocket_fs_newfile(media, "video", RAW), OVERWRITE);
+		rocket_fs_stream(&log_stream, media, rocket_fs_newfile(media, "log", RAW), OVERWRITE);
+
+		for(uint32_t frame = 0; frame < 256; frame++) {
+			video_frame[0] = frame;
+			video_stream.write(video_frame, sizeof(video_frame));
+			log_stream.write32(frame);
+			log_stream.write32(frame * 2654435761U);
+		}
+
+		video_stream.close();
+		log_stream.close();
+		rocket_fs_unmount(media);
+
+		emu_stats(3, &media_stats[i]);
+		media_stats[i].programs -= before.programs;
+		media_stats[i].programmed_bytes -= before.programmed_bytes;
+		media_stats[i].violations -= before.violations;
+
+		rocket_fs_mount(media);
+		rocket_fs_stream(&video_stream, media, rocket_fs_getfile(media, "video"), OVERWRITE);
+		rocket_fs_stream(&log_stream, media, rocket_fs_getfile(media, "log"), OVERWRITE);
+
+		for(uint32_t frame = 0; frame < 256; frame++) {
+			video_frame[0] = frame;
+
+			if(video_stream.read(video_readback, sizeof(video_readback)) != (int32_t) sizeof(video_readback) || memcmp(video_frame, video_readback, sizeof(video_frame))
+					|| log_stream.read32() != frame || log_stream.read32() != (uint32_t) (frame * 2654435761U)) {
+				printf("%s content mismatch at frame %u\n", i ? "NAND" : "NOR", frame);
+				break;
+			}
+		}
+
+		video_stream.close();
+		log_stream.close();
+		rocket_fs_wear(media, &nand_wear);
+		rocket_fs_unmount(media);
+	}
+
+	emu_nand(3, 0, 0);
+
+	printf("NOR: %u programs, %llu bytes / NAND: %u programs, %llu bytes, %u bad blocks\n", media_stats[0].programs, (unsigned long long) media_stats[0].programmed_bytes,
+			media_stats[1].programs, (unsigned long long) media_stats[1].programmed_bytes, nand_wear.bad_blocks);
+
+	if(media_stats[1].violations || nand_wear.bad_blocks != 3) {
+		printf("NAND program or bad block mismatch: %u violations\n", media_stats[1].violations);
+	}
+
+	if(media_stats[1].programs >= media_stats[0].programs) {
+		printf("NAND program count mismatch\n");
+	}
+#endif
+
+#ifdef __cpp_impl_coroutine
+	printf("===== Testing coroutine streams =====\n");
+	FileSystem async_fs[2] = { { 0 }, { 0 } };
+	Stream async_streams[2];
+	static uint8_t async_data[64 * FS_SUBSECTOR_SIZE], async_readback[2][64 * FS_SUBSECTOR_SIZE + 1];
+	uint64_t blocking_time, cooperative_time;
+
+	for(uint32_t i = 0; i < sizeof(async_data); i++) {
+		async_data[i] = i * 13 + (i >> 12);
+	}
+
+	emu_devices[1].erase_subsector(0); // Leftovers of the striped filesystem
+	emu_devices[2].erase_subsector(0);
+
+	rocket_fs_debug(&async_fs[0], &debug);
+	rocket_fs_device(&async_fs[0], "emulator async 1", FS_ADDRESSABLE_SPACE, FS_SUBSECTOR_SIZE);
+	rocket_fs_bind(&async_fs[0], &async_read<1>, &async_write<1>, &async_erase<1>, 0, &async_busy<1>);
+	rocket_fs_mount(&async_fs[0]);
+
+	rocket_fs_debug(&async_fs[1], &debug);
+	rocket_fs_device(&async_fs[1], "emulator async 2", FS_ADDRESSABLE_SPACE, FS_SUBSECTOR_SIZE);
+	rocket_fs_bind(&async_fs[1], &async_read<2>, &async_write<2>, &async_erase<2>, 0, &async_busy<2>);
+	rocket_fs_mount(&async_fs[1]);
+
+	async_idle();
+	blocking_time = async_clock; // Blocking writes, one file after the other
+
+	for(uint8_t i = 0; i < 2; i++) {
+		rocket_fs_stream(&async_streams[i], &async_fs[i], rocket_fs_newfile(&async_fs[i], "blocking", RAW), OVERWRITE);
+		async_streams[i].write(async_data, sizeof(async_data));
+		async_streams[i].close();
+	}
+
+	async_idle();
+	blocking_time = async_clock - blocking_time;
+
+	AsyncExecutor executor;
+	cooperative_time = async_clock; // Both files at once, on a single thread
+
+	for(uint8_t i = 0; i < 2; i++) {
+		rocket_fs_stream(&async_streams[i], &async_fs[i], rocket_fs_newfile(&async_fs[i], "cooperative", RAW), OVERWRITE);
+		AsyncTask writer = async_writer(&async_streams[i], async_data, sizeof(async_data));
+		executor.spawn(writer);
+	}
+
+	executor.run(&async_idle);
+	async_idle();
+	cooperative_time = async_clock - cooperative_time;
+
+	printf("Device time: %llu blocking, %llu cooperative\n", (unsigned long long) blocking_time, (unsigned long long) cooperative_time);
+
+	if(cooperative_time * 4 > blocking_time * 3) {
+		printf("Coroutine streams did not overlap the devices\n");
+	}
+
+	for(uint8_t i = 0; i < 2; i++) {
+		async_streams[i].close();
+		rocket_fs_stream(&async_streams[i], &async_fs[i], rocket_fs_getfile(&async_fs[i], "cooperative"), OVERWRITE);
+		AsyncTask reader = async_reader(&async_streams[i], async_data, async_readback[i], sizeof(async_data));
+		executor.spawn(reader);
+	}
+
+	executor.run(&async_idle);
+
+	for(uint8_t i = 0; i < 2; i++) {
+		async_streams[i].close();
+	}
+
+	printf("===== Testing I/O priorities =====\n");
+	AsyncExecutor priority_executor(&async_ticks);
+	Stream bulk_stream, record_stream;
+	uint32_t operations = 0;
+
+	priority_executor.latency[0].budget = 3 * 200 + 100; // An erase ahead of the bulk stream, and two of its own
+
+	rocket_fs_stream(&bulk_stream, &async_fs[0], rocket_fs_newfile(&async_fs[0], "bulk", RAW), OVERWRITE);
+	rocket_fs_stream(&record_stream, &async_fs[0], rocket_fs_newfile(&async_fs[0], "records", RAW), OVERWRITE);
+	rocket_fs_stream(&async_streams[1], &async_fs[1], rocket_fs_newfile(&async_fs[1], "pace", RAW), OVERWRITE);
+
+	AsyncTask bulk_writer = async_writer(&bulk_stream, async_data, sizeof(async_data));
+	AsyncTask recorder = async_recorder(&record_stream, &async_streams[1], async_data, 64);
+	priority_executor.spawn(bulk_writer);
+	priority_executor.spawn(recorder, 0);
+	priority_executor.run(&async_idle);
+
+	for(uint8_t i = 0; i < ASYNC_LATENCY_BUCKETS; i++) {
+		operations += priority_executor.latency[0].histogram[i];
+	}
+
+	printf("Worst latency: %u critical, %u bulk\n", priority_executor.latency[0].worst, priority_executor.latency[ASYNC_PRIORITIES - 1].worst);
+
+	if(operations != 3 * 64 || priority_executor.latency[0].overruns) {
+		printf("Critical latency mismatch (%u operations, %u overruns)\n", operations, priority_executor.latency[0].overruns);
+	}
+
+	if(priority_executor.latency[0].worst >= priority_executor.latency[ASYNC_PRIORITIES - 1].worst) {
+		printf("Bulk latency mismatch\n");
+	}
+
+	bulk_stream.close();
+	record_stream.close();
+	rocket_fs_stream(&bulk_stream, &async_fs[0], rocket_fs_getfile(&async_fs[0], "bulk"), OVERWRITE);
+	rocket_fs_stream(&record_stream, &async_fs[0], rocket_fs_getfile(&async_fs[0], "records"), OVERWRITE);
+
+	if(bulk_stream.read(async_readback[0], sizeof(async_data) + 1) != sizeof(async_data) || memcmp(async_data, async_readback[0], sizeof(async_data))
+	|| record_stream.read(async_readback[1], 64 * 32 + 1) != 64 * 32 || memcmp(async_data, async_readback[1], 64 * 32)) {
+		printf("Prioritized data mismatch\n");
+	}
+
+	bulk_stream.close();
+	record_stream.close();
+	async_streams[1].close();
+
+	printf("===== Testing erase suspension =====\n");
+	uint64_t read_latency[2] = { 0, 0 };
+
+	for(uint8_t run = 0; run < 2; run++) {
+		if(run) { // Same workload, the erases ahead being suspended for the reads
+			for(uint8_t i = 0; i < 2; i++) {
+				rocket_fs_unmount(&async_fs[i]);
+			}
+
+			rocket_fs_bind(&async_fs[0], &async_read<1>, &async_write<1>, &async_erase<1>, 0, &async_busy<1>, &async_suspend<1>, &async_resume<1>);
+			rocket_fs_bind(&async_fs[1], &async_read<2>, &async_write<2>, &async_erase<2>, 0, &async_busy<2>, &async_suspend<2>, &async_resume<2>);
+
+			for(uint8_t i = 0; i < 2; i++) {
+				rocket_fs_mount(&async_fs[i]);
+			}
+		}
+
+		AsyncExecutor suspend_executor;
+
+		rocket_fs_stream(&bulk_stream, &async_fs[0], rocket_fs_newfile(&async_fs[0], run ? "suspended" : "blocking erase", RAW), OVERWRITE);
+		rocket_fs_stream(&record_stream, &async_fs[0], rocket_fs_getfile(&async_fs[0], "records"), OVERWRITE);
+		rocket_fs_stream(&async_streams[1], &async_fs[1], rocket_fs_newfile(&async_fs[1], run ? "pace 1" : "pace 0", RAW), OVERWRITE);
+
+		AsyncTask suspend_writer = async_writer(&bulk_stream, async_data, sizeof(async_data));
+		AsyncTask monitor = async_monitor(&record_stream, &async_streams[1], async_data, async_readback[1], 64, &read_latency[run]);
+		suspend_executor.spawn(suspend_writer);
+		suspend_executor.spawn(monitor, 1);
+		suspend_executor.run(&async_idle);
+
+		bulk_stream.close();
+		rocket_fs_stream(&bulk_stream, &async_fs[0], rocket_fs_getfile(&async_fs[0], run ? "suspended" : "blocking erase"), OVERWRITE);
+
+		if(bulk_stream.read(async_readback[0], sizeof(async_data) + 1) != sizeof(async_data) || memcmp(async_data, async_readback[0], sizeof(async_data))) {
+			printf("Bulk data mismatch under erase suspension\n");
+		}
+
+		bulk_stream.close();
+		record_stream.close();
+		async_streams[1].close();
+	}
+
+	printf("Worst read latency: %llu blocking erases, %llu suspended erases\n", (unsigned long long) read_latency[0], (unsigned long long) read_latency[1]);
+
+	if(read_latency[1] * 4 > read_latency[0]) {
+		printf("Erase suspension latency mismatch\n");
+	}
+
+	for(uint8_t i = 0; i < 2; i++) {
+		rocket_fs_unmount(&async_fs[i]);
+	}
+#endif
+
 	emu_deinit();
 
 	return 0;
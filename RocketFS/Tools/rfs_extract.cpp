@@ -0,0 +1,528 @@
+/*
+ * rfs_extract.cpp
+ *
+ *  Created on: 18 Oct 2026
+ *      Author: Arion
+ */
+
+/*
+ * Host tool which extracts all files of a flash image (Linux).
+ *
+ * Usage: rfs-extract [-c] [-o directory] image [image...]
+ * Striped filesystems are extracted from one image per device, in the order in which the devices were bound.
+ * With -c, the filesystem is checked instead (see fsck.h) and the repairs which the flight software would apply are listed.
+ *
+ * The images are mapped in memory and mounted once, which resolves all chains in a single pass over the block headers.
+ * The blocks of all files are then decoded in parallel and each file is written by its own thread.
+ * The data of RAW and CIRCULAR files is written directly from the mapping; CHECKSUM, ECC, mirrored and COMPRESSED
+ * files are checked or decoded block per block, the corrupted chunks of mirrored files being read from their replicas.
+ * The check walks the chains once and sweeps ranges of blocks in parallel.
+ *
+ * Build with the rfs-extract configuration of the project (the Debug configuration excludes this directory, as this
+ * file defines its own main), or from the RocketFS directory:
+ *   g++ -std=c++17 -O2 -pthread -IInc -IHeaders Src/[a-z]*.cpp Tools/rfs_extract.cpp -o rfs-extract
+ * Images larger than NUM_BLOCKS blocks require the same -DNUM_BLOCKS=... as the flight software.
+ */
+
+#include "block_management.h"
+#include "checksum.h"
+#include "codec.h"
+#include "encoding.h"
+#include "fsck.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct Piece {
+	const uint8_t* data; // Into the mapping or into the decoded buffer
+	uint32_t length;
+	std::vector<uint8_t> decoded;
+} Piece;
+
+typedef struct Extraction {
+	File* file;
+	FileType type;
+	std::vector<uint32_t> blocks;                 // Chain of the file, in order
+	std::vector<uint32_t> mirrors[MAX_REPLICAS];  // Same index as blocks
+	std::vector<Piece> pieces;                    // One per block
+	std::atomic<uint32_t> corrupted_chunks;
+} Extraction;
+
+typedef struct WorkItem {
+	Extraction* extraction;
+	uint32_t index;
+} WorkItem;
+
+/*
+ * Non-exported function prototypes
+ */
+static bool rfs_extract_check(FileSystem* fs);
+static void rfs_extract_chain(FileSystem* fs, File* file, std::vector<uint32_t>* blocks);
+static void rfs_extract_block(FileSystem* fs, Extraction* extraction, uint32_t index);
+static uint32_t rfs_extract_chunks(FileSystem* fs, Extraction* extraction, uint32_t index, uint32_t begin, uint32_t end, Piece* piece);
+static void rfs_extract_frames(FileSystem* fs, uint32_t block_id, uint32_t begin, uint32_t end, Piece* piece);
+static bool rfs_extract_write(const char* directory, Extraction* extraction, uint64_t* written_bytes);
+static const uint8_t* __block_data(FileSystem* fs, uint32_t block_id);
+
+template<uint8_t device> static void __image_read(uint32_t address, uint8_t* buffer, uint32_t length);
+template<uint8_t device> static void __image_write(uint32_t address, uint8_t* buffer, uint32_t length);
+template<uint8_t device> static void __image_erase(uint32_t address);
+
+static uint8_t* images[MAX_DEVICES];
+static uint32_t image_size;
+static uint32_t erase_size;
+
+
+
+int main(int argc, char** argv) {
+	const char* directory = ".";
+	const char* paths[MAX_DEVICES];
+	uint8_t num_devices = 0;
+	bool check = false;
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-o") && i + 1 < argc) {
+			directory = argv[++i];
+		} else if(!strcmp(argv[i], "-c")) {
+			check = true;
+		} else if(num_devices < MAX_DEVICES) {
+			paths[num_devices++] = argv[i];
+		}
+	}
+
+	if(num_devices == 0) {
+		fprintf(stderr, "Usage: %s [-c] [-o directory] image [image...]\n", argv[0]);
+		return 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	for(uint8_t device = 0; device < num_devices; device++) {
+		int descriptor = open(paths[device], O_RDONLY);
+		struct stat status;
+
+		if(descriptor < 0 || fstat(descriptor, &status) < 0 || (device && (uint32_t) status.st_size != image_size)) {
+			fprintf(stderr, "Error: Unable to open %s (all images must have the same size)\n", paths[device]);
+			return 1;
+		}
+
+		image_size = status.st_size;
+
+		/*
+		 * Private writable mapping: what the library would program at mount (e.g. a recovered ring block)
+		 * stays in memory and never reaches the image.
+		 */
+		images[device] = (uint8_t*) mmap(0, image_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, descriptor, 0);
+		close(descriptor);
+
+		if(images[device] == MAP_FAILED) {
+			fprintf(stderr, "Error: Unable to map %s\n", paths[device]);
+			return 1;
+		}
+	}
+
+	// The geometry is read from the core block: magic (8), number of blocks (4), number of files (4), block size (4)
+	uint8_t* core = images[0] + BLOCK_HEADER_SIZE;
+	uint32_t block_size = __decode32(core + 16);
+
+	erase_size = block_size;
+
+	FileSystem* fs = (FileSystem*) calloc(1, sizeof(FileSystem));
+	BlockHeader header;
+
+	void (*reads[MAX_DEVICES])(uint32_t, uint8_t*, uint32_t) = { __image_read<0>, __image_read<1>, __image_read<2>, __image_read<3> };
+	void (*writes[MAX_DEVICES])(uint32_t, uint8_t*, uint32_t) = { __image_write<0>, __image_write<1>, __image_write<2>, __image_write<3> };
+	void (*erases[MAX_DEVICES])(uint32_t) = { __image_erase<0>, __image_erase<1>, __image_erase<2>, __image_erase<3> };
+
+	rocket_fs_device(fs, paths[0], num_devices * image_size, block_size);
+
+	for(uint8_t device = 0; device < num_devices; device++) {
+		rocket_fs_bind_device(fs, device, reads[device], writes[device], erases[device]);
+	}
+
+	if(!fs->device_configured || !rfs_block_read_header(fs, 0, &header)) {
+		fprintf(stderr, "Error: %s is not a RocketFS image\n", paths[0]);
+		return 1;
+	}
+
+	rocket_fs_mount(fs);
+
+	if(!fs->mounted) {
+		fprintf(stderr, "Error: Unable to mount %s (different geometry or format version)\n", paths[0]);
+		return 1;
+	}
+
+	if(check) {
+		return rfs_extract_check(fs) ? 0 : 1;
+	}
+
+	// Chains are resolved from the extents cache filled at mount, on a single thread
+	std::vector<Extraction> extractions(NUM_FILES);
+	std::vector<WorkItem> items;
+
+	for(uint32_t file_id = 0; file_id < NUM_FILES; file_id++) {
+		Extraction* extraction = &(extractions[file_id]);
+		File* file = &(fs->files[file_id]);
+
+		extraction->file = file;
+		extraction->type = file->first_block ? rfs_get_file_type(fs, file) : EMPTY;
+		extraction->corrupted_chunks = 0;
+
+		if(extraction->type == EMPTY || extraction->type == REPLICA) {
+			continue;
+		}
+
+		rfs_extract_chain(fs, file, &(extraction->blocks));
+
+		for(uint8_t i = 0; i < file->replica_count; i++) {
+			rfs_extract_chain(fs, &(fs->files[file->replicas[i]]), &(extraction->mirrors[i]));
+		}
+
+		extraction->pieces.resize(extraction->blocks.size());
+
+		for(uint32_t index = 0; index < extraction->blocks.size(); index++) {
+			items.push_back({ extraction, index });
+		}
+	}
+
+	uint32_t thread_count = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 4;
+	std::vector<std::thread> threads;
+	std::atomic<uint32_t> next_item(0);
+
+	for(uint32_t i = 0; i < thread_count; i++) {
+		threads.emplace_back([&]() {
+			FileSystem* copy = (FileSystem*) malloc(sizeof(FileSystem)); // The header cache is not shared
+
+			memcpy(copy, fs, sizeof(FileSystem));
+
+			for(uint32_t item = next_item++; item < items.size(); item = next_item++) {
+				rfs_extract_block(copy, items[item].extraction, items[item].index);
+			}
+
+			free(copy);
+		});
+	}
+
+	for(std::thread& thread : threads) {
+		thread.join();
+	}
+
+	threads.clear();
+
+	mkdir(directory, 0755);
+
+	std::atomic<uint64_t> total_bytes(0);
+	std::atomic<bool> failed(false);
+
+	for(Extraction& extraction : extractions) {
+		Extraction* written = &extraction;
+
+		if(!extraction.blocks.empty()) {
+			threads.emplace_back([written, directory, &failed, &total_bytes]() {
+				uint64_t written_bytes = 0;
+
+				if(!rfs_extract_write(directory, written, &written_bytes)) {
+					failed = true;
+				}
+
+				total_bytes += written_bytes;
+			});
+		}
+	}
+
+	for(std::thread& thread : threads) {
+		thread.join();
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	for(Extraction& extraction : extractions) {
+		if(!extraction.blocks.empty()) {
+			printf("%-16s %8u blocks", extraction.file->filename, (uint32_t) extraction.blocks.size());
+
+			if(extraction.corrupted_chunks) {
+				printf(" (%u corrupted chunks)", extraction.corrupted_chunks.load());
+			}
+
+			printf("\n");
+		}
+	}
+
+	printf("%llu bytes extracted in %.1f ms\n", (unsigned long long) total_bytes, elapsed * 1e3);
+
+	return failed ? 1 : 0;
+}
+
+
+
+/*
+ * Checks the filesystem: the chains are walked once, then each thread sweeps a range of blocks with its own copy of
+ * the FileSystem, whose partition table and header caches are not shared. Returns true if the filesystem is consistent.
+ */
+static bool rfs_extract_check(FileSystem* fs) {
+	Fsck* fsck = (Fsck*) calloc(1, sizeof(Fsck));
+	uint32_t thread_count = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 4;
+	uint32_t range = (fs->num_blocks + thread_count - 1) / thread_count;
+	std::vector<std::thread> threads;
+	std::vector<Fsck*> parts(thread_count);
+	std::vector<FileSystem*> copies(thread_count);
+
+	auto start = std::chrono::steady_clock::now();
+
+	rfs_fsck_walk(fs, fsck);
+	rocket_fs_flush(fs); // No dirty page may be evicted by the copies
+
+	for(uint32_t i = 0; i < thread_count; i++) {
+		parts[i] = (Fsck*) calloc(1, sizeof(Fsck));
+		copies[i] = (FileSystem*) malloc(sizeof(FileSystem));
+		memcpy(copies[i], fs, sizeof(FileSystem));
+
+		threads.emplace_back([=]() {
+			rfs_fsck_sweep(copies[i], fsck, parts[i], i * range, (i + 1) * range);
+		});
+	}
+
+	for(uint32_t i = 0; i < thread_count; i++) {
+		threads[i].join();
+		rfs_fsck_merge(fsck, parts[i]);
+		free(parts[i]);
+		free(copies[i]);
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%u used blocks, %u chained blocks\n", fsck->checked_blocks, fsck->chained_blocks);
+	printf("%u orphan blocks (%u invalid), %u unclaimed blocks, %u cycles\n", fsck->orphan_blocks, fsck->invalid_blocks, fsck->unclaimed_blocks, fsck->cycles);
+
+	for(uint16_t i = 0; i < fsck->repair_count; i++) {
+		FsckRepair* repair = &(fsck->repairs[i]);
+		printf("%s block %u (file %u)\n", repair->action == FSCK_FREE_BLOCK ? "Free" : "Claim", repair->block_id, repair->file_id);
+	}
+
+	if(fsck->dropped_repairs) {
+		printf("%u more repairs\n", fsck->dropped_repairs);
+	}
+
+	printf("Checked in %.1f ms\n", elapsed * 1e3);
+
+	bool consistent = !fsck->orphan_blocks && !fsck->unclaimed_blocks && !fsck->cycles;
+
+	free(fsck);
+
+	return consistent;
+}
+
+/*
+ * Lists the blocks of the file from its first data block to its last block.
+ */
+static void rfs_extract_chain(FileSystem* fs, File* file, std::vector<uint32_t>* blocks) {
+	uint32_t block_id = file->first_block;
+
+	if(rfs_get_file_type(fs, file) == CIRCULAR) {
+		block_id = file->head_block; // The root of a ring holds no data
+	}
+
+	while(block_id && blocks->size() < fs->num_blocks) {
+		blocks->push_back(block_id);
+
+		if(block_id == file->last_block) {
+			break;
+		}
+
+		block_id = rfs_block_successor(fs, block_id);
+	}
+}
+
+/*
+ * Decodes the data of a block into its piece. Runs concurrently, with a copy of the FileSystem: only reads the mapping and the resolved chains.
+ */
+static void rfs_extract_block(FileSystem* fs, Extraction* extraction, uint32_t index) {
+	File* file = extraction->file;
+	uint32_t block_id = extraction->blocks[index];
+	uint32_t begin = block_id == file->first_block ? BLOCK_HEADER_SIZE + 16 : BLOCK_HEADER_SIZE; // After the filename
+	uint32_t end = block_id == file->last_block ? file->tail_offset : rfs_compute_block_length(fs, block_id);
+	Piece* piece = &(extraction->pieces[index]);
+
+	piece->data = 0;
+	piece->length = 0;
+
+	if(end <= begin) {
+		return;
+	}
+
+	if(rfs_chunk_type(extraction->type)) {
+		uint32_t corrupted_chunks = rfs_extract_chunks(fs, extraction, index, begin, end, piece);
+
+		extraction->corrupted_chunks += corrupted_chunks;
+	} else if(extraction->type == COMPRESSED) {
+		rfs_extract_frames(fs, block_id, begin, end, piece);
+	} else {
+		piece->data = __block_data(fs, block_id) + begin; // Zero-copy
+		piece->length = end - begin;
+	}
+}
+
+/*
+ * Checks (and corrects) each chunk as a stream does, falling back on the copies of mirrored files.
+ * Returns the number of chunks which could not be verified.
+ */
+static uint32_t rfs_extract_chunks(FileSystem* fs, Extraction* extraction, uint32_t index, uint32_t begin, uint32_t end, Piece* piece) {
+	uint32_t block_id = extraction->blocks[index];
+	uint32_t chunk_size = rfs_chunk_size(extraction->type);
+	uint32_t data_end = rfs_chunk_data_end(extraction->type);
+	uint32_t corrupted_chunks = 0;
+	uint8_t chunk[CHECKSUM_CHUNK_SIZE];
+
+	piece->decoded.reserve(end - begin);
+
+	for(uint32_t offset = begin - begin % chunk_size; offset < end; offset += chunk_size) {
+		uint32_t chunk_address = block_id * fs->block_size + offset;
+		uint32_t first = offset < begin ? begin - offset : rfs_chunk_data_begin(fs, chunk_address);
+		uint32_t last = end - offset < data_end ? end - offset : data_end;
+
+		memcpy(chunk, __block_data(fs, block_id) + offset, chunk_size);
+
+		if(rfs_chunk_check(fs, extraction->type, chunk_address, chunk) < 0) {
+			bool recovered = false;
+
+			for(uint8_t i = 0; i < extraction->file->replica_count && !recovered; i++) {
+				if(index < extraction->mirrors[i].size()) {
+					uint32_t mirror_block = extraction->mirrors[i][index];
+
+					memcpy(chunk, __block_data(fs, mirror_block) + offset, chunk_size);
+					recovered = rfs_chunk_check(fs, extraction->type, mirror_block * fs->block_size + offset, chunk) >= 0;
+				}
+			}
+
+			corrupted_chunks += recovered ? 0 : 1;
+		}
+
+		if(last > rfs_chunk_fill(extraction->type, chunk)) {
+			last = rfs_chunk_fill(extraction->type, chunk); // Sealed when its stream was closed
+		}
+
+		if(first < last) {
+			piece->decoded.insert(piece->decoded.end(), chunk + first, chunk + last);
+		}
+	}
+
+	piece->data = piece->decoded.data();
+	piece->length = piece->decoded.size();
+
+	return corrupted_chunks;
+}
+
+/*
+ * Decodes the frames of a block, whose history starts cleared (see codec.cpp).
+ */
+static void rfs_extract_frames(FileSystem* fs, uint32_t block_id, uint32_t begin, uint32_t end, Piece* piece) {
+	const uint8_t* block = __block_data(fs, block_id);
+	uint32_t history[CODEC_FRAME_WORDS] = { 0 };
+	uint8_t raw[STREAM_CHUNK_SIZE];
+	uint32_t offset = begin;
+
+	while(offset < end) {
+		if(block[offset] == CODEC_PADDING) {
+			offset += STREAM_CHUNK_SIZE - offset % STREAM_CHUNK_SIZE;
+			continue;
+		}
+
+		uint32_t decoded_length;
+		int32_t frame_length = rfs_codec_decode(history, block + offset, end - offset, raw, &decoded_length);
+
+		if(frame_length < 0) {
+			fprintf(stderr, "Warning: Corrupted frame in block %u\n", block_id);
+			break; // The stream resumes with the next block as well
+		}
+
+		piece->decoded.insert(piece->decoded.end(), raw, raw + decoded_length);
+		offset += frame_length;
+	}
+
+	piece->data = piece->decoded.data();
+	piece->length = piece->decoded.size();
+}
+
+static bool rfs_extract_write(const char* directory, Extraction* extraction, uint64_t* written_bytes) {
+	char path[4096];
+	char filename[16];
+
+	filename_copy(extraction->file->filename, filename);
+
+	for(char* character = filename; *character; character++) {
+		*character = *character == '/' ? '_' : *character;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", directory, filename);
+
+	int descriptor = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if(descriptor < 0) {
+		fprintf(stderr, "Error: Unable to create %s\n", path);
+		return false;
+	}
+
+	for(Piece& piece : extraction->pieces) {
+		uint32_t index = 0;
+
+		while(index < piece.length) {
+			ssize_t length = write(descriptor, piece.data + index, piece.length - index);
+
+			if(length <= 0) {
+				fprintf(stderr, "Error: Unable to write %s\n", path);
+				close(descriptor);
+				return false;
+			}
+
+			index += length;
+		}
+
+		*written_bytes += piece.length;
+	}
+
+	close(descriptor);
+
+	return true;
+}
+
+/*
+ * Returns the block in the mapping of its device (see device.cpp).
+ */
+static const uint8_t* __block_data(FileSystem* fs, uint32_t block_id) {
+	return images[block_id % fs->num_devices] + (uint64_t) (block_id / fs->num_devices) * fs->block_size;
+}
+
+
+
+/*
+ * Device callbacks of the mapped images
+ */
+template<uint8_t device> static void __image_read(uint32_t address, uint8_t* buffer, uint32_t length) {
+	if(address + length <= image_size) {
+		memcpy(buffer, images[device] + address, length);
+	} else {
+		memset(buffer, 0xFF, length);
+	}
+}
+
+template<uint8_t device> static void __image_write(uint32_t address, uint8_t* buffer, uint32_t length) {
+	for(uint32_t i = 0; i < length && address + i < image_size; i++) {
+		images[device][address + i] &= buffer[i];
+	}
+}
+
+template<uint8_t device> static void __image_erase(uint32_t address) {
+	if(address < image_size) {
+		memset(images[device] + address, 0xFF, image_size - address < erase_size ? image_size - address : erase_size);
+	}
+}